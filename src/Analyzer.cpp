@@ -0,0 +1,283 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#include <algorithm>
+
+#include "Analyzer.h"
+
+
+Analyzer::Analyzer(FFMPEG *_f, AVStream *_video_stream, double _max_seconds, double _confidence, D2V::LoggingFunction _log_message)
+    : f(_f)
+    , video_stream(_video_stream)
+    , max_seconds(_max_seconds)
+    , confidence(_confidence)
+    , log_message(_log_message)
+    , gop{ }
+    , gop_closed(false)
+    , fields(0)
+    , frame_classes{ 0, 0, 0 }
+    , have_previous_frame(false)
+    , previous_tff(false)
+    , previous_rff(false)
+    , previous_progressive(false)
+    , alternating_rff_frames(0)
+    , cadence_breaks(0)
+    , field_order_changes(0)
+    , gops(0)
+    , closed_gops(0)
+    , gop_lengths{ }
+    , anchor_distances{ }
+    , stopped_early(false)
+    , stop_reason{ }
+{ }
+
+
+const D2V::Stats &Analyzer::getStats() const {
+    return stats;
+}
+
+
+const std::string &Analyzer::getError() const {
+    return error;
+}
+
+
+double Analyzer::getSeconds() const {
+    AVRational frame_rate = video_stream->codec->framerate;
+    if (frame_rate.num <= 0 || frame_rate.den <= 0)
+        frame_rate = { 25, 1 };
+
+    return (double)fields * frame_rate.den / (2.0 * frame_rate.num);
+}
+
+
+bool Analyzer::isConfident() const {
+    int classified = frame_classes[CLASS_PROGRESSIVE] + frame_classes[CLASS_TELECINE] + frame_classes[CLASS_INTERLACED];
+
+    // Too few frames to say anything.
+    if (classified < 100)
+        return false;
+
+    int dominant = *std::max_element(frame_classes, frame_classes + 3);
+
+    return (double)dominant / classified >= confidence;
+}
+
+
+void Analyzer::analyzeFrame(const Picture &picture) {
+    if (have_previous_frame) {
+        // After a repeated field, the next frame starts with the other field.
+        bool expected_tff = previous_rff ? !previous_tff : previous_tff;
+        if (picture.top_field_first != expected_tff)
+            field_order_changes++;
+
+        if (previous_progressive && picture.progressive_frame) {
+            if (picture.repeat_first_field != previous_rff) {
+                alternating_rff_frames++;
+            } else {
+                if (alternating_rff_frames >= 4)
+                    cadence_breaks++;
+                alternating_rff_frames = 0;
+            }
+        } else {
+            if (alternating_rff_frames >= 4)
+                cadence_breaks++;
+            alternating_rff_frames = 0;
+        }
+    }
+
+    int frame_class = CLASS_INTERLACED;
+    if (picture.progressive_frame) {
+        if (picture.repeat_first_field || alternating_rff_frames >= 2)
+            frame_class = CLASS_TELECINE;
+        else
+            frame_class = CLASS_PROGRESSIVE;
+    }
+    frame_classes[frame_class]++;
+
+    have_previous_frame = true;
+    previous_tff = picture.top_field_first;
+    previous_rff = picture.repeat_first_field;
+    previous_progressive = picture.progressive_frame;
+}
+
+
+void Analyzer::finishGOP() {
+    if (!gop.size())
+        return;
+
+    gops++;
+    if (gop_closed)
+        closed_gops++;
+    gop_lengths[gop.size()]++;
+
+    // In coded order, the B pictures displayed before an anchor picture come right after it.
+    for (size_t i = 0; i < gop.size(); i++) {
+        if (gop[i].type == MPEGParser::B_PICTURE)
+            continue;
+
+        if (i == 0 && gop_closed)
+            continue;
+
+        int b_pictures = 0;
+        while (i + 1 + b_pictures < gop.size() && gop[i + 1 + b_pictures].type == MPEGParser::B_PICTURE)
+            b_pictures++;
+
+        anchor_distances[b_pictures + 1]++;
+    }
+
+    std::stable_sort(gop.begin(), gop.end(), [] (const Picture &a, const Picture &b) {
+        return a.temporal_reference < b.temporal_reference;
+    });
+
+    for (size_t i = 0; i < gop.size(); i++)
+        analyzeFrame(gop[i]);
+
+    gop.clear();
+}
+
+
+bool Analyzer::engage() {
+    AVPacket packet;
+    av_init_packet(&packet);
+
+    while (av_read_frame(f->fctx, &packet) == 0) {
+        if (packet.stream_index != video_stream->index) {
+            av_free_packet(&packet);
+            continue;
+        }
+
+        parser.parseData(packet.data, packet.size);
+
+        av_free_packet(&packet);
+
+        if (parser.width <= 0 || parser.height <= 0) {
+            if (log_message)
+                log_message("Skipping frame with invalid dimensions " + std::to_string(parser.width) + "x" + std::to_string(parser.height) + ".");
+
+            continue;
+        }
+
+        if (parser.picture_coding_type < MPEGParser::I_PICTURE || parser.picture_coding_type > MPEGParser::B_PICTURE) {
+            if (log_message)
+                log_message("Skipping unknown picture type " + std::to_string(parser.picture_coding_type) + ".");
+
+            continue;
+        }
+
+        // Like in the D2V file, every I picture starts a new line.
+        if (parser.picture_coding_type == MPEGParser::I_PICTURE) {
+            finishGOP();
+
+            gop_closed = parser.group_of_pictures_header && parser.closed_gop;
+        }
+
+        Picture picture;
+        picture.type = parser.picture_coding_type;
+        picture.temporal_reference = parser.temporal_reference;
+        picture.top_field_first = parser.top_field_first;
+        picture.repeat_first_field = parser.repeat_first_field;
+        picture.progressive_frame = parser.progressive_sequence || parser.progressive_frame;
+        gop.push_back(picture);
+
+        stats.video_frames++;
+        if (picture.progressive_frame)
+            stats.progressive_frames++;
+        if (picture.top_field_first)
+            stats.tff_frames++;
+        if (picture.repeat_first_field)
+            stats.rff_frames++;
+
+        fields += picture.repeat_first_field ? 3 : 2;
+
+        if (max_seconds > 0 && getSeconds() >= max_seconds) {
+            stopped_early = true;
+            stop_reason = "analyzed " + std::to_string((int)max_seconds) + " seconds";
+            break;
+        }
+
+        if (confidence > 0 && isConfident()) {
+            stopped_early = true;
+            stop_reason = "confidence reached";
+            break;
+        }
+    }
+
+    finishGOP();
+
+    if (!stats.video_frames) {
+        error = "No video frames found.";
+        return false;
+    }
+
+    return true;
+}
+
+
+std::string Analyzer::getReport() const {
+    const char *class_names[3] = {
+        "progressive",
+        "soft telecine",
+        "interlaced"
+    };
+
+    int classified = frame_classes[CLASS_PROGRESSIVE] + frame_classes[CLASS_TELECINE] + frame_classes[CLASS_INTERLACED];
+
+    int dominant_class = std::max_element(frame_classes, frame_classes + 3) - frame_classes;
+
+    std::string verdict = "mixed";
+    if (classified && (double)frame_classes[dominant_class] / classified >= 0.9)
+        verdict = class_names[dominant_class];
+
+    char seconds[50] = { 0 };
+    snprintf(seconds, 50, "%.2f", getSeconds());
+
+    std::string report;
+
+    report += "Video frames seen:   " + std::to_string(stats.video_frames) + "\n";
+    report += "    Progressive:     " + std::to_string(stats.progressive_frames) + "\n";
+    report += "    Top field first: " + std::to_string(stats.tff_frames) + "\n";
+    report += "    Repeat:          " + std::to_string(stats.rff_frames) + "\n";
+    report += "Seconds analyzed:    " + std::string(seconds) + "\n";
+    if (stopped_early)
+        report += "Stopped early:       " + stop_reason + "\n";
+    report += "\n";
+
+    report += "Frame classes:\n";
+    for (int i = 0; i < 3; i++) {
+        char percent[50] = { 0 };
+        snprintf(percent, 50, "%.1f", classified ? frame_classes[i] * 100.0 / classified : 0.0);
+        report += "    " + std::string(class_names[i]) + ": " + std::to_string(frame_classes[i]) + " (" + percent + "%)\n";
+    }
+    report += "Verdict:             " + verdict + "\n";
+    report += "Cadence breaks:      " + std::to_string(cadence_breaks) + "\n";
+    report += "Field order changes: " + std::to_string(field_order_changes) + "\n";
+    report += "\n";
+
+    report += "GOPs:                " + std::to_string(gops) + " (" + std::to_string(closed_gops) + " closed)\n";
+    report += "GOP lengths (frames: GOPs):\n";
+    for (auto it = gop_lengths.cbegin(); it != gop_lengths.cend(); it++)
+        report += "    " + std::to_string(it->first) + ": " + std::to_string(it->second) + "\n";
+    report += "Anchor picture distances (M: anchors):\n";
+    for (auto it = anchor_distances.cbegin(); it != anchor_distances.cend(); it++)
+        report += "    " + std::to_string(it->first) + ": " + std::to_string(it->second) + "\n";
+
+    return report;
+}
@@ -0,0 +1,114 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#ifndef D2V_WITCH_ANALYZER_H
+#define D2V_WITCH_ANALYZER_H
+
+
+#include <map>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include "D2V.h"
+#include "FFMPEG.h"
+#include "MPEGParser.h"
+
+
+// Looks at the picture headers of the video track, without writing
+// anything, in order to tell whether it's progressive, interlaced, or
+// soft telecined. It can stop as soon as the answer is clear enough.
+class Analyzer {
+public:
+    enum FrameClasses {
+        CLASS_PROGRESSIVE = 0,
+        CLASS_TELECINE = 1,
+        CLASS_INTERLACED = 2
+    };
+
+    // max_seconds <= 0 and confidence <= 0 mean there is no limit.
+    Analyzer(FFMPEG *_f, AVStream *_video_stream, double _max_seconds, double _confidence, D2V::LoggingFunction _log_message);
+
+    const D2V::Stats &getStats() const;
+
+    const std::string &getError() const;
+
+    bool engage();
+
+    std::string getReport() const;
+
+private:
+    struct Picture {
+        int type;
+        int temporal_reference;
+        bool top_field_first;
+        bool repeat_first_field;
+        bool progressive_frame;
+    };
+
+    FFMPEG *f;
+    AVStream *video_stream;
+    double max_seconds;
+    double confidence;
+    D2V::LoggingFunction log_message;
+
+    MPEGParser parser;
+
+    // The current GOP, in coded order.
+    std::vector<Picture> gop;
+    bool gop_closed;
+
+    D2V::Stats stats;
+    int64_t fields;
+    int frame_classes[3];
+
+    bool have_previous_frame;
+    bool previous_tff;
+    bool previous_rff;
+    bool previous_progressive;
+    int alternating_rff_frames;
+
+    int cadence_breaks;
+    int field_order_changes;
+    int gops;
+    int closed_gops;
+    std::map<int, int> gop_lengths;
+    std::map<int, int> anchor_distances;
+
+    bool stopped_early;
+    std::string stop_reason;
+
+    std::string error;
+
+
+    void finishGOP();
+
+    void analyzeFrame(const Picture &picture);
+
+    bool isConfident() const;
+
+    double getSeconds() const;
+};
+
+
+#endif // D2V_WITCH_ANALYZER_H
@@ -0,0 +1,230 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+
+#include "AudioIndex.h"
+#include "Bullshit.h"
+
+
+static void writeInt(uint8_t *buffer, int64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++)
+        buffer[i] = (uint8_t)((uint64_t)value >> (i * 8));
+}
+
+
+static int64_t readInt(const uint8_t *buffer, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+        value |= (uint64_t)buffer[i] << (i * 8);
+
+    // Sign extension for the 32 bit numbers.
+    if (bytes < 8 && (value >> (bytes * 8 - 1)) & 1)
+        value |= ~(uint64_t)0 << (bytes * 8);
+
+    return (int64_t)value;
+}
+
+
+AudioIndex::AudioIndex(int _interval)
+    : interval(_interval)
+    , time_base{ 1, 1 }
+    , sample_rate(0)
+{ }
+
+
+bool AudioIndex::addTrack(int stream_index, FILE *file, const AVStream *stream) {
+    Track track;
+    track.file = file;
+    track.time_base = stream->time_base;
+    track.sample_rate = stream->codec->sample_rate;
+    track.frame_size = stream->codec->frame_size;
+    track.offset = 0;
+    track.sample = 0;
+    track.frames = 0;
+
+    std::string header;
+    header += "D2VWitch audio index 1\n";
+    header += "time_base=" + std::to_string(track.time_base.num) + "/" + std::to_string(track.time_base.den) + "\n";
+    header += "sample_rate=" + std::to_string(track.sample_rate) + "\n";
+    header += "interval=" + std::to_string(interval) + "\n";
+    header += "\n";
+
+    if (fwrite(header.data(), 1, header.size(), file) < header.size()) {
+        error = "Failed to write audio index header: fwrite() failed.";
+        return false;
+    }
+
+    tracks.insert({ stream_index, track });
+
+    return true;
+}
+
+
+bool AudioIndex::addPacket(const AVPacket *packet) {
+    auto it = tracks.find(packet->stream_index);
+    if (it == tracks.end())
+        return true;
+
+    Track &track = it->second;
+
+    // The demuxer's duration is more reliable than the codec's frame size,
+    // which is unknown for some codecs.
+    int64_t samples = track.frame_size;
+    if (packet->duration > 0 && track.sample_rate > 0)
+        samples = av_rescale_q(packet->duration, track.time_base, AVRational{ 1, track.sample_rate });
+
+    if (track.frames % interval == 0) {
+        uint8_t record[RECORD_SIZE];
+        writeInt(record, track.offset, 8);
+        writeInt(record + 8, packet->pts == AV_NOPTS_VALUE ? INT64_MIN : packet->pts, 8);
+        writeInt(record + 16, track.sample, 8);
+        writeInt(record + 24, samples, 4);
+
+        if (fwrite(record, 1, RECORD_SIZE, track.file) < RECORD_SIZE) {
+            error = "Failed to write audio index entry: fwrite() failed.";
+            return false;
+        }
+    }
+
+    track.offset += packet->size;
+    track.sample += samples;
+    track.frames++;
+
+    return true;
+}
+
+
+bool AudioIndex::read(const std::string &path) {
+    entries.clear();
+    pts_order.clear();
+
+    FILE *file = openFile(path.c_str(), "rb");
+    if (!file) {
+        error = "Failed to open audio index '" + path + "': " + strerror(errno);
+        return false;
+    }
+
+    bool okay = true;
+
+    char line[512];
+    for (int line_number = 0; okay; line_number++) {
+        if (!fgets(line, sizeof(line), file)) {
+            error = "The file is truncated.";
+            okay = false;
+            break;
+        }
+
+        std::string text(line);
+        while (text.size() && (text.back() == '\n' || text.back() == '\r'))
+            text.pop_back();
+
+        if (line_number == 0) {
+            if (text != "D2VWitch audio index 1") {
+                error = "Not an audio index, or an unsupported version.";
+                okay = false;
+            }
+        } else if (!text.size()) {
+            break;
+        } else if (text.compare(0, 10, "time_base=") == 0) {
+            if (sscanf(text.c_str() + 10, "%d/%d", &time_base.num, &time_base.den) != 2 || time_base.num <= 0 || time_base.den <= 0) {
+                error = "Invalid time base '" + text + "'.";
+                okay = false;
+            }
+        } else if (text.compare(0, 12, "sample_rate=") == 0) {
+            if (sscanf(text.c_str() + 12, "%d", &sample_rate) != 1 || sample_rate < 0) {
+                error = "Invalid sample rate '" + text + "'.";
+                okay = false;
+            }
+        }
+        // Unknown lines are ignored, for the benefit of future versions.
+    }
+
+    uint8_t record[RECORD_SIZE];
+    size_t length;
+    while (okay && (length = fread(record, 1, RECORD_SIZE, file)) > 0) {
+        if (length < RECORD_SIZE) {
+            error = "The file is truncated.";
+            okay = false;
+            break;
+        }
+
+        Entry entry;
+        entry.offset = readInt(record, 8);
+        entry.pts = readInt(record + 8, 8);
+        entry.sample = readInt(record + 16, 8);
+        entry.samples = (int32_t)readInt(record + 24, 4);
+
+        entries.push_back(entry);
+    }
+
+    fclose(file);
+
+    for (size_t i = 0; i < entries.size(); i++)
+        if (entries[i].pts != INT64_MIN)
+            pts_order.push_back(i);
+
+    // Entries with the same pts stay in file order.
+    std::stable_sort(pts_order.begin(), pts_order.end(), [this] (size_t a, size_t b) {
+        return entries[a].pts < entries[b].pts;
+    });
+
+    return okay;
+}
+
+
+AVRational AudioIndex::getTimeBase() const {
+    return time_base;
+}
+
+
+int AudioIndex::getSampleRate() const {
+    return sample_rate;
+}
+
+
+const AudioIndex::Entry *AudioIndex::findSample(int64_t sample) const {
+    auto it = std::upper_bound(entries.cbegin(), entries.cend(), sample, [] (int64_t value, const Entry &entry) {
+        return value < entry.sample;
+    });
+
+    if (it == entries.cbegin())
+        return nullptr;
+
+    return &*(it - 1);
+}
+
+
+const AudioIndex::Entry *AudioIndex::findPts(int64_t pts) const {
+    auto it = std::upper_bound(pts_order.cbegin(), pts_order.cend(), pts, [this] (int64_t value, size_t index) {
+        return value < entries[index].pts;
+    });
+
+    if (it == pts_order.cbegin())
+        return nullptr;
+
+    return &entries[*(it - 1)];
+}
+
+
+const std::string &AudioIndex::getError() const {
+    return error;
+}
@@ -0,0 +1,117 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#ifndef D2V_WITCH_AUDIOINDEX_H
+#define D2V_WITCH_AUDIOINDEX_H
+
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/avutil.h>
+}
+
+
+// Seek indexes for the demuxed audio files, so that players can find a
+// position without reading the audio from the start.
+//
+// Each sidecar file starts with a few text lines:
+//
+//   D2VWitch audio index 1
+//   time_base=1/90000
+//   sample_rate=48000
+//   interval=<n>
+//   <empty line>
+//
+// followed by one 28 byte record for every interval-th audio frame: the
+// frame's byte offset in the audio file, its pts in the time base (or
+// INT64_MIN if it has none), the number of samples before it, all three
+// as 64 bit integers, and its number of samples as a 32 bit integer. All
+// little endian. The records are sorted by offset and by sample, so they
+// can be searched with a binary search.
+class AudioIndex {
+public:
+    struct Entry {
+        int64_t offset;
+        int64_t pts;
+        int64_t sample;
+        int32_t samples;
+    };
+
+    enum {
+        RECORD_SIZE = 28
+    };
+
+    // Every interval-th audio frame gets an entry.
+    AudioIndex(int _interval);
+
+    // Writes the header. Called once per audio stream, before its packets.
+    bool addTrack(int stream_index, FILE *file, const AVStream *stream);
+
+    // Called with every audio packet right after it was written.
+    bool addPacket(const AVPacket *packet);
+
+    bool read(const std::string &path);
+
+    AVRational getTimeBase() const;
+
+    int getSampleRate() const;
+
+    // Only work after read(). Return the last entry at or before the
+    // given sample or pts, or nullptr. If the timestamps jump backwards
+    // somewhere, findPts() may return an entry from either side.
+    const Entry *findSample(int64_t sample) const;
+
+    const Entry *findPts(int64_t pts) const;
+
+    const std::string &getError() const;
+
+private:
+    struct Track {
+        FILE *file;
+        AVRational time_base;
+        int sample_rate;
+        int frame_size;
+        int64_t offset;
+        int64_t sample;
+        int64_t frames;
+    };
+
+    int interval;
+    std::unordered_map<int, Track> tracks;
+
+    // Filled by read().
+    AVRational time_base;
+    int sample_rate;
+    std::vector<Entry> entries;
+    // Indices of the entries with a pts, sorted by pts.
+    std::vector<size_t> pts_order;
+
+    std::string error;
+};
+
+
+#endif // D2V_WITCH_AUDIOINDEX_H
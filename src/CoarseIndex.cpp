@@ -0,0 +1,228 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+
+#include "CoarseIndex.h"
+#include "MPEGParser.h"
+
+
+// Bytes read at every sample. Big enough to contain a GOP header in most
+// streams, small enough to be quick even on slow disks.
+static const int window_size = 512 * 1024;
+
+
+static double getFrameRate(int frame_rate_code) {
+    static const double frame_rates[9] = {
+        0, 24000.0 / 1001, 24, 25, 30000.0 / 1001, 30, 50, 60000.0 / 1001, 60
+    };
+
+    if (frame_rate_code < 1 || frame_rate_code > 8)
+        return 0;
+
+    return frame_rates[frame_rate_code];
+}
+
+
+// data points right after the start code of a video PES packet (0xe0..0xef).
+// Only the MPEG-2 PES header syntax is understood.
+static bool getPESTimestamp(const uint8_t *data, const uint8_t *data_end, int64_t *pts) {
+    if (data_end - data < 10)
+        return false;
+
+    // '10' marker bits and the PTS_DTS_flags.
+    if ((data[2] & 0xc0) != 0x80 || !(data[3] & 0x80))
+        return false;
+
+    const uint8_t *p = data + 5;
+
+    *pts = ((int64_t)(p[0] & 0x0e) << 29) |
+           ((int64_t)p[1] << 22) |
+           ((int64_t)(p[2] & 0xfe) << 14) |
+           ((int64_t)p[3] << 7) |
+           (p[4] >> 1);
+
+    return true;
+}
+
+
+CoarseIndex::CoarseIndex(const FakeFile &_files, int _samples)
+    : files{ }
+    , samples(_samples)
+    , entries{ }
+    , error{ }
+{
+    for (auto it = _files.cbegin(); it != _files.cend(); it++)
+        files.push_back(it->name);
+}
+
+
+bool CoarseIndex::build() {
+    entries.clear();
+
+    FakeFile fake_file;
+    for (size_t i = 0; i < files.size(); i++)
+        fake_file.push_back(files[i]);
+
+    if (!fake_file.open()) {
+        error = fake_file.getError();
+        fake_file.close();
+        return false;
+    }
+
+    int64_t total_size = fake_file.getTotalSize();
+
+    std::vector<uint8_t> buffer(window_size);
+
+    double frame_rate = 0;
+    // In bits per second.
+    double bitrate = 0;
+    int64_t first_pts = -1;
+
+    for (int i = 0; i < samples; i++) {
+        int64_t offset = total_size * i / samples;
+
+        if (entries.size() && offset <= entries.back().position)
+            continue;
+
+        if (FakeFile::seek(&fake_file, offset, SEEK_SET) < 0) {
+            error = "Failed to seek to " + std::to_string(offset) + ": " + fake_file.getError();
+            fake_file.close();
+            return false;
+        }
+
+        int bytes_read = FakeFile::readPacket(&fake_file, buffer.data(), buffer.size());
+        if (bytes_read < 0) {
+            error = "Failed to read at " + std::to_string(offset) + ": " + fake_file.getError();
+            fake_file.close();
+            return false;
+        }
+
+        const uint8_t *data = buffer.data();
+        const uint8_t *data_end = data + bytes_read;
+
+        bool have_pts = false;
+        int64_t pts = 0;
+
+        while (data < data_end) {
+            uint32_t start_code = 0xffffffff;
+            data = MPEGParser::findStartCode(data, data_end, &start_code);
+
+            if (start_code >= 0xe0 && start_code <= 0xef) {
+                have_pts = getPESTimestamp(data, data_end, &pts);
+            } else if (start_code == MPEGParser::SEQUENCE_HEADER_CODE || start_code == MPEGParser::GROUP_START_CODE) {
+                if (start_code == MPEGParser::SEQUENCE_HEADER_CODE && data_end - data >= 7 && !frame_rate) {
+                    frame_rate = getFrameRate(data[3] & 0xf);
+
+                    int bit_rate_value = (data[4] << 10) | (data[5] << 2) | (data[6] >> 6);
+                    // 0x3ffff means variable bitrate.
+                    if (bit_rate_value != 0x3ffff)
+                        bitrate = bit_rate_value * 400.0;
+                }
+
+                Entry entry;
+                entry.position = offset + (data - 4 - buffer.data());
+                entry.file = fake_file.getFileIndex(entry.position);
+                entry.file_position = fake_file.getPositionInRealFile(entry.position);
+                entry.frame = -1;
+                entry.from_timestamp = false;
+
+                if (have_pts && first_pts == -1 && entries.empty())
+                    first_pts = pts;
+
+                if (frame_rate > 0) {
+                    if (have_pts && first_pts != -1) {
+                        // The PTS is 33 bits and wraps around.
+                        int64_t ticks = (pts - first_pts) & ((INT64_C(1) << 33) - 1);
+                        entry.frame = (int64_t)std::llround(ticks * frame_rate / 90000);
+                        entry.from_timestamp = true;
+                    } else if (bitrate > 0) {
+                        entry.frame = (int64_t)std::llround(entry.position * 8 / bitrate * frame_rate);
+                    }
+                }
+
+                // A discontinuity makes the estimates useless for seeking.
+                if (entry.frame >= 0 && (entries.empty() || entry.frame > entries.back().frame))
+                    entries.push_back(entry);
+
+                break;
+            }
+        }
+    }
+
+    fake_file.close();
+
+    if (!entries.size()) {
+        error = "No sequence or GOP headers found.";
+        return false;
+    }
+
+    return true;
+}
+
+
+const std::vector<CoarseIndex::Entry> &CoarseIndex::getEntries() const {
+    return entries;
+}
+
+
+bool CoarseIndex::findEntry(int64_t frame, Entry *entry) const {
+    auto it = std::upper_bound(entries.begin(), entries.end(), frame, [] (int64_t value, const Entry &element) {
+        return value < element.frame;
+    });
+
+    if (it == entries.begin())
+        return false;
+
+    *entry = *(it - 1);
+
+    return true;
+}
+
+
+bool CoarseIndex::write(FILE *file) {
+    if (fprintf(file, "# position file file_position frame source\n") < 0) {
+        error = "Failed to write the coarse index: fprintf() failed.";
+        return false;
+    }
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        const Entry &entry = entries[i];
+
+        if (fprintf(file, "%" PRId64 " %d %" PRId64 " %" PRId64 " %s\n",
+                    entry.position,
+                    entry.file,
+                    entry.file_position,
+                    entry.frame,
+                    entry.from_timestamp ? "pts" : "bitrate") < 0) {
+            error = "Failed to write the coarse index: fprintf() failed.";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+const std::string &CoarseIndex::getError() const {
+    return error;
+}
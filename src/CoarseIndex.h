@@ -0,0 +1,78 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#ifndef D2V_WITCH_COARSEINDEX_H
+#define D2V_WITCH_COARSEINDEX_H
+
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "FakeFile.h"
+
+
+// A rough seek table, built in a few milliseconds by looking at some
+// evenly spaced places in the input instead of reading all of it. At
+// each place, the next sequence header or GOP header is found by
+// scanning for start codes, and its picture number is estimated from
+// the PTS of the PES packet it's in, or failing that, from the bitrate
+// in the sequence header.
+class CoarseIndex {
+public:
+    struct Entry {
+        // In the fake file.
+        int64_t position;
+        int file;
+        int64_t file_position;
+
+        // Estimated. Only meant for seeking near the right place.
+        int64_t frame;
+
+        // Whether the estimate came from a timestamp or from the bitrate.
+        bool from_timestamp;
+    };
+
+    // Opens the files on its own, so indexing can go on at the same time.
+    CoarseIndex(const FakeFile &_files, int _samples);
+
+    bool build();
+
+    const std::vector<Entry> &getEntries() const;
+
+    // Finds the last entry whose frame is not after the given frame.
+    bool findEntry(int64_t frame, Entry *entry) const;
+
+    bool write(FILE *file);
+
+    const std::string &getError() const;
+
+private:
+    std::vector<std::string> files;
+    int samples;
+
+    std::vector<Entry> entries;
+
+    std::string error;
+};
+
+
+#endif // D2V_WITCH_COARSEINDEX_H
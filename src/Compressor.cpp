@@ -0,0 +1,253 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "Bullshit.h"
+#include "Compressor.h"
+
+
+int Compressor::getCompression(const std::string &name) {
+    if (name == "none")
+        return NO_COMPRESSION;
+    else if (name == "gzip")
+        return GZIP_COMPRESSION;
+
+    return UNKNOWN_COMPRESSION;
+}
+
+
+int Compressor::getCompressionForPath(const std::string &path) {
+    if (path.size() > 3 && path.compare(path.size() - 3, 3, ".gz") == 0)
+        return GZIP_COMPRESSION;
+
+    return NO_COMPRESSION;
+}
+
+
+gzFile Compressor::openForReading(const std::string &path, std::string &err) {
+    FILE *file = openFile(path.c_str(), "rb");
+    if (!file) {
+        err = strerror(errno);
+        return nullptr;
+    }
+
+    // Going through openFile takes care of the file names on Windows.
+    int fd = dup(fileno(file));
+    fclose(file);
+
+    if (fd < 0) {
+        err = strerror(errno);
+        return nullptr;
+    }
+
+    gzFile gz = gzdopen(fd, "rb");
+    if (!gz) {
+        err = "gzdopen() failed.";
+        close(fd);
+        return nullptr;
+    }
+
+    gzbuffer(gz, 128 * 1024);
+
+    return gz;
+}
+
+
+bool Compressor::decompress(const std::string &path, FILE *destination, std::string &err) {
+    gzFile gz = openForReading(path, err);
+    if (!gz) {
+        err = "Failed to open '" + path + "': " + err;
+        return false;
+    }
+
+    std::vector<char> buffer(128 * 1024);
+
+    int bytes_read;
+    while ((bytes_read = gzread(gz, buffer.data(), buffer.size())) > 0) {
+        if (fwrite(buffer.data(), 1, bytes_read, destination) < (size_t)bytes_read) {
+            err = "Failed to write the decompressed data: fwrite() failed.";
+            gzclose(gz);
+            return false;
+        }
+    }
+
+    if (bytes_read < 0) {
+        int errnum;
+        err = "Failed to decompress '" + path + "': ";
+        err += gzerror(gz, &errnum);
+        gzclose(gz);
+        return false;
+    }
+
+    gzclose(gz);
+
+    if (fflush(destination)) {
+        err = "Failed to write the decompressed data: fflush() failed.";
+        return false;
+    }
+
+    return true;
+}
+
+
+Compressor::Compressor(FILE *_output, int _level)
+    : output(_output)
+    , level(_level)
+    , input(nullptr)
+    , read_fd(-1)
+{ }
+
+
+Compressor::~Compressor() {
+    finish();
+}
+
+
+bool Compressor::start() {
+    int fds[2];
+
+#ifdef _WIN32
+    if (_pipe(fds, 1024 * 1024, _O_BINARY)) {
+#else
+    if (pipe(fds)) {
+#endif
+        error = "Failed to create a pipe for the compressor: ";
+        error += strerror(errno);
+        return false;
+    }
+
+    input = fdopen(fds[1], "wb");
+    if (!input) {
+        error = "Failed to open the compressor's pipe: ";
+        error += strerror(errno);
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    // Fewer trips through the pipe.
+    setvbuf(input, nullptr, _IOFBF, 64 * 1024);
+
+    read_fd = fds[0];
+
+    thread = std::thread(&Compressor::work, this);
+
+    return true;
+}
+
+
+void Compressor::work() {
+    z_stream stream;
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+
+    // 15 + 16 means a gzip header instead of a zlib header.
+    bool okay = deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    if (!okay)
+        error = "Failed to initialise the compressor: deflateInit2() failed.";
+
+    std::vector<uint8_t> in(64 * 1024);
+    std::vector<uint8_t> out(64 * 1024);
+
+    while (true) {
+        int bytes_read = read(read_fd, in.data(), in.size());
+        if (bytes_read < 0 && errno == EINTR)
+            continue;
+
+        if (bytes_read < 0 && okay) {
+            error = "Failed to read from the compressor's pipe: ";
+            error += strerror(errno);
+            okay = false;
+        }
+
+        // After an error the pipe is still drained, otherwise the writer
+        // would block forever.
+        if (!okay) {
+            if (bytes_read <= 0)
+                break;
+            continue;
+        }
+
+        int flush = bytes_read > 0 ? Z_NO_FLUSH : Z_FINISH;
+
+        stream.next_in = in.data();
+        stream.avail_in = bytes_read;
+
+        do {
+            stream.next_out = out.data();
+            stream.avail_out = out.size();
+
+            deflate(&stream, flush);
+
+            size_t have = out.size() - stream.avail_out;
+            if (have && fwrite(out.data(), 1, have, output) < have) {
+                error = "Failed to write compressed data: fwrite() failed.";
+                okay = false;
+                break;
+            }
+        } while (stream.avail_out == 0);
+
+        if (flush == Z_FINISH)
+            break;
+    }
+
+    deflateEnd(&stream);
+}
+
+
+FILE *Compressor::getInput() const {
+    return input;
+}
+
+
+bool Compressor::finish() {
+    if (!input)
+        return !error.size();
+
+    std::string close_error;
+    if (fclose(input)) {
+        close_error = "Failed to write to the compressor's pipe: ";
+        close_error += strerror(errno);
+    }
+    input = nullptr;
+
+    thread.join();
+
+    if (!error.size())
+        error = close_error;
+
+    close(read_fd);
+    read_fd = -1;
+
+    return !error.size();
+}
+
+
+const std::string &Compressor::getError() const {
+    return error;
+}
@@ -0,0 +1,86 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+#ifndef D2V_WITCH_COMPRESSOR_H
+#define D2V_WITCH_COMPRESSOR_H
+
+
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include <zlib.h>
+
+
+// Compresses everything written to getInput() into the output file, in
+// gzip format, on a separate thread, so the code writing the data doesn't
+// need to know about it. The data goes through a pipe.
+class Compressor {
+    FILE *output;
+    int level;
+
+    FILE *input;
+    int read_fd;
+
+    std::thread thread;
+
+    std::string error;
+
+
+    void work();
+
+public:
+    enum Compression {
+        UNKNOWN_COMPRESSION = -1,
+        NO_COMPRESSION,
+        GZIP_COMPRESSION
+    };
+
+    static int getCompression(const std::string &name);
+
+    // Files whose names end in ".gz" are compressed by default.
+    static int getCompressionForPath(const std::string &path);
+
+    // Opens a file for reading with zlib, which reads uncompressed files
+    // as they are.
+    static gzFile openForReading(const std::string &path, std::string &err);
+
+    // Writes the uncompressed contents of the file, which may not be
+    // compressed at all.
+    static bool decompress(const std::string &path, FILE *destination, std::string &err);
+
+
+    // level is a zlib compression level, 1 to 9.
+    Compressor(FILE *_output, int _level);
+
+    ~Compressor();
+
+    bool start();
+
+    FILE *getInput() const;
+
+    // Closes the input and waits for everything to be compressed. The
+    // output is left open.
+    bool finish();
+
+    const std::string &getError() const;
+};
+
+
+#endif // D2V_WITCH_COMPRESSOR_H
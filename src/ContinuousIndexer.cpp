@@ -0,0 +1,291 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <unordered_set>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <signal.h>
+#include <sys/stat.h>
+#endif
+
+#include "ContinuousIndexer.h"
+#include "Daemon.h"
+
+
+volatile int ContinuousIndexer::stop_requested = 0;
+
+
+ContinuousIndexer::ContinuousIndexer(const std::string &_directory, const std::string &_output_directory, const std::string &_extension, int _bucket_seconds, int _stable_seconds, D2V::LoggingFunction _log_message)
+    : directory(_directory)
+    , output_directory(_output_directory.size() ? _output_directory : _directory)
+    , extension(_extension)
+    , bucket_seconds(_bucket_seconds)
+    , stable_seconds(_stable_seconds)
+    , log_message(_log_message)
+    , next_bucket(INT64_MIN)
+    , done(0)
+    , failed(0)
+{ }
+
+
+void ContinuousIndexer::signalHandler(int) {
+    stop_requested = 1;
+}
+
+
+void ContinuousIndexer::log(const std::string &message) {
+    if (log_message)
+        log_message(message);
+}
+
+
+const std::string &ContinuousIndexer::getError() const {
+    return error;
+}
+
+
+int64_t ContinuousIndexer::getBucketStart(int64_t time) const {
+    int64_t start = time - time % bucket_seconds;
+    if (time < 0 && time % bucket_seconds)
+        start -= bucket_seconds;
+
+    return start;
+}
+
+
+std::string ContinuousIndexer::getBucketPath(int64_t bucket_start) const {
+    time_t t = (time_t)bucket_start;
+    struct tm tm;
+#ifdef _WIN32
+    gmtime_s(&tm, &t);
+#else
+    gmtime_r(&t, &tm);
+#endif
+
+    char name[32];
+    strftime(name, sizeof(name), "%Y%m%d-%H%M%S", &tm);
+
+    return output_directory + "/" + name + extension;
+}
+
+
+#ifdef __linux__
+
+bool ContinuousIndexer::scanDirectory(std::vector<Segment> &segments, bool &all_stable, int64_t &later_bucket) {
+    segments.clear();
+    all_stable = true;
+    later_bucket = INT64_MIN;
+
+    DIR *dir = opendir(directory.c_str());
+    if (!dir) {
+        error = "Failed to open directory '" + directory + "': " + strerror(errno);
+        return false;
+    }
+
+    // Only the segments of the earliest bucket not done yet are kept.
+    int64_t bucket = INT64_MAX;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        std::string path = directory + "/" + entry->d_name;
+
+        if (!Daemon::isMPEGFile(path))
+            continue;
+
+        struct stat st;
+        if (stat(path.c_str(), &st) || !S_ISREG(st.st_mode))
+            continue;
+
+        int64_t segment_bucket = getBucketStart(st.st_mtime);
+
+        // Segments that belong to a bucket already indexed came too late.
+        if (segment_bucket < next_bucket)
+            continue;
+
+        if (segment_bucket > bucket) {
+            later_bucket = std::max(later_bucket, segment_bucket);
+            continue;
+        }
+
+        if (segment_bucket < bucket) {
+            if (segments.size())
+                later_bucket = std::max(later_bucket, bucket);
+
+            bucket = segment_bucket;
+            segments.clear();
+        }
+
+        segments.push_back({ path, (int64_t)st.st_mtime });
+
+        Clock::time_point now = Clock::now();
+
+        auto it = sizes.find(path);
+        if (it == sizes.end()) {
+            sizes.insert({ path, { (int64_t)st.st_size, (int64_t)st.st_mtime, now, true } });
+        } else {
+            it->second.seen = true;
+
+            if (it->second.size != st.st_size || it->second.mtime != st.st_mtime) {
+                it->second.size = st.st_size;
+                it->second.mtime = st.st_mtime;
+                it->second.last_change = now;
+            }
+        }
+    }
+
+    closedir(dir);
+
+    std::unordered_set<std::string> in_bucket;
+    for (size_t i = 0; i < segments.size(); i++)
+        in_bucket.insert(segments[i].path);
+
+    int64_t wall_clock = time(nullptr);
+
+    // Forget the files that went away or moved to a later bucket.
+    for (auto it = sizes.begin(); it != sizes.end(); ) {
+        if (!it->second.seen || !in_bucket.count(it->first)) {
+            it = sizes.erase(it);
+            continue;
+        }
+
+        it->second.seen = false;
+
+        // Old segments found when catching up don't need to be watched.
+        if (wall_clock - it->second.mtime < stable_seconds &&
+            Clock::now() - it->second.last_change < std::chrono::seconds(stable_seconds))
+            all_stable = false;
+
+        it++;
+    }
+
+    return true;
+}
+
+
+bool ContinuousIndexer::indexNextBucket(bool &indexed) {
+    indexed = false;
+
+    std::vector<Segment> segments;
+    bool all_stable;
+    int64_t later_bucket;
+
+    if (!scanDirectory(segments, all_stable, later_bucket))
+        return false;
+
+    if (!segments.size())
+        return true;
+
+    int64_t bucket = getBucketStart(segments[0].mtime);
+    std::string d2v_path = getBucketPath(bucket);
+
+    // Indexed before a restart.
+    struct stat st;
+    if (!stat(d2v_path.c_str(), &st)) {
+        next_bucket = bucket + bucket_seconds;
+        sizes.clear();
+        indexed = true;
+        return true;
+    }
+
+    // The bucket is over when the recorder started writing the next one,
+    // or when it ended a while ago, in case the recording stopped.
+    bool over = later_bucket > bucket || (int64_t)time(nullptr) >= bucket + bucket_seconds + stable_seconds;
+    if (!over || !all_stable)
+        return true;
+
+    std::sort(segments.begin(), segments.end(), [] (const Segment &a, const Segment &b) {
+        if (a.mtime != b.mtime)
+            return a.mtime < b.mtime;
+        return a.path < b.path;
+    });
+
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < segments.size(); i++)
+        paths.push_back(segments[i].path);
+
+    log("Indexing " + std::to_string(paths.size()) + " segments into '" + d2v_path + "'.");
+
+    std::string err;
+    if (indexBucket(paths, d2v_path, err)) {
+        log("Finished '" + d2v_path + "'.");
+        done++;
+    } else {
+        log("Failed to index '" + d2v_path + "': " + err);
+        failed++;
+    }
+
+    // A failed bucket isn't tried again, or it would hold up all the
+    // following ones.
+    next_bucket = bucket + bucket_seconds;
+    sizes.clear();
+    indexed = true;
+
+    return true;
+}
+
+
+bool ContinuousIndexer::run() {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signalHandler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    log("Indexing '" + directory + "' in buckets of " + std::to_string(bucket_seconds) + " seconds.");
+
+    while (!stop_requested) {
+        bool indexed;
+        if (!indexNextBucket(indexed))
+            break;
+
+        // Catch up with older buckets without waiting.
+        if (!indexed)
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    if (stop_requested)
+        log("Stopped after indexing " + std::to_string(done) + " buckets, " + std::to_string(failed) + " failed.");
+
+    return !error.size();
+}
+
+#else // __linux__
+
+bool ContinuousIndexer::scanDirectory(std::vector<Segment> &, bool &, int64_t &) {
+    return false;
+}
+
+
+bool ContinuousIndexer::indexNextBucket(bool &) {
+    return false;
+}
+
+
+bool ContinuousIndexer::run() {
+    error = "Continuous indexing is only supported on Linux.";
+    return false;
+}
+
+#endif // __linux__
@@ -0,0 +1,111 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#ifndef D2V_WITCH_CONTINUOUSINDEXER_H
+#define D2V_WITCH_CONTINUOUSINDEXER_H
+
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "D2V.h"
+
+
+// Follows a directory where a recorder keeps writing rotating segments of
+// one endless stream, and indexes them in time buckets: every segment
+// belongs to the bucket its modification time falls in, and once a bucket
+// is over and all of its segments stopped changing, they are indexed
+// together into one D2V file named after the start of the bucket.
+//
+// Only one bucket is indexed at a time and nothing is remembered about
+// the buckets already done, so memory and open files don't grow however
+// long it runs. Buckets that already have a D2V file are skipped, which
+// lets a restarted indexer continue where it stopped.
+//
+// Only implemented for Linux.
+class ContinuousIndexer {
+    typedef std::chrono::steady_clock Clock;
+
+    struct Segment {
+        std::string path;
+        int64_t mtime;
+    };
+
+    struct SizeCheck {
+        int64_t size;
+        int64_t mtime;
+        Clock::time_point last_change;
+        bool seen;
+    };
+
+    std::string directory;
+    std::string output_directory;
+    std::string extension;
+    int bucket_seconds;
+    int stable_seconds;
+    D2V::LoggingFunction log_message;
+
+    // Segments still being checked for changes, by path.
+    std::unordered_map<std::string, SizeCheck> sizes;
+
+    // Start of the earliest bucket that may still be indexed.
+    int64_t next_bucket;
+
+    int done;
+    int failed;
+
+    std::string error;
+
+    static volatile int stop_requested;
+
+
+    static void signalHandler(int signum);
+
+    void log(const std::string &message);
+
+    bool scanDirectory(std::vector<Segment> &segments, bool &all_stable, int64_t &later_bucket);
+
+    bool indexNextBucket(bool &indexed);
+
+protected:
+    // Called with the segments of one bucket in recording order.
+    virtual bool indexBucket(const std::vector<std::string> &paths, const std::string &d2v_path, std::string &err) = 0;
+
+public:
+    ContinuousIndexer(const std::string &_directory, const std::string &_output_directory, const std::string &_extension, int _bucket_seconds, int _stable_seconds, D2V::LoggingFunction _log_message);
+
+    virtual ~ContinuousIndexer() = default;
+
+    int64_t getBucketStart(int64_t time) const;
+
+    std::string getBucketPath(int64_t bucket_start) const;
+
+    // Returns after SIGINT or SIGTERM, once the bucket being indexed is
+    // finished.
+    bool run();
+
+    const std::string &getError() const;
+};
+
+
+#endif // D2V_WITCH_CONTINUOUSINDEXER_H
@@ -18,7 +18,10 @@ SOFTWARE.
 */
 
 
+#include <algorithm>
 #include <cinttypes>
+#include <cstring>
+#include <thread>
 
 extern "C" {
 #include <libavformat/avformat.h>
@@ -27,6 +30,7 @@ extern "C" {
 }
 
 #include "D2V.h"
+#include "SPSCQueue.h"
 
 
 void D2V::clearDataLine() {
@@ -38,6 +42,9 @@ void D2V::clearDataLine() {
     line.vob = 0;
     line.cell = 0;
     line.flags.clear();
+    line_timestamps.clear();
+    line_pts.clear();
+    line_user_data.clear();
 }
 
 
@@ -52,8 +59,23 @@ void D2V::reorderDataLineFlags() {
 
     for (size_t i = 1; i < line.flags.size(); i++) {
         if ((line.flags[i - 1] & FLAGS_B_PICTURE) != FLAGS_B_PICTURE &&
-                (line.flags[i] & FLAGS_B_PICTURE) == FLAGS_B_PICTURE)
+                (line.flags[i] & FLAGS_B_PICTURE) == FLAGS_B_PICTURE) {
             std::swap(line.flags[i - 1], line.flags[i]);
+
+            if (timestamps) {
+                std::swap(line_timestamps[i - 1], line_timestamps[i]);
+
+                // Everything decoded after a discontinuity is on the new
+                // timeline, including the B pictures now displayed before
+                // the reference picture that carried the flag.
+                if (line_timestamps[i].discontinuity) {
+                    line_timestamps[i].discontinuity = false;
+                    line_timestamps[i - 1].discontinuity = true;
+                }
+            }
+            std::swap(line_pts[i - 1], line_pts[i]);
+            std::swap(line_user_data[i - 1], line_user_data[i]);
+        }
     }
 }
 
@@ -69,7 +91,7 @@ bool D2V::printHeader() {
 
     header += "\n";
 
-    if (fprintf(d2v_file, "%s", header.c_str()) < 0) {
+    if (d2v_file && fprintf(d2v_file, "%s", header.c_str()) < 0) {
         error = "Failed to print d2v header section: fprintf() failed.";
         return false;
     }
@@ -107,17 +129,32 @@ bool D2V::printSettings() {
         mpeg_type = 2;
 
     int width, height;
-    if (av_opt_get_image_size(video_stream->codec, "video_size", 0, &width, &height) < 0)
-        width = height = -1;
+    AVRational dar, frame_rate;
 
-    AVRational sar;
-    if (av_opt_get_q(video_stream->codec, "aspect", 0, &sar) < 0)
-        sar = { 1, 1 };
-    AVRational dar = av_mul_q(av_make_q(width, height), sar);
-    av_reduce(&dar.num, &dar.den, dar.num, dar.den, 1024);
+    if (segment_number == 0) {
+        if (av_opt_get_image_size(video_stream->codec, "video_size", 0, &width, &height) < 0)
+            width = height = -1;
 
-    // No AVOption for framerate?
-    AVRational frame_rate = video_stream->codec->framerate;
+        AVRational sar;
+        if (av_opt_get_q(video_stream->codec, "aspect", 0, &sar) < 0)
+            sar = { 1, 1 };
+        dar = av_mul_q(av_make_q(width, height), sar);
+        av_reduce(&dar.num, &dar.den, dar.num, dar.den, 1024);
+
+        // No AVOption for framerate?
+        frame_rate = video_stream->codec->framerate;
+
+        segment.width = width;
+        segment.height = height;
+        segment.display_aspect_ratio = dar;
+        segment.frame_rate = frame_rate;
+    } else {
+        // ffmpeg only knows about the first sequence header.
+        width = segment.width;
+        height = segment.height;
+        dar = segment.display_aspect_ratio;
+        frame_rate = segment.frame_rate;
+    }
 
     std::string settings;
 
@@ -142,7 +179,7 @@ bool D2V::printSettings() {
     settings += "Frame_Rate=" + std::to_string((int)((float)frame_rate.num * 1000 / frame_rate.den)) + " (" + std::to_string(frame_rate.num) + "/" + std::to_string(frame_rate.den) + ")\n";
     settings += "Location=0,0,0,0\n"; // Whatever.
 
-    if (fprintf(d2v_file, "%s", settings.c_str()) < 0) {
+    if (d2v_file && fprintf(d2v_file, "%s", settings.c_str()) < 0) {
         error = "Failed to print d2v settings section: fprintf() failed.";
         return false;
     }
@@ -151,8 +188,123 @@ bool D2V::printSettings() {
 }
 
 
+AVRational D2V::getDisplayAspectRatio(const SequenceParameters &parameters) const {
+    AVRational dar = { parameters.width, parameters.height };
+
+    if (video_stream->codec->codec_id == AV_CODEC_ID_MPEG2VIDEO) {
+        if (parameters.aspect_ratio_information == 2)
+            dar = { 4, 3 };
+        else if (parameters.aspect_ratio_information == 3)
+            dar = { 16, 9 };
+        else if (parameters.aspect_ratio_information == 4)
+            dar = { 221, 100 };
+    } else {
+        // MPEG-1 has the pixel aspect ratio instead (height / width), times 10000 here.
+        static const int pixel_aspect_ratios[16] = {
+            0, 10000, 6735, 7031, 7615, 8055, 8437, 8935, 9157, 9815, 10255, 10695, 10950, 11575, 12015, 0
+        };
+
+        int pixel_aspect_ratio = pixel_aspect_ratios[parameters.aspect_ratio_information & 15];
+        if (pixel_aspect_ratio)
+            dar = { parameters.width * 10000, parameters.height * pixel_aspect_ratio };
+    }
+
+    av_reduce(&dar.num, &dar.den, dar.num, dar.den, 1024);
+
+    return dar;
+}
+
+
+AVRational D2V::getFrameRate(const SequenceParameters &parameters) {
+    static const AVRational frame_rates[9] = {
+        { 0, 1 }, { 24000, 1001 }, { 24, 1 }, { 25, 1 }, { 30000, 1001 }, { 30, 1 }, { 50, 1 }, { 60000, 1001 }, { 60, 1 }
+    };
+
+    if (parameters.frame_rate_code < 1 || parameters.frame_rate_code > 8)
+        return { 0, 1 };
+
+    AVRational frame_rate = frame_rates[parameters.frame_rate_code];
+    av_reduce(&frame_rate.num,
+              &frame_rate.den,
+              (int64_t)frame_rate.num * (parameters.frame_rate_extension_n + 1),
+              (int64_t)frame_rate.den * (parameters.frame_rate_extension_d + 1),
+              INT32_MAX);
+
+    return frame_rate;
+}
+
+
+bool D2V::checkSequenceParameters(int64_t packet_position) {
+    SequenceParameters parameters = {
+        parser.width,
+        parser.height,
+        parser.aspect_ratio_information,
+        parser.frame_rate_code,
+        parser.frame_rate_extension_n,
+        parser.frame_rate_extension_d
+    };
+
+    if (!have_sequence_parameters) {
+        sequence_parameters = parameters;
+        have_sequence_parameters = true;
+        return true;
+    }
+
+    if (parameters == sequence_parameters)
+        return true;
+
+    sequence_parameters = parameters;
+
+    AVRational dar = getDisplayAspectRatio(parameters);
+    AVRational frame_rate = getFrameRate(parameters);
+
+    std::string description = std::to_string(parameters.width) + "x" + std::to_string(parameters.height) +
+                              ", " + std::to_string(dar.num) + ":" + std::to_string(dar.den) +
+                              ", " + std::to_string(frame_rate.num) + "/" + std::to_string(frame_rate.den) + " fps";
+
+    if (!segment_handler) {
+        if (log_message)
+            log_message("The sequence parameters changed to " + description + " at byte " + std::to_string(packet_position) +
+                        ". The settings in the d2v file are wrong for the rest of the video.");
+
+        return true;
+    }
+
+    if (!printStreamEnd())
+        return false;
+
+    segment.pictures = stats.video_frames - segment.first_picture;
+
+    if (!segment_handler->finishSegment(segment_number, segment, error))
+        return false;
+
+    segment_number++;
+
+    segment.width = parameters.width;
+    segment.height = parameters.height;
+    segment.display_aspect_ratio = dar;
+    segment.frame_rate = frame_rate;
+    segment.first_picture = stats.video_frames;
+    segment.first_line = line_number + 1;
+    segment.file = fake_file->getFileIndex(packet_position);
+    segment.position = fake_file->getPositionInRealFile(packet_position);
+    segment.pictures = 0;
+
+    d2v_file = segment_handler->startSegment(segment_number, segment, error);
+    if (!d2v_file)
+        return false;
+
+    if (log_message)
+        log_message("Starting segment " + std::to_string(segment_number) + " (" + description + ") at byte " + std::to_string(packet_position) + ".");
+
+    return printHeader() && printSettings();
+}
+
+
 bool D2V::printDataLine() {
-    if (fprintf(d2v_file, "\n%x %d %d %" PRId64 " %d %d %d",
+    TraceScope scope(trace, "write", "D2V::printDataLine");
+
+    if (d2v_file && fprintf(d2v_file, "\n%x %d %d %" PRId64 " %d %d %d",
                 line.info,
                 line.matrix,
                 line.file,
@@ -164,25 +316,48 @@ bool D2V::printDataLine() {
         return false;
     }
 
-    for (auto it = line.flags.begin(); it != line.flags.cend(); it++) {
+    for (auto it = line.flags.begin(); it != line.flags.cend() && d2v_file; it++) {
         if (fprintf(d2v_file, " %x", (int)*it) < 0) {
             error = "Failed to print d2v data line: fprintf() failed.";
             return false;
         }
     }
 
+    if (timestamps)
+        timestamps->addLine(line_timestamps);
+
+    LineEvent event = { line_number, &line, printed_pictures, &line_pts, &line_user_data };
+
+    for (size_t i = 0; i < sinks.size(); i++)
+        if (!sinks[i]->handleLine(event, error))
+            return false;
+
+    printed_pictures += line.flags.size();
+
     return true;
 }
 
 
 bool D2V::handleVideoPacket(AVPacket *packet) {
-    parser.parseData(packet->data, packet->size);
+    {
+        TraceScope scope(trace, "parse", "MPEGParser::parseData");
+        parser.parseData(packet->data, packet->size);
+    }
 
     uint8_t flags = 0;
 
     if (parser.width <= 0 || parser.height <= 0) {
+        std::string problem = "Skipping frame with invalid dimensions " + std::to_string(parser.width) + "x" + std::to_string(parser.height) + ".";
         if (log_message)
-            log_message("Skipping frame with invalid dimensions " + std::to_string(parser.width) + "x" + std::to_string(parser.height) + ".");
+            log_message(problem);
+
+        return handleBadPicture(packet, problem);
+    }
+
+    if (dropping_pictures &&
+        (parser.picture_coding_type == MPEGParser::P_PICTURE || parser.picture_coding_type == MPEGParser::B_PICTURE)) {
+        if (damage_report)
+            damage_report->droppedPicture(packet->pos, line_number);
 
         return true;
     }
@@ -195,6 +370,9 @@ bool D2V::handleVideoPacket(AVPacket *packet) {
             clearDataLine();
         }
 
+        if (parser.sequence_header && !checkSequenceParameters(packet->pos))
+            return false;
+
         line.info = INFO_BIT11;
         if (parser.progressive_sequence)
             line.info |= INFO_PROGRESSIVE_SEQUENCE;
@@ -206,15 +384,42 @@ bool D2V::handleVideoPacket(AVPacket *packet) {
                 line.info |= INFO_CLOSED_GOP;
         }
 
+        line_gop_closed = parser.group_of_pictures_header && parser.closed_gop;
+
         line.matrix = parser.matrix_coefficients;
 
         line.file = fake_file->getFileIndex(packet->pos);
         line.position = fake_file->getPositionInRealFile(packet->pos);
+        line.vob = fake_file->getVobId(packet->pos);
+        line.cell = fake_file->getCellId(packet->pos);
+
+        if (line_number == -1) {
+            segment.file = line.file;
+            segment.position = line.position;
+        }
+
+        line_number++;
+
+        dropping_pictures = false;
+        if (damage_report)
+            damage_report->lineStarted(packet->pos, line_number);
+
+        if (gop_stats && !gop_stats->startGOP(line_number, line.file, line.position, packet->pos)) {
+            error = gop_stats->getError();
+            return false;
+        }
+
+        if (thumbnailer && line_number % thumbnail_interval == 0) {
+            if (!thumbnailer->submit(line_number, 1, { packet })) {
+                error = "Failed to create thumbnail: " + thumbnailer->getError();
+                return false;
+            }
+        }
 
         flags = FLAGS_I_PICTURE | FLAGS_DECODABLE_WITHOUT_PREVIOUS_GOP;
 
-        if (progress_report)
-            progress_report(packet->pos, fake_file->getTotalSize());
+        if (progress)
+            progress->update(progress_job, packet->pos, stats.video_frames, line_number + 1);
     } else if (parser.picture_coding_type == MPEGParser::P_PICTURE) {
         flags = FLAGS_P_PICTURE | FLAGS_DECODABLE_WITHOUT_PREVIOUS_GOP;
     } else if (parser.picture_coding_type == MPEGParser::B_PICTURE) {
@@ -235,14 +440,26 @@ bool D2V::handleVideoPacket(AVPacket *packet) {
             flags |= FLAGS_DECODABLE_WITHOUT_PREVIOUS_GOP;
         } else {
             line.info &= ~INFO_CLOSED_GOP;
+
+            // Leading B pictures of an open GOP need the previous GOP,
+            // so decoders starting here have to throw them away.
+            if (!line_gop_closed)
+                line.skip++;
         }
     } else {
+        std::string problem = "Skipping unknown picture type " + std::to_string(parser.picture_coding_type) + ".";
         if (log_message)
-            log_message("Skipping unknown picture type " + std::to_string(parser.picture_coding_type) + ".");
+            log_message(problem);
 
-        return true;
+        return handleBadPicture(packet, problem);
     }
 
+    if (recent_errors > 0)
+        recent_errors--;
+
+    if (health_monitor)
+        health_monitor->addPicture(packet->pos);
+
     if (parser.repeat_first_field)
         flags |= FLAGS_RFF;
 
@@ -254,6 +471,19 @@ bool D2V::handleVideoPacket(AVPacket *packet) {
 
     line.flags.push_back(flags);
 
+    if (timestamps)
+        line_timestamps.push_back(timestamps->makePicture(packet->pts, packet->dts));
+    line_pts.push_back(packet->pts);
+    line_user_data.push_back(parser.user_data);
+
+    // The first displayed picture has the lowest timestamp of the first GOP.
+    if (line_number == 0 && packet->pts != AV_NOPTS_VALUE &&
+        (first_video_pts == AV_NOPTS_VALUE || packet->pts < first_video_pts))
+        first_video_pts = packet->pts;
+
+    if (gop_stats)
+        gop_stats->addPicture(parser.picture_coding_type, packet->size, parser.repeat_first_field);
+
     stats.video_frames++;
     if (flags & FLAGS_PROGRESSIVE)
         stats.progressive_frames++;
@@ -266,25 +496,164 @@ bool D2V::handleVideoPacket(AVPacket *packet) {
 }
 
 
+bool D2V::handleBadPicture(const AVPacket *packet, const std::string &problem) {
+    if (damage_report)
+        damage_report->badPicture(packet->pos, line_number, problem);
+
+    recent_errors++;
+
+    if (resync_errors > 0 && recent_errors >= resync_errors && !pipeline_queue_length)
+        return resync(packet);
+
+    return true;
+}
+
+
+int64_t D2V::findNextHeader(int64_t position) {
+    // Far enough for any sane GOP.
+    const int64_t max_distance = 64 * 1024 * 1024;
+
+    if (FakeFile::seek(fake_file, position, SEEK_SET) < 0)
+        return -1;
+
+    std::vector<uint8_t> buffer(256 * 1024);
+
+    // The last few bytes of each read are looked at again with the next
+    // one, in case a start code is split between them.
+    int kept = 0;
+
+    for (int64_t offset = position; offset < position + max_distance; ) {
+        int bytes_read = FakeFile::readPacket(fake_file, buffer.data() + kept, buffer.size() - kept);
+        if (bytes_read <= 0)
+            return -1;
+
+        const uint8_t *data = buffer.data();
+        const uint8_t *data_end = data + kept + bytes_read;
+
+        while (data < data_end) {
+            uint32_t start_code = 0xffffffff;
+            data = MPEGParser::findStartCode(data, data_end, &start_code);
+
+            if (start_code == MPEGParser::SEQUENCE_HEADER_CODE || start_code == MPEGParser::GROUP_START_CODE)
+                return offset - kept + (data - buffer.data()) - 4;
+        }
+
+        offset += bytes_read;
+
+        if (kept + bytes_read >= 3) {
+            memmove(buffer.data(), data_end - 3, 3);
+            kept = 3;
+        }
+    }
+
+    return -1;
+}
+
+
+// Scans the raw input for the next header, then makes the demuxer
+// continue a little before it, so it can find the start of the packet
+// that contains it.
+bool D2V::resync(const AVPacket *packet) {
+    recent_errors = 0;
+
+    if (packet->pos < 0)
+        return true;
+
+    int64_t from = std::max(packet->pos + packet->size, last_resync_position + 1);
+
+    int64_t saved_position = fake_file->getCurrentPosition();
+
+    int64_t header_position;
+    {
+        TraceScope scope(trace, "parse", "D2V::findNextHeader");
+        header_position = findNextHeader(from);
+    }
+
+    // The demuxer's idea of the position must stay true if it has to
+    // carry on by itself.
+    if (FakeFile::seek(fake_file, saved_position, SEEK_SET) < 0) {
+        error = "Failed to seek back after looking for the next header: " + fake_file->getError();
+        return false;
+    }
+
+    if (header_position < 0) {
+        if (log_message)
+            log_message("No sequence or GOP header found after the damaged data at " + std::to_string(packet->pos) + ".");
+
+        return true;
+    }
+
+    int64_t target = std::max(from, header_position - 2048);
+
+    if (av_seek_frame(f->fctx, -1, target, AVSEEK_FLAG_BYTE) < 0) {
+        if (log_message)
+            log_message("Failed to jump over the damaged data at " + std::to_string(packet->pos) + ".");
+
+        return true;
+    }
+
+    if (log_message)
+        log_message("Jumped over " + std::to_string(target - from) + " bytes of damaged data at " + std::to_string(packet->pos) + ".");
+
+    if (damage_report)
+        damage_report->skipped(from, target, line_number);
+
+    last_resync_position = target;
+
+    // Whatever comes before the next I picture refers to pictures that
+    // were skipped.
+    if (!isDataLineNull()) {
+        reorderDataLineFlags();
+        if (!printDataLine())
+            return false;
+    }
+    clearDataLine();
+
+    dropping_pictures = true;
+
+    return true;
+}
+
+
 bool D2V::handleAudioPacket(AVPacket *packet) {
+    noteAudioStart(packet);
+
+    return writeAudioPacket(packet, error);
+}
+
+
+void D2V::noteAudioStart(const AVPacket *packet) {
+    if (packet->pts != AV_NOPTS_VALUE && !first_audio_pts.count(packet->stream_index))
+        first_audio_pts.insert({ packet->stream_index, packet->pts });
+}
+
+
+bool D2V::writeAudioPacket(const AVPacket *packet, std::string &err) const {
     FILE *file = audio_files.at(packet->stream_index);
 
+    TraceScope scope(trace, "write", "audio fwrite");
+
     if (fwrite(packet->data, 1, packet->size, file) < (size_t)packet->size) {
         char id[20] = { 0 };
         snprintf(id, 19, "%x", f->fctx->streams[packet->stream_index]->id);
-        error = "Failed to write audio packet from stream id ";
-        error += id;
-        error += ": fwrite() failed.";
+        err = "Failed to write audio packet from stream id ";
+        err += id;
+        err += ": fwrite() failed.";
 
         return false;
     }
 
+    if (audio_index && !audio_index->addPacket(packet)) {
+        err = audio_index->getError();
+        return false;
+    }
+
     return true;
 }
 
 
 bool D2V::printStreamEnd() {
-    if (fprintf(d2v_file, " ff\n") < 0) {
+    if (d2v_file && fprintf(d2v_file, " ff\n") < 0) {
         error = "Failed to print the d2v stream end flag: fprintf() failed.";
         return false;
     }
@@ -293,61 +662,322 @@ bool D2V::printStreamEnd() {
 }
 
 
-D2V::D2V(FILE *_d2v_file, const std::unordered_map<int, FILE *> &_audio_files, FakeFile *_fake_file, FFMPEG *_f, AVStream *_video_stream, ProgressFunction _progress_report, LoggingFunction _log_message)
+D2V::D2V(FILE *_d2v_file, const std::unordered_map<int, FILE *> &_audio_files, FakeFile *_fake_file, FFMPEG *_f, AVStream *_video_stream, LoggingFunction _log_message)
     : d2v_file(_d2v_file)
     , audio_files(_audio_files)
     , fake_file(_fake_file)
     , f(_f)
     , video_stream(_video_stream)
-    , progress_report(_progress_report)
     , log_message(_log_message)
+    , thumbnailer(nullptr)
+    , thumbnail_interval(1)
+    , gop_stats(nullptr)
+    , trace(nullptr)
+    , progress(nullptr)
+    , progress_job(0)
+    , pipeline_queue_length(0)
+    , sinks{ }
+    , printed_pictures(0)
+    , timestamps(nullptr)
+    , first_video_pts(AV_NOPTS_VALUE)
+    , audio_index(nullptr)
+    , health_monitor(nullptr)
+    , damage_report(nullptr)
+    , resync_errors(0)
+    , recent_errors(0)
+    , last_resync_position(-1)
+    , dropping_pictures(false)
+    , segment_handler(nullptr)
+    , have_sequence_parameters(false)
+    , sequence_parameters{ }
+    , segment_number(0)
+    , segment{ }
+    , line_number(-1)
+    , line_gop_closed(false)
 { }
 
 
+void D2V::setThumbnailer(Thumbnailer *_thumbnailer, int _interval) {
+    thumbnailer = _thumbnailer;
+    thumbnail_interval = _interval;
+}
+
+
+void D2V::setGOPStats(GOPStats *_gop_stats) {
+    gop_stats = _gop_stats;
+}
+
+
+void D2V::setTrace(Trace *_trace) {
+    trace = _trace;
+}
+
+
+void D2V::setTimestamps(Timestamps *_timestamps) {
+    timestamps = _timestamps;
+    timestamps->setTimeBase(video_stream->time_base);
+}
+
+
+void D2V::setAudioIndex(AudioIndex *_audio_index) {
+    audio_index = _audio_index;
+}
+
+
+void D2V::setHealthMonitor(HealthMonitor *_health_monitor) {
+    health_monitor = _health_monitor;
+}
+
+
+void D2V::setDamageReport(DamageReport *_damage_report) {
+    damage_report = _damage_report;
+}
+
+
+void D2V::setResync(int _errors) {
+    resync_errors = _errors;
+}
+
+
+void D2V::setSegmentHandler(SegmentHandler *_segment_handler) {
+    segment_handler = _segment_handler;
+}
+
+
+void D2V::addSink(Sink *sink) {
+    sinks.push_back(sink);
+}
+
+
+void D2V::setPipeline(int _queue_length) {
+    pipeline_queue_length = _queue_length;
+}
+
+
+void D2V::setProgress(Progress *_progress, int _job) {
+    progress = _progress;
+    progress_job = _job;
+}
+
+
 const D2V::Stats &D2V::getStats() const {
     return stats;
 }
 
 
+bool D2V::getAudioDelay(int stream_index, int64_t *milliseconds) const {
+    auto it = first_audio_pts.find(stream_index);
+    if (it == first_audio_pts.end() || first_video_pts == AV_NOPTS_VALUE)
+        return false;
+
+    AVRational ms = { 1, 1000 };
+
+    *milliseconds = av_rescale_q(it->second, f->fctx->streams[stream_index]->time_base, ms) -
+                    av_rescale_q(first_video_pts, video_stream->time_base, ms);
+
+    return true;
+}
+
+
 const std::string &D2V::getError() const {
     return error;
 }
 
 
-bool D2V::engage() {
-    if (!printHeader())
-        return false;
+int D2V::readFrame(AVPacket *packet) {
+    TraceScope scope(trace, "demux", "av_read_frame");
 
-    if (!printSettings())
-        return false;
+    return av_read_frame(f->fctx, packet);
+}
 
-    AVPacket packet;
-    av_init_packet(&packet);
 
-    while (av_read_frame(f->fctx, &packet) == 0) {
-        // Apparently we might receive packets from streams with AVDISCARD_ALL set,
-        // and also from streams discovered late, probably.
-        if (packet.stream_index != video_stream->index &&
-            !audio_files.count(packet.stream_index)) {
+bool D2V::isWantedPacket(const AVPacket *packet) const {
+    // Apparently we might receive packets from streams with AVDISCARD_ALL set,
+    // and also from streams discovered late, probably.
+    return packet->stream_index == video_stream->index || audio_files.count(packet->stream_index);
+}
+
+
+bool D2V::readPackets() {
+    bool finished = false;
+
+    while (!finished)
+        if (!step(&finished))
+            return false;
+
+    return true;
+}
+
+
+// The demuxer thread reads packets and passes them to the calling
+// thread, which parses the video packets and passes the audio packets
+// to the writer thread. Each stage only waits when its queue is full
+// or empty, so the slowest stage sets the speed.
+bool D2V::readPacketsPipelined() {
+    SPSCQueue<AVPacket> demuxed_packets(pipeline_queue_length);
+    SPSCQueue<AVPacket> audio_packets(pipeline_queue_length);
+
+    std::string demuxer_error;
+    std::string writer_error;
+
+    std::thread demuxer([&] {
+        if (trace)
+            trace->setThreadName("demuxer");
+
+        AVPacket packet;
+        av_init_packet(&packet);
+
+        while (readFrame(&packet) == 0) {
+            if (!isWantedPacket(&packet)) {
+                av_free_packet(&packet);
+                continue;
+            }
+
+            // The packet may point into the demuxer's buffers, which the
+            // next av_read_frame() reuses.
+            AVPacket copy;
+            av_init_packet(&copy);
+
+            int ret = av_copy_packet(&copy, &packet);
             av_free_packet(&packet);
-            continue;
+
+            if (ret < 0) {
+                demuxer_error = "Failed to copy a packet for the parser thread: av_copy_packet() failed.";
+                break;
+            }
+
+            if (!demuxed_packets.push(copy)) {
+                av_free_packet(&copy);
+                break;
+            }
         }
 
-        bool okay = true;
+        demuxed_packets.close();
+    });
 
-        if (packet.stream_index == video_stream->index)
-            okay = handleVideoPacket(&packet);
-        else
-            okay = handleAudioPacket(&packet);
+    std::thread writer([&] {
+        if (trace)
+            trace->setThreadName("writer");
+
+        AVPacket packet;
+
+        while (audio_packets.pop(packet)) {
+            bool okay = writeAudioPacket(&packet, writer_error);
 
-        if (!okay) {
             av_free_packet(&packet);
-            return false;
+
+            if (!okay) {
+                audio_packets.abort();
+                break;
+            }
+        }
+    });
+
+    bool okay = true;
+
+    AVPacket packet;
+
+    while (okay && demuxed_packets.pop(packet)) {
+        if (packet.stream_index == video_stream->index) {
+            okay = handleVideoPacket(&packet);
+            av_free_packet(&packet);
+        } else {
+            noteAudioStart(&packet);
+
+            // Only fails when the writer gave up.
+            if (!audio_packets.push(packet)) {
+                av_free_packet(&packet);
+                okay = false;
+            }
         }
+    }
+
+    if (!okay)
+        demuxed_packets.abort();
+    audio_packets.close();
+
+    demuxer.join();
+    writer.join();
 
+    while (demuxed_packets.tryPop(packet))
         av_free_packet(&packet);
+    while (audio_packets.tryPop(packet))
+        av_free_packet(&packet);
+
+    if (writer_error.size()) {
+        error = writer_error;
+        return false;
+    }
+
+    if (!okay)
+        return false;
+
+    if (demuxer_error.size()) {
+        error = demuxer_error;
+        return false;
+    }
+
+    return checkHealth();
+}
+
+
+bool D2V::checkHealth() {
+    if (health_monitor && !health_monitor->isHealthy()) {
+        error = health_monitor->getError();
+        return false;
+    }
+
+    return true;
+}
+
+
+bool D2V::begin() {
+    if (!printHeader())
+        return false;
+
+    if (!printSettings())
+        return false;
+
+    if (gop_stats && !gop_stats->printHeader()) {
+        error = gop_stats->getError();
+        return false;
     }
 
+    for (size_t i = 0; i < sinks.size(); i++)
+        if (!sinks[i]->start(video_stream->time_base, segment.frame_rate, error))
+            return false;
+
+    return true;
+}
+
+
+bool D2V::step(bool *finished) {
+    AVPacket packet;
+    av_init_packet(&packet);
+
+    *finished = readFrame(&packet) != 0;
+    if (*finished)
+        return checkHealth();
+
+    if (!isWantedPacket(&packet)) {
+        av_free_packet(&packet);
+        return true;
+    }
+
+    bool okay;
+
+    if (packet.stream_index == video_stream->index)
+        okay = handleVideoPacket(&packet);
+    else
+        okay = handleAudioPacket(&packet);
+
+    av_free_packet(&packet);
+
+    return okay;
+}
+
+
+bool D2V::finish() {
     if (!isDataLineNull()) {
         reorderDataLineFlags();
         if (!printDataLine())
@@ -358,5 +988,46 @@ bool D2V::engage() {
     if (!printStreamEnd())
         return false;
 
+    if (segment_handler) {
+        segment.pictures = stats.video_frames - segment.first_picture;
+
+        if (!segment_handler->finishSegment(segment_number, segment, error))
+            return false;
+    }
+
+    if (progress)
+        progress->update(progress_job, fake_file->getTotalSize(), stats.video_frames, line_number + 1);
+
+    if (gop_stats && !gop_stats->finish(fake_file->getTotalSize())) {
+        error = gop_stats->getError();
+        return false;
+    }
+
+    for (size_t i = 0; i < sinks.size(); i++)
+        if (!sinks[i]->finish(error))
+            return false;
+
+    if (thumbnailer && !thumbnailer->finish()) {
+        error = "Failed to create thumbnail: " + thumbnailer->getError();
+        return false;
+    }
+
     return true;
 }
+
+
+bool D2V::engage() {
+    if (!begin())
+        return false;
+
+    bool okay;
+    if (pipeline_queue_length > 0)
+        okay = readPacketsPipelined();
+    else
+        okay = readPackets();
+
+    if (!okay)
+        return false;
+
+    return finish();
+}
@@ -31,9 +31,17 @@ extern "C" {
 #include <libavformat/avformat.h>
 }
 
+#include "AudioIndex.h"
+#include "DamageReport.h"
 #include "FakeFile.h"
 #include "FFMPEG.h"
+#include "GOPStats.h"
+#include "HealthMonitor.h"
 #include "MPEGParser.h"
+#include "Progress.h"
+#include "Thumbnailer.h"
+#include "Timestamps.h"
+#include "Trace.h"
 
 
 class D2V {
@@ -48,7 +56,6 @@ public:
     };
 
 
-    typedef void (*ProgressFunction)(int64_t current_position, int64_t total_size);
     typedef void (*LoggingFunction)(const std::string &message);
 
     struct Stats {
@@ -65,15 +72,7 @@ public:
         { }
     };
 
-    D2V(FILE *_d2v_file, const std::unordered_map<int, FILE *> &_audio_files, FakeFile *_fake_file, FFMPEG *_f, AVStream *_video_stream, ProgressFunction _progress_report, LoggingFunction _log_message);
 
-    const Stats &getStats() const;
-
-    const std::string &getError() const;
-
-    bool engage();
-
-private:
     // 12 bits
     enum InfoField {
         INFO_BIT11 = (1 << 11),
@@ -98,6 +97,42 @@ private:
     };
 
 
+    // The parameters from the sequence header that end up in the settings.
+    struct Segment {
+        int width;
+        int height;
+        AVRational display_aspect_ratio;
+        AVRational frame_rate;
+
+        // Where the segment starts: the number of pictures before it (in
+        // all the segments), its first data line's file and position.
+        int64_t first_picture;
+        int first_line;
+        int file;
+        int64_t position;
+
+        // Only known when the segment is finished.
+        int64_t pictures;
+    };
+
+
+    // Receives the D2V files of the segments, when the video's sequence
+    // parameters change in the middle of the stream.
+    class SegmentHandler {
+    public:
+        virtual ~SegmentHandler() = default;
+
+        // Returns the file where the segment's D2V file should be written,
+        // or nullptr after setting err. Not called for the first segment,
+        // which goes to the file given to the constructor.
+        virtual FILE *startSegment(int number, const Segment &segment, std::string &err) = 0;
+
+        // Called after the segment's D2V file is complete, including for
+        // the last segment.
+        virtual bool finishSegment(int number, const Segment &segment, std::string &err) = 0;
+    };
+
+
     struct DataLine {
         int info;
         int matrix;
@@ -120,17 +155,189 @@ private:
         { }
     };
 
+
+    // What the sinks get for every data line.
+    struct LineEvent {
+        int line_number;
+        const DataLine *line;
+
+        // The number of pictures in all the lines before this one.
+        int64_t first_picture;
+
+        // Parallel to line->flags. AV_NOPTS_VALUE when unknown.
+        const std::vector<int64_t> *pts;
+
+        // Parallel to line->flags.
+        const std::vector<MPEGParser::UserData> *user_data;
+    };
+
+
+    // Receives the results of the indexing as soon as they are known, in
+    // whatever format it likes. Any number of sinks can be added, and they
+    // all get the events from the same pass over the input.
+    class Sink {
+    public:
+        virtual ~Sink() = default;
+
+        // Called by begin(). The time base is the one of the PTS.
+        virtual bool start(AVRational time_base, AVRational frame_rate, std::string &err) {
+            (void)time_base;
+            (void)frame_rate;
+            (void)err;
+            return true;
+        }
+
+        // Called for every data line, as soon as it's complete.
+        virtual bool handleLine(const LineEvent &event, std::string &err) = 0;
+
+        // Called by finish(), after the last line.
+        virtual bool finish(std::string &err) {
+            (void)err;
+            return true;
+        }
+    };
+
+
+    // _d2v_file can be nullptr, if only the sinks are of interest.
+    D2V(FILE *_d2v_file, const std::unordered_map<int, FILE *> &_audio_files, FakeFile *_fake_file, FFMPEG *_f, AVStream *_video_stream, LoggingFunction _log_message);
+
+    // Every interval-th GOP's I picture will be sent to the thumbnailer.
+    void setThumbnailer(Thumbnailer *_thumbnailer, int _interval);
+
+    void setGOPStats(GOPStats *_gop_stats);
+
+    void setTrace(Trace *_trace);
+
+    void setTimestamps(Timestamps *_timestamps);
+
+    // The audio index must already know about the audio streams.
+    void setAudioIndex(AudioIndex *_audio_index);
+
+    // Gets every accepted picture. Indexing fails with its diagnosis if
+    // it stopped the reading.
+    void setHealthMonitor(HealthMonitor *_health_monitor);
+
+    void setDamageReport(DamageReport *_damage_report);
+
+    // When this many pictures can't be indexed in a row, give or take a
+    // few good ones, jump to the next sequence or GOP header instead of
+    // letting the demuxer crawl through the damage. 0 (the default) never
+    // jumps. Ignored with setPipeline(), because the demuxer then runs on
+    // another thread.
+    void setResync(int _errors);
+
+    // Without a segment handler, parameter changes are only logged.
+    void setSegmentHandler(SegmentHandler *_segment_handler);
+
+    // Progress is reported under the given job id.
+    void setProgress(Progress *_progress, int _job);
+
+    // With a queue length greater than 0, demuxing, parsing, and writing
+    // the audio happen on separate threads, connected by queues of this
+    // many packets. 0 (the default) does everything on the calling thread.
+    void setPipeline(int _queue_length);
+
+    // The sinks are called in the order they were added.
+    void addSink(Sink *sink);
+
+    const Stats &getStats() const;
+
+    // The difference between the first audio packet's timestamp and the
+    // first displayed video picture's timestamp. Returns false if either
+    // is unknown.
+    bool getAudioDelay(int stream_index, int64_t *milliseconds) const;
+
+    const std::string &getError() const;
+
+    // Indexes everything: begin(), step() until the end, then finish().
+    bool engage();
+
+    // Prints the header and the settings.
+    bool begin();
+
+    // Reads and handles one packet. Sets *finished at the end of the input,
+    // after which finish() must be called.
+    bool step(bool *finished);
+
+    // Prints the last data line and finishes everything else.
+    bool finish();
+
+private:
     FILE *d2v_file;
     std::unordered_map<int, FILE *> audio_files;
     FakeFile* fake_file;
     FFMPEG *f;
     AVStream *video_stream;
-    ProgressFunction progress_report;
     LoggingFunction log_message;
 
+    Thumbnailer *thumbnailer;
+    int thumbnail_interval;
+
+    GOPStats *gop_stats;
+
+    Trace *trace;
+
+    Progress *progress;
+    int progress_job;
+
+    int pipeline_queue_length;
+
+    std::vector<Sink *> sinks;
+    int64_t printed_pictures;
+
+    Timestamps *timestamps;
+    // Parallel to line.flags.
+    std::vector<Timestamps::Picture> line_timestamps;
+    std::vector<int64_t> line_pts;
+    std::vector<MPEGParser::UserData> line_user_data;
+
+    int64_t first_video_pts;
+    std::unordered_map<int, int64_t> first_audio_pts;
+
+    AudioIndex *audio_index;
+
+    HealthMonitor *health_monitor;
+
+    DamageReport *damage_report;
+
+    int resync_errors;
+    // Bad pictures lately, minus good ones.
+    int recent_errors;
+    int64_t last_resync_position;
+    // After a resync, until the next I picture.
+    bool dropping_pictures;
+
+    SegmentHandler *segment_handler;
+
+    struct SequenceParameters {
+        int width;
+        int height;
+        int aspect_ratio_information;
+        int frame_rate_code;
+        int frame_rate_extension_n;
+        int frame_rate_extension_d;
+
+        bool operator==(const SequenceParameters &other) const {
+            return width == other.width &&
+                   height == other.height &&
+                   aspect_ratio_information == other.aspect_ratio_information &&
+                   frame_rate_code == other.frame_rate_code &&
+                   frame_rate_extension_n == other.frame_rate_extension_n &&
+                   frame_rate_extension_d == other.frame_rate_extension_d;
+        }
+    };
+
+    bool have_sequence_parameters;
+    SequenceParameters sequence_parameters;
+    int segment_number;
+    Segment segment;
+
     MPEGParser parser;
 
     DataLine line;
+    int line_number;
+    // The GOP header of the current line said the GOP is closed.
+    bool line_gop_closed;
 
     Stats stats;
 
@@ -147,12 +354,46 @@ private:
 
     bool printSettings();
 
+    AVRational getDisplayAspectRatio(const SequenceParameters &parameters) const;
+
+    static AVRational getFrameRate(const SequenceParameters &parameters);
+
+    // Called for I pictures with a sequence header, before their data line
+    // is started.
+    bool checkSequenceParameters(int64_t packet_position);
+
     bool printDataLine();
 
+    int readFrame(AVPacket *packet);
+
     bool handleVideoPacket(AVPacket *packet);
 
     bool handleAudioPacket(AVPacket *packet);
 
+    void noteAudioStart(const AVPacket *packet);
+
+    // Only reads members, but adds to the audio index, which isn't locked.
+    // Safe because the pipeline's writer thread is the only caller when
+    // pipelining; don't call it from the parser thread as well.
+    bool writeAudioPacket(const AVPacket *packet, std::string &err) const;
+
+    // After the demuxer stopped returning packets.
+    bool checkHealth();
+
+    bool handleBadPicture(const AVPacket *packet, const std::string &problem);
+
+    // Returns the position of the next sequence or GOP header at or after
+    // position, or -1.
+    int64_t findNextHeader(int64_t position);
+
+    bool resync(const AVPacket *packet);
+
+    bool isWantedPacket(const AVPacket *packet) const;
+
+    bool readPackets();
+
+    bool readPacketsPipelined();
+
     bool printStreamEnd();
 };
 
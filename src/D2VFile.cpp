@@ -0,0 +1,604 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdlib>
+
+#include "Bullshit.h"
+#include "Compressor.h"
+#include "D2VFile.h"
+
+
+static bool readLine(gzFile file, std::string &text) {
+    text.clear();
+
+    char buffer[4096];
+
+    while (gzgets(file, buffer, sizeof(buffer))) {
+        text += buffer;
+
+        if (text.size() && text.back() == '\n')
+            break;
+    }
+
+    while (text.size() && (text.back() == '\n' || text.back() == '\r'))
+        text.pop_back();
+
+    return text.size() || !gzeof(file);
+}
+
+
+static bool parseNumber(const std::string &token, int base, int64_t *number) {
+    if (!token.size())
+        return false;
+
+    char *end;
+    *number = strtoll(token.c_str(), &end, base);
+
+    return *end == 0;
+}
+
+
+static int getFields(uint8_t flags) {
+    return (flags & D2V::FLAGS_RFF) ? 3 : 2;
+}
+
+
+bool D2VFile::parseDataLine(const std::string &text, int line_number, bool *end_of_stream) {
+    std::vector<std::string> tokens;
+
+    size_t token_start = 0;
+    while (token_start < text.size()) {
+        size_t token_end = text.find(' ', token_start);
+        if (token_end == std::string::npos)
+            token_end = text.size();
+
+        if (token_end > token_start)
+            tokens.push_back(text.substr(token_start, token_end - token_start));
+
+        token_start = token_end + 1;
+    }
+
+    std::string where = " on line " + std::to_string(line_number) + ".";
+
+    if (tokens.size() < 8) {
+        error = "Truncated data line" + where;
+        return false;
+    }
+
+    D2V::DataLine line;
+
+    int64_t numbers[7];
+    for (int i = 0; i < 7; i++) {
+        if (!parseNumber(tokens[i], i == 0 ? 16 : 10, &numbers[i])) {
+            error = "Invalid number '" + tokens[i] + "'" + where;
+            return false;
+        }
+    }
+
+    line.info = numbers[0];
+    line.matrix = numbers[1];
+    line.file = numbers[2];
+    line.position = numbers[3];
+    line.skip = numbers[4];
+    line.vob = numbers[5];
+    line.cell = numbers[6];
+
+    if (line.file < 0 || line.file >= (int)files.size()) {
+        error = "Invalid file number " + std::to_string(line.file) + where;
+        return false;
+    }
+
+    for (size_t i = 7; i < tokens.size(); i++) {
+        int64_t flags;
+        if (!parseNumber(tokens[i], 16, &flags) || flags < 0 || flags > 0xff) {
+            error = "Invalid flags '" + tokens[i] + "'" + where;
+            return false;
+        }
+
+        // The last line ends with "ff".
+        if (flags == 0xff) {
+            *end_of_stream = true;
+            break;
+        }
+
+        line.flags.push_back(flags);
+    }
+
+    lines.push_back(line);
+
+    return true;
+}
+
+
+bool D2VFile::parse(const std::string &path) {
+    files.clear();
+    settings.clear();
+    lines.clear();
+    fields_before_line.clear();
+    pictures_before_line.clear();
+
+    gzFile file = Compressor::openForReading(path, error);
+    if (!file) {
+        error = "Failed to open d2v file '" + path + "': " + error;
+        return false;
+    }
+
+    std::string text;
+    int line_number = 0;
+    bool okay = true;
+
+    enum {
+        SECTION_MAGIC,
+        SECTION_FILE_COUNT,
+        SECTION_FILES,
+        SECTION_SETTINGS,
+        SECTION_DATA,
+        SECTION_END
+    } section = SECTION_MAGIC;
+
+    int file_count = 0;
+
+    while (okay && section != SECTION_END && readLine(file, text)) {
+        line_number++;
+
+        if (section == SECTION_MAGIC) {
+            if (text.compare(0, 18, "DGIndexProjectFile") != 0) {
+                error = "Not a d2v file.";
+                okay = false;
+            }
+
+            section = SECTION_FILE_COUNT;
+        } else if (section == SECTION_FILE_COUNT) {
+            int64_t count;
+            if (!parseNumber(text, 10, &count) || count < 1) {
+                error = "Invalid number of files '" + text + "'.";
+                okay = false;
+            }
+
+            file_count = count;
+            section = SECTION_FILES;
+        } else if (section == SECTION_FILES) {
+            if ((int)files.size() < file_count) {
+                files.push_back(text);
+            } else {
+                if (text.size()) {
+                    error = "Expected an empty line after the list of files.";
+                    okay = false;
+                }
+
+                section = SECTION_SETTINGS;
+            }
+        } else if (section == SECTION_SETTINGS) {
+            if (text.size())
+                settings.push_back(text);
+            else
+                section = SECTION_DATA;
+        } else if (section == SECTION_DATA) {
+            if (!text.size())
+                continue;
+
+            bool end_of_stream = false;
+            okay = parseDataLine(text, line_number, &end_of_stream);
+            if (end_of_stream)
+                section = SECTION_END;
+        }
+    }
+
+    gzclose(file);
+
+    if (okay && section != SECTION_END) {
+        error = "The d2v file is truncated.";
+        okay = false;
+    }
+
+    if (!okay) {
+        error = "Failed to parse d2v file '" + path + "': " + error;
+        return false;
+    }
+
+    buildFrameTable();
+
+    return true;
+}
+
+
+bool D2VFile::write(const std::string &path, int compression) {
+    FILE *output;
+    if (path == "-") {
+        output = stdout;
+    } else {
+        output = openFile(path.c_str(), "wb");
+        if (!output) {
+            error = "Failed to open d2v file '" + path + "' for writing: " + strerror(errno);
+            return false;
+        }
+    }
+
+    FILE *file = output;
+
+    Compressor compressor(output, Z_DEFAULT_COMPRESSION);
+    if (compression == Compressor::GZIP_COMPRESSION) {
+        if (!compressor.start()) {
+            error = compressor.getError();
+            if (output != stdout)
+                fclose(output);
+            return false;
+        }
+
+        file = compressor.getInput();
+    }
+
+    std::string header;
+
+    header += "DGIndexProjectFile16\n";
+    header += std::to_string(files.size()) + "\n";
+    for (size_t i = 0; i < files.size(); i++)
+        header += files[i] + "\n";
+    header += "\n";
+
+    for (size_t i = 0; i < settings.size(); i++)
+        header += settings[i] + "\n";
+
+    bool okay = fprintf(file, "%s", header.c_str()) >= 0;
+
+    for (size_t i = 0; i < lines.size() && okay; i++) {
+        const D2V::DataLine &line = lines[i];
+
+        okay = fprintf(file, "\n%x %d %d %" PRId64 " %d %d %d",
+                       line.info,
+                       line.matrix,
+                       line.file,
+                       line.position,
+                       line.skip,
+                       line.vob,
+                       line.cell) >= 0;
+
+        for (size_t j = 0; j < line.flags.size() && okay; j++)
+            okay = fprintf(file, " %x", (int)line.flags[j]) >= 0;
+    }
+
+    if (okay)
+        okay = fprintf(file, " ff\n") >= 0;
+
+    if (!compressor.finish()) {
+        error = "Failed to write d2v file '" + path + "': " + compressor.getError();
+        okay = false;
+    } else if (!okay) {
+        error = "Failed to write d2v file '" + path + "'.";
+    }
+
+    if (output != stdout) {
+        if (fclose(output) && okay) {
+            error = "Failed to write d2v file '" + path + "'.";
+            okay = false;
+        }
+    } else if (fflush(output) && okay) {
+        error = "Failed to write d2v file '" + path + "'.";
+        okay = false;
+    }
+
+    if (!okay)
+        return false;
+
+    return true;
+}
+
+
+void D2VFile::markCutPoint(D2V::DataLine &line) {
+    line.info |= D2V::INFO_STARTS_NEW_GOP;
+
+    // The pictures that needed the previous GOP now have the wrong one,
+    // so the GOP can only be called closed if there are no such pictures.
+    bool closed = true;
+    for (size_t i = 0; i < line.flags.size(); i++)
+        if (!(line.flags[i] & D2V::FLAGS_DECODABLE_WITHOUT_PREVIOUS_GOP))
+            closed = false;
+
+    if (closed)
+        line.info |= D2V::INFO_CLOSED_GOP;
+    else
+        line.info &= ~D2V::INFO_CLOSED_GOP;
+}
+
+
+bool D2VFile::append(const D2VFile &other) {
+    for (size_t i = 0; i < settings.size() || i < other.settings.size(); i++) {
+        std::string setting = i < settings.size() ? settings[i] : "";
+        std::string other_setting = i < other.settings.size() ? other.settings[i] : "";
+
+        // Location is not used by anyone.
+        if (setting.compare(0, 9, "Location=") == 0 && other_setting.compare(0, 9, "Location=") == 0)
+            continue;
+
+        if (setting != other_setting) {
+            error = "The d2v files have different settings: '" + setting + "' and '" + other_setting + "'.";
+            return false;
+        }
+    }
+
+    std::vector<int> file_map;
+    for (size_t i = 0; i < other.files.size(); i++) {
+        auto it = std::find(files.cbegin(), files.cend(), other.files[i]);
+        if (it == files.cend()) {
+            files.push_back(other.files[i]);
+            it = files.cend() - 1;
+        }
+
+        file_map.push_back(it - files.cbegin());
+    }
+
+    size_t first_new_line = lines.size();
+
+    for (size_t i = 0; i < other.lines.size(); i++) {
+        lines.push_back(other.lines[i]);
+        lines.back().file = file_map[other.lines[i].file];
+    }
+
+    if (first_new_line > 0 && first_new_line < lines.size())
+        markCutPoint(lines[first_new_line]);
+
+    buildFrameTable();
+
+    return true;
+}
+
+
+bool D2VFile::trim(const std::vector<FrameRange> &ranges, D2VFile &output, std::vector<FrameRange> &actual_ranges) {
+    output.files = files;
+    output.settings = settings;
+    output.lines.clear();
+
+    actual_ranges.clear();
+
+    int last_copied_line = -1;
+    int64_t output_fields = 0;
+
+    for (size_t i = 0; i < ranges.size(); i++) {
+        FrameLocation first, last;
+
+        if (ranges[i].first > ranges[i].second ||
+            !findFrame(ranges[i].first, &first) ||
+            !findFrame(ranges[i].second, &last)) {
+            error = "Invalid frame range " + std::to_string(ranges[i].first) + "-" + std::to_string(ranges[i].second) +
+                    ". The d2v file has " + std::to_string(getFrameCount()) + " frames.";
+            return false;
+        }
+
+        int64_t range_fields = fields_before_line[last.line + 1] - fields_before_line[first.line];
+
+        actual_ranges.push_back({ output_fields / 2, (output_fields + range_fields) / 2 - 1 });
+
+        output_fields += range_fields;
+
+        for (int j = first.line; j <= last.line; j++) {
+            output.lines.push_back(lines[j]);
+
+            if (j - 1 != last_copied_line)
+                markCutPoint(output.lines.back());
+
+            last_copied_line = j;
+        }
+    }
+
+    output.buildFrameTable();
+
+    return true;
+}
+
+
+std::string D2VFile::getSetting(const std::string &name) const {
+    for (size_t i = 0; i < settings.size(); i++) {
+        if (settings[i].size() > name.size() &&
+            settings[i].compare(0, name.size(), name) == 0 &&
+            settings[i][name.size()] == '=')
+            return settings[i].substr(name.size() + 1);
+    }
+
+    return "";
+}
+
+
+int D2VFile::getStreamType() const {
+    int64_t stream_type;
+    if (!parseNumber(getSetting("Stream_Type"), 10, &stream_type))
+        return D2V::UNSUPPORTED_STREAM;
+
+    return stream_type;
+}
+
+
+int D2VFile::getVideoId() const {
+    if (getStreamType() != D2V::TRANSPORT_STREAM)
+        return -1;
+
+    std::string pids = getSetting("MPEG2_Transport_PID");
+
+    int64_t video_id;
+    if (!parseNumber(pids.substr(0, pids.find(',')), 16, &video_id))
+        return -1;
+
+    return video_id;
+}
+
+
+const std::string &D2VFile::getError() const {
+    return error;
+}
+
+
+
+void D2VFile::buildFrameTable() {
+    fields_before_line.resize(lines.size() + 1);
+    pictures_before_line.resize(lines.size() + 1);
+
+    int64_t fields = 0;
+    int64_t pictures = 0;
+
+    for (size_t i = 0; i < lines.size(); i++) {
+        fields_before_line[i] = fields;
+        pictures_before_line[i] = pictures;
+
+        for (size_t j = 0; j < lines[i].flags.size(); j++)
+            fields += getFields(lines[i].flags[j]);
+
+        pictures += lines[i].flags.size();
+    }
+
+    fields_before_line[lines.size()] = fields;
+    pictures_before_line[lines.size()] = pictures;
+}
+
+
+AVRational D2VFile::getFrameRate() const {
+    // "Frame_Rate=29970 (30000/1001)"
+    std::string frame_rate = getSetting("Frame_Rate");
+
+    size_t open = frame_rate.find('(');
+    size_t slash = frame_rate.find('/', open);
+    size_t close = frame_rate.find(')', slash);
+
+    int64_t num, den;
+
+    if (open == std::string::npos || slash == std::string::npos || close == std::string::npos ||
+        !parseNumber(frame_rate.substr(open + 1, slash - open - 1), 10, &num) ||
+        !parseNumber(frame_rate.substr(slash + 1, close - slash - 1), 10, &den) ||
+        num <= 0 || den <= 0)
+        return { 0, 0 };
+
+    return { (int)num, (int)den };
+}
+
+
+int64_t D2VFile::getFrameCount() const {
+    if (!fields_before_line.size())
+        return 0;
+
+    return fields_before_line.back() / 2;
+}
+
+
+bool D2VFile::findFrame(int64_t frame, FrameLocation *location) const {
+    if (frame < 0 || frame >= getFrameCount())
+        return false;
+
+    // The frame is wherever its first field is.
+    int64_t field = frame * 2;
+
+    auto it = std::upper_bound(fields_before_line.cbegin(), fields_before_line.cend(), field);
+    int line_index = (it - fields_before_line.cbegin()) - 1;
+
+    const D2V::DataLine &line = lines[line_index];
+
+    int64_t fields = fields_before_line[line_index];
+    size_t frame_in_line = 0;
+    while (frame_in_line < line.flags.size() - 1 && fields + getFields(line.flags[frame_in_line]) <= field) {
+        fields += getFields(line.flags[frame_in_line]);
+        frame_in_line++;
+    }
+
+    location->frame = frame;
+    location->line = line_index;
+    location->frame_in_line = frame_in_line;
+    location->file = line.file;
+    location->position = line.position;
+
+    return true;
+}
+
+
+void D2VFile::findFrames(const std::vector<int64_t> &frames, std::vector<FrameLocation> &locations, std::vector<bool> &found) const {
+    locations.resize(frames.size());
+    found.resize(frames.size());
+
+    for (size_t i = 0; i < frames.size(); i++)
+        found[i] = findFrame(frames[i], &locations[i]);
+}
+
+
+int64_t D2VFile::getFrameAtTime(double seconds) const {
+    AVRational frame_rate = getFrameRate();
+    if (frame_rate.num <= 0 || seconds < 0)
+        return -1;
+
+    // The small bias protects against timecodes like 0.0333 being just under a frame boundary.
+    int64_t frame = (int64_t)std::floor(seconds * frame_rate.num / frame_rate.den + 1e-6);
+    if (frame >= getFrameCount())
+        return -1;
+
+    return frame;
+}
+
+
+int64_t D2VFile::getFrameOfPicture(int64_t picture) const {
+    if (picture < 0 || !pictures_before_line.size() || picture >= pictures_before_line.back())
+        return -1;
+
+    auto it = std::upper_bound(pictures_before_line.cbegin(), pictures_before_line.cend(), picture);
+    int line_index = (it - pictures_before_line.cbegin()) - 1;
+
+    const D2V::DataLine &line = lines[line_index];
+
+    int64_t fields = fields_before_line[line_index];
+    for (int64_t i = pictures_before_line[line_index]; i < picture; i++)
+        fields += getFields(line.flags[i - pictures_before_line[line_index]]);
+
+    return fields / 2;
+}
+
+
+double D2VFile::parseTimecode(const std::string &timecode) {
+    double seconds = 0;
+
+    size_t start = 0;
+    int parts = 0;
+
+    while (true) {
+        size_t colon = timecode.find(':', start);
+        std::string part = timecode.substr(start, colon == std::string::npos ? std::string::npos : colon - start);
+
+        if (!part.size() || part.find_first_not_of("0123456789.") != std::string::npos)
+            return -1;
+
+        char *end;
+        double value = strtod(part.c_str(), &end);
+        if (*end)
+            return -1;
+
+        // Only the seconds can have a fractional part.
+        if (colon != std::string::npos && part.find('.') != std::string::npos)
+            return -1;
+
+        seconds = seconds * 60 + value;
+        parts++;
+
+        if (colon == std::string::npos)
+            break;
+
+        start = colon + 1;
+    }
+
+    if (parts > 3)
+        return -1;
+
+    return seconds;
+}
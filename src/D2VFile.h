@@ -0,0 +1,132 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#ifndef D2V_WITCH_D2VFILE_H
+#define D2V_WITCH_D2VFILE_H
+
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <libavutil/rational.h>
+}
+
+#include "D2V.h"
+
+
+// An existing D2V file, read back into memory.
+//
+// Frame numbers count displayed frames, that is, the repeat first field
+// flags are honoured, like d2vsource does by default.
+class D2VFile {
+public:
+    typedef std::pair<int64_t, int64_t> FrameRange;
+
+    struct FrameLocation {
+        int64_t frame;
+        int line;
+        // Index into the line's flags.
+        int frame_in_line;
+        int file;
+        int64_t position;
+    };
+
+    std::vector<std::string> files;
+
+    // "Name=value" lines, in their original order.
+    std::vector<std::string> settings;
+
+    std::vector<D2V::DataLine> lines;
+
+
+    // The file may be compressed with gzip.
+    bool parse(const std::string &path);
+
+    // The special name "-" means standard output. compression is one of
+    // Compressor::Compression.
+    bool write(const std::string &path, int compression);
+
+    // Appends the lines of another D2V file, which must have the same
+    // settings, adding its input files to the list.
+    bool append(const D2VFile &other);
+
+    // Copies the data lines containing the frames in the ranges (first and
+    // last frame, inclusive) to output. The ranges are extended to whole
+    // lines, and the ranges actually copied are stored in actual_ranges,
+    // numbered as in the output.
+    bool trim(const std::vector<FrameRange> &ranges, D2VFile &output, std::vector<FrameRange> &actual_ranges);
+
+    // Returns an empty string if the setting is missing.
+    std::string getSetting(const std::string &name) const;
+
+    int getStreamType() const;
+
+    // The video PID for transport streams, otherwise -1.
+    int getVideoId() const;
+
+    // From the Frame_Rate setting, or 0/0 if it's missing.
+    AVRational getFrameRate() const;
+
+    int64_t getFrameCount() const;
+
+    // O(log n). Returns false if the frame doesn't exist.
+    bool findFrame(int64_t frame, FrameLocation *location) const;
+
+    void findFrames(const std::vector<int64_t> &frames, std::vector<FrameLocation> &locations, std::vector<bool> &found) const;
+
+    // Returns -1 if the time is before the start or after the end.
+    int64_t getFrameAtTime(double seconds) const;
+
+    // Pictures are counted without honouring the repeat first field
+    // flags, one per element of the lines' flags. Returns -1 if the
+    // picture doesn't exist.
+    int64_t getFrameOfPicture(int64_t picture) const;
+
+    // Accepts "[[hh:]mm:]ss[.sss]". Returns -1 if the string is invalid.
+    static double parseTimecode(const std::string &timecode);
+
+    const std::string &getError() const;
+
+private:
+    std::string error;
+
+    // fields_before_line[i] is the number of fields displayed before line i.
+    // It has one extra element at the end, with the total.
+    std::vector<int64_t> fields_before_line;
+
+    // Same, with the pictures.
+    std::vector<int64_t> pictures_before_line;
+
+
+    void buildFrameTable();
+
+    // For a line whose predecessor in the file is not its predecessor in
+    // the source anymore.
+    static void markCutPoint(D2V::DataLine &line);
+
+
+    bool parseDataLine(const std::string &text, int line_number, bool *end_of_stream);
+};
+
+
+#endif // D2V_WITCH_D2VFILE_H
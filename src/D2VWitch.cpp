@@ -18,7 +18,11 @@ SOFTWARE.
 */
 
 
+#include <algorithm>
+#include <cinttypes>
+#include <memory>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -37,15 +41,31 @@ extern "C" {
 #endif
 
 
+#include "Analyzer.h"
+#include "AudioIndex.h"
 #include "Bullshit.h"
+#include "CoarseIndex.h"
+#include "Compressor.h"
+#include "ContinuousIndexer.h"
 #include "D2V.h"
+#include "D2VFile.h"
+#include "DamageReport.h"
+#include "Daemon.h"
+#include "DVDTitle.h"
 #include "FakeFile.h"
 #include "FFMPEG.h"
-
-
-void printProgress(int64_t current_position, int64_t total_size) {
-    fprintf(stderr, "%3d%%\r", (int)(current_position * 100 / total_size));
-}
+#include "GOPStats.h"
+#include "Hash.h"
+#include "HealthMonitor.h"
+#include "IncrementalIndex.h"
+#include "Progress.h"
+#include "Sinks.h"
+#include "ThreadedSink.h"
+#include "Throttle.h"
+#include "Thumbnailer.h"
+#include "Timestamps.h"
+#include "Trace.h"
+#include "Verifier.h"
 
 
 void printWarnings(const std::string &message) {
@@ -117,12 +137,211 @@ void deselectAllStreams(AVFormatContext *fctx) {
 }
 
 
+bool writeHashes(FILE *hash_file, const Hasher &hasher, std::string &error) {
+    std::string hashes;
+
+    hashes += "# ";
+    hashes += Hasher::getAlgorithmName(hasher.getAlgorithm());
+    hashes += "\n";
+
+    const std::vector<Hasher::Digest> &digests = hasher.getFileDigests();
+    for (auto it = digests.cbegin(); it != digests.cend(); it++)
+        hashes += it->hex + "  " + it->name + "\n";
+
+    hashes += "# all files: " + hasher.getTotalDigest() + "\n";
+
+    if (fprintf(hash_file, "%s", hashes.c_str()) < 0) {
+        error = "Failed to write hash file: fprintf() failed.";
+        return false;
+    }
+
+    return true;
+}
+
+
+// Written under a temporary name first, because other programs may be
+// waiting for it to appear.
+bool writeCoarseIndex(const FakeFile &fake_file, int samples, const std::string &path, std::string &error) {
+    CoarseIndex index(fake_file, samples);
+    if (!index.build()) {
+        error = "Failed to build the coarse index: " + index.getError();
+        return false;
+    }
+
+    std::string temporary_path = path + ".part";
+
+    FILE *file = openFile(temporary_path.c_str(), "wb");
+    if (!file) {
+        error = "Failed to open coarse index file '" + temporary_path + "' for writing: " + strerror(errno);
+        return false;
+    }
+
+    bool okay = index.write(file);
+    if (!okay)
+        error = index.getError();
+
+    if (fclose(file) && okay) {
+        error = "Failed to close '" + temporary_path + "': " + strerror(errno);
+        okay = false;
+    }
+
+    if (okay && rename(temporary_path.c_str(), path.c_str())) {
+        error = "Failed to rename '" + temporary_path + "' to '" + path + "': " + strerror(errno);
+        okay = false;
+    }
+
+    if (!okay)
+        remove(temporary_path.c_str());
+
+    return okay;
+}
+
+
+// timestamps can be null.
+bool queryFrames(const D2VFile &d2v, const Timestamps *timestamps, FILE *input, FILE *output, std::string &error) {
+    std::vector<std::string> queries;
+    std::vector<int64_t> frames;
+
+    char buffer[512];
+    while (fgets(buffer, sizeof(buffer), input)) {
+        std::string query(buffer);
+        while (query.size() && (query.back() == '\n' || query.back() == '\r' || query.back() == ' '))
+            query.pop_back();
+
+        if (!query.size())
+            continue;
+
+        int64_t frame = -1;
+
+        if (query.find_first_of(":.") != std::string::npos) {
+            double seconds = D2VFile::parseTimecode(query);
+            if (seconds >= 0 && timestamps)
+                frame = d2v.getFrameOfPicture(timestamps->getPictureAtTime(seconds));
+            else if (seconds >= 0)
+                frame = d2v.getFrameAtTime(seconds);
+        } else {
+            size_t converted_chars;
+            try {
+                frame = std::stoll(query, &converted_chars);
+            } catch (...) {
+                converted_chars = 0;
+            }
+
+            if (converted_chars != query.size())
+                frame = -1;
+        }
+
+        queries.push_back(query);
+        frames.push_back(frame);
+    }
+
+    std::vector<D2VFile::FrameLocation> locations;
+    std::vector<bool> found;
+    d2v.findFrames(frames, locations, found);
+
+    for (size_t i = 0; i < queries.size(); i++) {
+        int ret;
+
+        if (found[i])
+            ret = fprintf(output, "%" PRId64 " %d %d %" PRId64 " %d\n",
+                          locations[i].frame,
+                          locations[i].line,
+                          locations[i].file,
+                          locations[i].position,
+                          locations[i].frame_in_line);
+        else
+            ret = fprintf(output, "%s not found\n", queries[i].c_str());
+
+        if (ret < 0) {
+            error = "Failed to print query results: fprintf() failed.";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+// Answers as soon as the GOP with the picture is indexed, with the
+// coarse index's guess first, if it has one.
+bool queryFramesLive(IncrementalIndex &index, FILE *input, FILE *output, std::string &error) {
+    char buffer[512];
+    while (fgets(buffer, sizeof(buffer), input)) {
+        std::string query(buffer);
+        while (query.size() && (query.back() == '\n' || query.back() == '\r' || query.back() == ' '))
+            query.pop_back();
+
+        if (!query.size())
+            continue;
+
+        int64_t picture;
+        size_t converted_chars;
+        try {
+            picture = std::stoll(query, &converted_chars);
+        } catch (...) {
+            converted_chars = 0;
+        }
+
+        if (converted_chars != query.size() || picture < 0) {
+            if (fprintf(output, "%s not found\n", query.c_str()) < 0 || fflush(output)) {
+                error = "Failed to print query results: fprintf() failed.";
+                return false;
+            }
+
+            continue;
+        }
+
+        IncrementalIndex::SeekPoint point;
+
+        int ret = 0;
+        if (index.findSeekPoint(picture, &point) && !point.exact) {
+            ret = fprintf(output, "%" PRId64 " %d %" PRId64 " %" PRId64 " approximate\n",
+                          picture,
+                          point.file,
+                          point.position,
+                          point.first_picture);
+            fflush(output);
+        }
+
+        if (!index.ensureFrame(picture)) {
+            error = "Failed to index: " + index.getError();
+            return false;
+        }
+
+        if (ret >= 0) {
+            if (index.findSeekPoint(picture, &point) && point.exact)
+                ret = fprintf(output, "%" PRId64 " %d %" PRId64 " %" PRId64 " exact\n",
+                              picture,
+                              point.file,
+                              point.position,
+                              point.first_picture);
+            else
+                ret = fprintf(output, "%s not found\n", query.c_str());
+        }
+
+        if (ret < 0 || fflush(output)) {
+            error = "Failed to print query results: fprintf() failed.";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
 void printHelp() {
     const char usage[] = R"usage(
 D2V Witch indexes MPEG (1, 2) streams and writes D2V files. These can
 be used with the VapourSynth plugin d2vsource.
 
 Usage: D2VWitch [options] input_file1 input_file2 ...
+       D2VWitch --verify <d2v name> [--verify-samples <n>] [--verify-decode]
+       D2VWitch --query <d2v name>
+       D2VWitch --live-query [--coarse-index <n>] [--video-id <id>] input_file1 ...
+       D2VWitch --edit --output <d2v name> [--ranges <ranges>] d2v1 d2v2 ...
+       D2VWitch [options] --watch <directory1> --watch <directory2> ...
+       D2VWitch [options] --continuous <directory>
+       D2VWitch --decompress <d2v name>
 
 Options:
     --help
@@ -154,6 +373,348 @@ Options:
         Process the video track with this id. By default, the first
         video track found will be processed.
 
+    --title <n>
+        Index only title n of a DVD. The input must then be the DVD's
+        VIDEO_TS.IFO, where the titles of the whole disc are counted, or
+        one VTS_xx_0.IFO, where only the titles of that title set are
+        counted. Only the parts of the title set's VOB files that belong
+        to the title are read, and the VOB and cell ids are written to
+        the D2V file. The default is 1 when the input is an IFO file. If
+        --output is not used, the name of the D2V file is the name of the
+        IFO file plus the title number.
+
+    --angle <n>
+        Index angle n of the DVD title. The default is 1.
+
+    --hash <algorithm>
+        Compute checksums of the input files while indexing them, one
+        per file and one for all of them together. The supported
+        algorithms are "xxh64" and "sha256". The checksums are written
+        to a file whose name is the name of the D2V file plus ".hash".
+        If the D2V file is standard output, the name of the first input
+        file is used instead.
+
+    --thumbnails <directory>
+        Decode the first picture of some GOPs while indexing, and write
+        160 pixels wide greyscale thumbnails (PGM) into the specified
+        directory, which must exist. The thumbnails are named after the
+        number of the D2V line (starting at 0) of their GOP, for example
+        "00000012.pgm".
+
+    --thumbnail-interval <n>
+        Create a thumbnail every n GOPs. The default is 10.
+
+    --gop-stats <file name>
+        Write the size, number of frames, picture types, and bitrate of
+        every GOP to the specified file, in CSV format, followed by a
+        summary with the average and peak bitrates and histograms of the
+        GOP lengths and bitrates. The "span" column is the number of bytes
+        from the start of the GOP to the start of the next one.
+
+    --keyframes <file name>
+        Write the numbers of the pictures that are I pictures to the
+        specified file, in Aegisub's keyframe format. Picture numbers
+        are counted in the order of the D2V file, without pulldown.
+
+    --timecodes <file name>
+        Write the time of every picture, in milliseconds, to the
+        specified file, in mkvmerge's timecode format v2. The times come
+        from the presentation timestamps. Pictures without one, or with
+        one that would make the times go backwards, get the previous time
+        plus one frame.
+
+    --gop-json <file name>
+        Write every GOP to the specified file as a JSON object, one per
+        line: its data line number, file and position, first picture
+        number, number of pictures, GOP flags, picture types, and
+        presentation timestamps.
+
+    --captions <file name>
+        Write the closed captions carried in the pictures' user data
+        (ATSC A/53) to the specified file, with the picture numbers in
+        display order. If the file name ends in ".scc", the CEA-608
+        captions of the first field are written in SCC format, with one
+        caption word per frame. The timecodes count frames from the
+        pictures' fields, so they stay in sync with soft telecined
+        material, where some pictures last three fields. Otherwise,
+        every picture with captions gets a line with its number and all
+        of its cc_data constructs in hexadecimal, three bytes each, so
+        that CEA-708 captions are kept too.
+
+    --afd <file name>
+        Write the Active Format Description (DTG1) and the bar data
+        (ATSC A/53) from the pictures' user data to the specified file,
+        one line for every picture where they change: the picture number,
+        the active format, and the top, bottom, left, and right bars.
+        Values that were never given are -1.
+
+    --sink-threads
+        Write the files of --keyframes, --timecodes, --gop-json,
+        --captions, and --afd on their own threads.
+
+    --verify <d2v name>
+        Check that an existing D2V file still matches its input files,
+        without indexing them again. Some of the data lines are checked
+        by seeking to their positions and making sure that an I picture
+        with the right GOP flags starts there. The input files are taken
+        from the D2V file. Problems are printed and the exit code is 1
+        if there were any.
+
+    --verify-samples <n>
+        Check this many data lines, evenly spaced. The value 0 means all
+        of them. The default is 100.
+
+    --verify-decode
+        Also decode the pictures of the checked data lines, and make sure
+        that the decoder returns as many frames as the "skip" field says.
+        The "skip" field is the number of leading B pictures of an open
+        GOP, which can't be decoded when decoding starts at that GOP, and
+        0 for closed GOPs. D2V files written by versions that always set
+        "skip" to 0 fail this check when they have open GOPs.
+
+    --analyze
+        Only look at the picture headers of the video track and print
+        statistics about them, without writing a D2V file or demuxing
+        any audio: the frame counts, whether the video is progressive,
+        soft telecined, interlaced, or a mix, the number of breaks in the
+        pulldown cadence, the number of field order changes, and the GOP
+        lengths and anchor picture distances.
+
+    --analyze-seconds <n>
+        Stop analyzing after n seconds of video.
+
+    --analyze-confidence <fraction>
+        Stop analyzing as soon as this fraction of the frames (between 0
+        and 1, for example 0.95) belongs to the same class, after at least
+        100 frames.
+
+    --live-query
+        Read picture numbers (in the order of the flags in a D2V file)
+        from standard input, one per line, and print where to start
+        reading the input files to get each of them: "picture file
+        position first_picture exact", where first_picture is the number
+        of the first picture of the GOP there. The input files are only
+        indexed as far as needed to answer, so the first answers come
+        long before a D2V file for the whole input could be written.
+        With --coarse-index, a line ending in "approximate" from the
+        coarse index is printed first for pictures not indexed yet.
+        Nothing is written to disk.
+
+    --query <d2v name>
+        Read frame numbers or timecodes ("[[hh:]mm:]ss[.sss]") from
+        standard input, one per line, and print where each frame is in
+        the D2V file: "frame line file position index", where line is
+        the number of the data line (starting at 0), file and position
+        are the data line's fields, and index is the position of the
+        frame in the data line's list of flags. Plain integers are frame
+        numbers. Frame numbers honour the repeat first field flags. If
+        the D2V file has a timestamps file (see --timestamps), the
+        timecodes are looked up there instead of being computed from
+        the frame rate; they start at the first picture and skip over
+        timestamp discontinuities.
+
+    --edit
+        Write a new D2V file (specified with --output) made from existing
+        D2V files, which are given instead of the input files, without
+        reading the video files. The D2V files are concatenated, and they
+        must have the same settings. With --ranges, only the specified
+        frames are kept.
+
+    --ranges <first1-last1,first2-last2,...>
+        With --edit, keep only these frames, in this order. The ranges are
+        extended to whole GOPs, and the frame numbers of the ranges in the
+        new D2V file are printed. At the start of every cut, the GOP is
+        marked as a new GOP, and as closed only if none of its pictures
+        need the previous GOP.
+
+    --trace <file name>
+        Record how long reading, demuxing, parsing, and writing take
+        while indexing, and on which threads, and write it to the
+        specified file in the Chrome trace event format (JSON). The file
+        can be opened in chrome://tracing or https://ui.perfetto.dev.
+
+    --trace-sampling <n>
+        Record only one in n events of each kind, so that events which
+        always come in the same order are all sampled. The default is 1
+        (all of them).
+
+    --trace-events <n>
+        Keep only the last n events. The default is 1000000, which needs
+        about 40 MB of memory.
+
+    --compress <algorithm>
+        Compress the D2V file while writing it, on a separate thread.
+        The supported algorithms are "gzip" and "none". By default, D2V
+        files whose names end in ".gz" are compressed with gzip, and the
+        others are not. If the name of the D2V file is not specified, it
+        gets an extra ".gz" with --compress gzip. Compressed D2V files can
+        be given to --verify, --query, and --edit.
+
+    --decompress <d2v name>
+        Write the uncompressed contents of a compressed D2V file to
+        standard output, for programs that can't read it directly.
+        Uncompressed files are written as they are.
+
+    --timestamps
+        Write the presentation and decoding timestamps of every video
+        picture to a file whose name is the name of the D2V file plus
+        ".timestamps" (or the name of the first input file, if the D2V
+        file is standard output). The timestamps are delta encoded, in
+        the order of the pictures in the D2V file, and discontinuities
+        are marked. The delay of each demuxed audio track relative to
+        the video is also stored there, and printed.
+
+    --resync <n>
+        When n pictures can't be indexed in a short time, because of
+        invalid dimensions or an unknown picture type, look for the next
+        sequence or GOP header in the input and continue from there,
+        instead of waiting for the demuxer to find its way through the
+        damaged data. The pictures after the jump are left out until the
+        next I picture. Can't be used with --pipeline.
+
+    --damage-report
+        Write what was lost to damaged data to a file whose name is the
+        name of the D2V file plus ".damage.json" (or the name of the
+        first input file, if the D2V file is standard output). For every
+        damaged region, it has the byte range, from the first picture
+        that couldn't be indexed to the next I picture, the position in
+        the input file, the bytes jumped over with --resync, the numbers
+        of bad and dropped pictures, the data line that was affected, and
+        the first data line after the damage.
+
+    --audio-index <n>
+        Write a seek index next to every demuxed audio file, in a file
+        whose name is the name of the audio file plus ".idx". It has an
+        entry for every n-th audio frame, with the frame's byte offset in
+        the audio file, its timestamp, the number of samples before it,
+        and its number of samples, so that players can find a position
+        with a binary search instead of reading the audio from the
+        start. Use 1 to index every frame.
+
+    --split
+        Start a new D2V file whenever the sequence parameters (frame
+        size, aspect ratio, or frame rate) change, with the correct
+        settings for that part of the video. The first part goes in the
+        usual D2V file, the others in files named like it with ".1",
+        ".2", etc. before the extension. A list of the parts, with their
+        first picture, number of pictures, settings, and starting
+        position, is written to a file whose name is the name of the D2V
+        file plus ".segments". The input is still read only once. Audio,
+        thumbnails, GOP statistics, and timestamps always cover the whole
+        video. Can't be used when the D2V file is standard output.
+
+    --coarse-index <n>
+        Before indexing, look at n evenly spaced places in the input and
+        write a rough seek table to a file whose name is the name of the
+        D2V file plus ".coarse" (or the name of the first input file, if
+        the D2V file is standard output). Each line has the position of
+        a sequence or GOP header (in all the files together, and in its
+        own file), and the estimated number of the frame there, from the
+        PTS or from the bitrate. This takes milliseconds even for huge
+        files, so players can seek approximately while the D2V file is
+        made. The file is deleted once the D2V file is complete.
+
+    --max-read-rate <n>
+        Read the input files at most n megabytes per second, so that
+        other users of the same storage still get their share. With
+        --watch, the limit is shared by all the files being indexed.
+
+    --read-latency <n>
+        When reading the input files takes longer than n milliseconds on
+        average, halve the read rate, at most once per second, and raise
+        it again slowly once reads are fast. Combined with
+        --max-read-rate, the rate never goes above that limit.
+
+    --idle-io
+        Read the input files with the idle I/O scheduling class, so that
+        the disk serves everyone else first. Only supported on Linux.
+
+    --health-check <n>
+        Check the input in windows of n MB while indexing, and give up
+        with a diagnosis as soon as a window breaks one of the limits of
+        --health-limits. The first window is checked before the rest of
+        the file is read, so scrambled, empty, or badly damaged inputs
+        fail within seconds. In transport streams, the scrambled packets,
+        continuity counter errors, and losses of sync are counted. In all
+        inputs, the video pictures are counted, a little behind the other
+        checks because the demuxer reads ahead.
+
+    --health-limits <list>
+        The limits for --health-check, as a comma separated list of
+        name=value pairs:
+            scrambled=<percentage of transport packets scrambled>
+            cc=<continuity counter errors per 1000 transport packets>
+            resyncs=<losses of the transport stream sync per MB>
+            pictures=<minimum number of video pictures per window>
+        The default is "scrambled=10,cc=20,resyncs=5,pictures=1".
+
+    --pipeline
+        Demux, parse the video, and write the audio on separate threads,
+        connected by bounded lock-free queues, so that the indexing speed
+        is set by the slowest of them instead of their sum. Also turns on
+        --read-ahead 8 unless --read-ahead is given. Useful for inputs
+        that can't be split, like growing files. The inputs must still
+        be seekable, so pipes can't be indexed.
+
+    --read-ahead <n>
+        Read up to n megabytes of the input files ahead, on a separate
+        thread. The default is 0 (off), or 8 with --pipeline.
+
+    --progress-fd <n>
+        Write progress reports to this file descriptor, as JSON lines.
+        A "progress" line has the bytes read, the total number of bytes,
+        the frames and GOPs seen so far, the current throughput in bytes
+        per second, and the estimated number of seconds left ("eta"),
+        both for each file being indexed ("jobs") and for all of them
+        together. When a file is finished, a "done" or "failed" line is
+        written.
+
+    --progress-rate <n>
+        Report progress at most n times per second, both on the console
+        and with --progress-fd. The default is 2.
+
+    --watch <directory>
+        Keep running and index every MPEG file that appears in the
+        directory, once its size has stopped changing. This option can be
+        given more than once; files from the first directories are
+        indexed first. The D2V, audio, and hash files are written next to
+        each input file, under temporary names that are only renamed once
+        the file was indexed successfully. Files that already have a
+        newer D2V file are skipped. SIGINT and SIGTERM stop the daemon
+        once the files being indexed are done. Only supported on Linux.
+
+    --workers <n>
+        With --watch, index up to n files at the same time. The default
+        is 2.
+
+    --stable-seconds <n>
+        With --watch or --continuous, consider a file complete when its
+        size hasn't changed for n seconds. The default is 30.
+
+    --control-socket <path>
+        With --watch, create a Unix socket at this path. Every connection
+        receives the daemon's status as one line of JSON, with the number
+        of pending (still changing), queued, done, and failed files, the
+        files being indexed, and the most recent failures.
+
+    --continuous <directory>
+        Keep running and index the rotating segments a recorder writes
+        into the directory in time buckets. Every segment belongs to the
+        bucket its modification time falls in. Once a bucket is over and
+        its segments stopped changing, they are indexed together into
+        one D2V file named after the start of the bucket in UTC, such as
+        '20161024-130000.d2v'. The D2V file only refers to the segments
+        of its own bucket and starts at the first GOP found in them.
+        Segments that show up after their bucket was indexed are
+        ignored. Buckets that already have a D2V file are skipped. With
+        --output, the D2V files are written to that directory instead.
+        SIGINT and SIGTERM stop indexing once the current bucket is done.
+        Only supported on Linux.
+
+    --bucket-minutes <n>
+        With --continuous, the length of the buckets in minutes. The
+        default is 60.
+
 )usage";
 
     fprintf(stderr, "%s", usage);
@@ -263,6 +824,77 @@ struct CommandLine {
     int video_id;
     bool have_video_id;
 
+    int hash_algorithm;
+
+    std::string thumbnail_directory;
+    int thumbnail_interval;
+
+    std::string gop_stats_path;
+
+    std::string keyframes_path;
+    std::string timecodes_path;
+    std::string gop_json_path;
+    std::string captions_path;
+    std::string afd_path;
+    bool sink_threads;
+
+    std::string verify_path;
+    int verify_samples;
+    bool verify_decode;
+
+    bool analyze_wanted;
+    double analyze_seconds;
+    double analyze_confidence;
+
+    std::string query_path;
+
+    bool live_query_wanted;
+
+    bool edit_wanted;
+    std::vector<D2VFile::FrameRange> edit_ranges;
+
+    bool timestamps_wanted;
+
+    int audio_index_interval;
+
+    int dvd_title;
+    int dvd_angle;
+
+    int resync_errors;
+    bool damage_report_wanted;
+
+    bool split_wanted;
+
+    int compression;
+    std::string decompress_path;
+
+    std::string trace_path;
+    int trace_sampling;
+    int trace_events;
+
+    int progress_fd;
+    double progress_rate;
+
+    std::vector<std::string> watch_directories;
+    int workers;
+    int stable_seconds;
+    std::string control_socket;
+
+    std::string continuous_directory;
+    int bucket_minutes;
+
+    bool pipeline_wanted;
+    int read_ahead;
+
+    int coarse_samples;
+
+    double max_read_rate;
+    double read_latency;
+    bool idle_io_wanted;
+
+    int health_window;
+    HealthMonitor::Limits health_limits;
+
     std::string error;
 
     CommandLine()
@@ -275,6 +907,54 @@ struct CommandLine {
         , audio_ids_all(false)
         , video_id(0)
         , have_video_id(false)
+        , hash_algorithm(Hasher::UNKNOWN_ALGORITHM)
+        , thumbnail_directory{ }
+        , thumbnail_interval(10)
+        , gop_stats_path{ }
+        , keyframes_path{ }
+        , timecodes_path{ }
+        , gop_json_path{ }
+        , captions_path{ }
+        , afd_path{ }
+        , sink_threads(false)
+        , verify_path{ }
+        , verify_samples(100)
+        , verify_decode(false)
+        , analyze_wanted(false)
+        , analyze_seconds(0)
+        , analyze_confidence(0)
+        , query_path{ }
+        , live_query_wanted(false)
+        , edit_wanted(false)
+        , edit_ranges{ }
+        , timestamps_wanted(false)
+        , audio_index_interval(0)
+        , dvd_title(0)
+        , dvd_angle(0)
+        , resync_errors(0)
+        , damage_report_wanted(false)
+        , split_wanted(false)
+        , compression(Compressor::UNKNOWN_COMPRESSION)
+        , decompress_path{ }
+        , trace_path{ }
+        , trace_sampling(1)
+        , trace_events(1000000)
+        , progress_fd(-1)
+        , progress_rate(2)
+        , watch_directories{ }
+        , workers(2)
+        , stable_seconds(30)
+        , control_socket{ }
+        , continuous_directory{ }
+        , bucket_minutes(60)
+        , pipeline_wanted(false)
+        , read_ahead(-1)
+        , coarse_samples(0)
+        , max_read_rate(0)
+        , read_latency(0)
+        , idle_io_wanted(false)
+        , health_window(0)
+        , health_limits{ }
         , error{ }
     { }
 
@@ -292,6 +972,54 @@ struct CommandLine {
         const char *opt_output = "--output";
         const char *opt_audio_ids = "--audio-ids";
         const char *opt_video_id = "--video-id";
+        const char *opt_hash = "--hash";
+        const char *opt_thumbnails = "--thumbnails";
+        const char *opt_thumbnail_interval = "--thumbnail-interval";
+        const char *opt_gop_stats = "--gop-stats";
+        const char *opt_keyframes = "--keyframes";
+        const char *opt_timecodes = "--timecodes";
+        const char *opt_gop_json = "--gop-json";
+        const char *opt_captions = "--captions";
+        const char *opt_afd = "--afd";
+        const char *opt_sink_threads = "--sink-threads";
+        const char *opt_verify = "--verify";
+        const char *opt_verify_samples = "--verify-samples";
+        const char *opt_verify_decode = "--verify-decode";
+        const char *opt_analyze = "--analyze";
+        const char *opt_analyze_seconds = "--analyze-seconds";
+        const char *opt_analyze_confidence = "--analyze-confidence";
+        const char *opt_query = "--query";
+        const char *opt_live_query = "--live-query";
+        const char *opt_edit = "--edit";
+        const char *opt_ranges = "--ranges";
+        const char *opt_timestamps = "--timestamps";
+        const char *opt_audio_index = "--audio-index";
+        const char *opt_title = "--title";
+        const char *opt_angle = "--angle";
+        const char *opt_resync = "--resync";
+        const char *opt_damage_report = "--damage-report";
+        const char *opt_split = "--split";
+        const char *opt_compress = "--compress";
+        const char *opt_decompress = "--decompress";
+        const char *opt_trace = "--trace";
+        const char *opt_trace_sampling = "--trace-sampling";
+        const char *opt_trace_events = "--trace-events";
+        const char *opt_progress_fd = "--progress-fd";
+        const char *opt_progress_rate = "--progress-rate";
+        const char *opt_watch = "--watch";
+        const char *opt_workers = "--workers";
+        const char *opt_stable_seconds = "--stable-seconds";
+        const char *opt_control_socket = "--control-socket";
+        const char *opt_pipeline = "--pipeline";
+        const char *opt_read_ahead = "--read-ahead";
+        const char *opt_coarse_index = "--coarse-index";
+        const char *opt_max_read_rate = "--max-read-rate";
+        const char *opt_read_latency = "--read-latency";
+        const char *opt_idle_io = "--idle-io";
+        const char *opt_health_check = "--health-check";
+        const char *opt_health_limits = "--health-limits";
+        const char *opt_continuous = "--continuous";
+        const char *opt_bucket_minutes = "--bucket-minutes";
 
         std::unordered_set<std::string> valid_options = {
             opt_help,
@@ -300,7 +1028,55 @@ struct CommandLine {
             opt_quiet,
             opt_output,
             opt_audio_ids,
-            opt_video_id
+            opt_video_id,
+            opt_hash,
+            opt_thumbnails,
+            opt_thumbnail_interval,
+            opt_gop_stats,
+            opt_keyframes,
+            opt_timecodes,
+            opt_gop_json,
+            opt_captions,
+            opt_afd,
+            opt_sink_threads,
+            opt_verify,
+            opt_verify_samples,
+            opt_verify_decode,
+            opt_analyze,
+            opt_analyze_seconds,
+            opt_analyze_confidence,
+            opt_query,
+            opt_live_query,
+            opt_edit,
+            opt_ranges,
+            opt_timestamps,
+            opt_audio_index,
+            opt_title,
+            opt_angle,
+            opt_resync,
+            opt_damage_report,
+            opt_split,
+            opt_compress,
+            opt_decompress,
+            opt_trace,
+            opt_trace_sampling,
+            opt_trace_events,
+            opt_progress_fd,
+            opt_progress_rate,
+            opt_watch,
+            opt_workers,
+            opt_stable_seconds,
+            opt_control_socket,
+            opt_pipeline,
+            opt_read_ahead,
+            opt_coarse_index,
+            opt_max_read_rate,
+            opt_read_latency,
+            opt_idle_io,
+            opt_health_check,
+            opt_health_limits,
+            opt_continuous,
+            opt_bucket_minutes
         };
 
         for (int i = 1; i < argc; i++) {
@@ -394,302 +1170,2048 @@ struct CommandLine {
                     error = "Video id '" + id + "' is not a valid hexadecimal number.";
                     return false;
                 }
-            } else { // Input files.
-                std::string err;
-                makeAbsolute(arg, err);
-                if (err.size()) {
-                    error = "Failed to turn '" + arg + "' into an absolute path: " + err;
+            } else if (arg == opt_hash) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_hash;
+                    error += " requires the name of a hash algorithm.";
                     return false;
                 }
 
-                fake_file.push_back(arg);
-            }
-        }
+                std::string algorithm(argv[i + 1]);
+                i++;
 
-        if (!fake_file.size()) {
-            error = "No files given. Try '--help'.";
-            return false;
-        }
+                hash_algorithm = Hasher::getAlgorithm(algorithm);
+                if (hash_algorithm == Hasher::UNKNOWN_ALGORITHM) {
+                    error = "Unknown hash algorithm '" + algorithm + "'. Supported algorithms are 'xxh64' and 'sha256'.";
+                    return false;
+                }
+            } else if (arg == opt_thumbnails) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_thumbnails;
+                    error += " requires a directory name.";
+                    return false;
+                }
 
-        return true;
-    }
-};
+                thumbnail_directory = argv[i + 1];
+                i++;
+            } else if (arg == opt_thumbnail_interval) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_thumbnail_interval;
+                    error += " requires a number.";
+                    return false;
+                }
 
+                std::string interval(argv[i + 1]);
+                i++;
 
-#ifdef _WIN32
-BOOL WINAPI HandlerRoutine(DWORD dwCtrlType) {
-    switch (dwCtrlType) {
-    case CTRL_C_EVENT:
-    case CTRL_BREAK_EVENT:
-    case CTRL_CLOSE_EVENT:
-        _exit(1);
-    default:
-        return FALSE;
-    }
-}
+                size_t converted_chars;
+                try {
+                    thumbnail_interval = std::stoi(interval, &converted_chars);
+                } catch (...) {
+                    error = "Invalid thumbnail interval '" + interval + "'.";
+                    return false;
+                }
 
+                if (interval.size() != converted_chars || thumbnail_interval < 1) {
+                    error = "Thumbnail interval '" + interval + "' is not a positive number.";
+                    return false;
+                }
+            } else if (arg == opt_gop_stats) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_gop_stats;
+                    error += " requires a file name.";
+                    return false;
+                }
 
-int wmain(int argc, wchar_t **argvw) {
-    if (_setmode(_fileno(stdout), _O_BINARY) == -1)
-        fprintf(stderr, "Failed to set stdout to binary mode.\n");
+                gop_stats_path = argv[i + 1];
+                i++;
+            } else if (arg == opt_keyframes) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_keyframes;
+                    error += " requires a file name.";
+                    return false;
+                }
 
-    SetConsoleCtrlHandler(HandlerRoutine, TRUE);
+                keyframes_path = argv[i + 1];
+                i++;
+            } else if (arg == opt_timecodes) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_timecodes;
+                    error += " requires a file name.";
+                    return false;
+                }
 
-    UTF16 utf16;
+                timecodes_path = argv[i + 1];
+                i++;
+            } else if (arg == opt_gop_json) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_gop_json;
+                    error += " requires a file name.";
+                    return false;
+                }
 
-    std::vector<std::string> argv;
+                gop_json_path = argv[i + 1];
+                i++;
+            } else if (arg == opt_captions) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_captions;
+                    error += " requires a file name.";
+                    return false;
+                }
 
-    for (int i = 0; i < argc; i++)
-        argv.push_back(utf16.to_bytes(argvw[i]));
-#else
-int main(int argc, char **argv) {
-#endif
+                captions_path = argv[i + 1];
+                i++;
+            } else if (arg == opt_afd) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_afd;
+                    error += " requires a file name.";
+                    return false;
+                }
 
-    // ffmpeg init part 0
-    av_log_set_level(AV_LOG_PANIC);
-    av_register_all();
-    avcodec_register_all();
+                afd_path = argv[i + 1];
+                i++;
+            } else if (arg == opt_sink_threads) {
+                sink_threads = true;
+            } else if (arg == opt_verify) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_verify;
+                    error += " requires a d2v file name.";
+                    return false;
+                }
 
+                verify_path = argv[i + 1];
+                i++;
+            } else if (arg == opt_verify_samples) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_verify_samples;
+                    error += " requires a number.";
+                    return false;
+                }
 
-    // command line parsing
-    FakeFile fake_file;
+                std::string number(argv[i + 1]);
+                i++;
 
-    CommandLine cmd;
-    if (!cmd.parse(argc, argv, fake_file)) {
-        fprintf(stderr, "%s\n", cmd.getError().c_str());
-        return 1;
-    }
+                size_t converted_chars;
+                try {
+                    verify_samples = std::stoi(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid number of samples '" + number + "'.";
+                    return false;
+                }
 
-    if (cmd.help_wanted) {
-        printHelp();
-        return 0;
-    }
+                if (number.size() != converted_chars || verify_samples < 0) {
+                    error = "Number of samples '" + number + "' is not a valid number.";
+                    return false;
+                }
+            } else if (arg == opt_verify_decode) {
+                verify_decode = true;
+            } else if (arg == opt_analyze) {
+                analyze_wanted = true;
+            } else if (arg == opt_analyze_seconds) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_analyze_seconds;
+                    error += " requires a number.";
+                    return false;
+                }
 
-    if (cmd.version_wanted) {
-        printVersions();
-        return 0;
-    }
+                std::string number(argv[i + 1]);
+                i++;
 
+                size_t converted_chars;
+                try {
+                    analyze_seconds = std::stod(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid number of seconds '" + number + "'.";
+                    return false;
+                }
 
-    // input opening
-    if (!fake_file.open()) {
-        fprintf(stderr, "%s\n", fake_file.getError().c_str());
+                if (number.size() != converted_chars || analyze_seconds <= 0) {
+                    error = "Number of seconds '" + number + "' is not a positive number.";
+                    return false;
+                }
+            } else if (arg == opt_analyze_confidence) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_analyze_confidence;
+                    error += " requires a number.";
+                    return false;
+                }
 
-        fake_file.close();
+                std::string number(argv[i + 1]);
+                i++;
 
-        return 1;
-    }
+                size_t converted_chars;
+                try {
+                    analyze_confidence = std::stod(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid confidence '" + number + "'.";
+                    return false;
+                }
 
+                if (number.size() != converted_chars || analyze_confidence <= 0 || analyze_confidence > 1) {
+                    error = "Confidence '" + number + "' is not a number between 0 and 1.";
+                    return false;
+                }
+            } else if (arg == opt_query) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_query;
+                    error += " requires a d2v file name.";
+                    return false;
+                }
 
-    FFMPEG f;
+                query_path = argv[i + 1];
+                i++;
+            } else if (arg == opt_live_query) {
+                live_query_wanted = true;
+            } else if (arg == opt_edit) {
+                edit_wanted = true;
+            } else if (arg == opt_ranges) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_ranges;
+                    error += " requires a list of frame ranges.";
+                    return false;
+                }
 
-    // ffmpeg init part 1
-    if (!f.initFormat(fake_file)) {
-        fprintf(stderr, "%s\n", f.getError().c_str());
+                std::string ranges(argv[i + 1]);
+                i++;
 
-        f.cleanup();
-        fake_file.close();
+                size_t range_start = 0, range_end;
+
+                do {
+                    range_end = ranges.find(',', range_start);
+                    std::string range;
+                    if (range_end == std::string::npos)
+                        range = ranges.substr(range_start);
+                    else
+                        range = ranges.substr(range_start, range_end - range_start);
+
+                    size_t dash = range.find('-');
+                    std::string first = range.substr(0, dash);
+                    std::string last = dash == std::string::npos ? first : range.substr(dash + 1);
+
+                    size_t converted_first = 0, converted_last = 0;
+                    D2VFile::FrameRange frames;
+                    try {
+                        frames.first = std::stoll(first, &converted_first);
+                        frames.second = std::stoll(last, &converted_last);
+                    } catch (...) {
+                    }
+
+                    if (!first.size() || !last.size() || first.size() != converted_first || last.size() != converted_last || frames.first < 0 || frames.first > frames.second) {
+                        error = "Invalid frame range '" + range + "'.";
+                        return false;
+                    }
+
+                    edit_ranges.push_back(frames);
+
+                    range_start = range_end + 1;
+                } while (range_end != std::string::npos);
+            } else if (arg == opt_timestamps) {
+                timestamps_wanted = true;
+            } else if (arg == opt_resync) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_resync;
+                    error += " requires a number.";
+                    return false;
+                }
 
-        return 1;
-    }
+                std::string number(argv[i + 1]);
+                i++;
 
+                size_t converted_chars;
+                try {
+                    resync_errors = std::stoi(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid number of pictures '" + number + "'.";
+                    return false;
+                }
 
-    // info printing
+                if (number.size() != converted_chars || resync_errors < 1) {
+                    error = "Number of pictures '" + number + "' is not a positive number.";
+                    return false;
+                }
+            } else if (arg == opt_title) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_title;
+                    error += " requires a number.";
+                    return false;
+                }
+
+                std::string number(argv[i + 1]);
+                i++;
+
+                size_t converted_chars;
+                try {
+                    dvd_title = std::stoi(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid title number '" + number + "'.";
+                    return false;
+                }
+
+                if (number.size() != converted_chars || dvd_title < 1) {
+                    error = "Title number '" + number + "' is not a positive number.";
+                    return false;
+                }
+            } else if (arg == opt_angle) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_angle;
+                    error += " requires a number.";
+                    return false;
+                }
+
+                std::string number(argv[i + 1]);
+                i++;
+
+                size_t converted_chars;
+                try {
+                    dvd_angle = std::stoi(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid angle number '" + number + "'.";
+                    return false;
+                }
+
+                if (number.size() != converted_chars || dvd_angle < 1) {
+                    error = "Angle number '" + number + "' is not a positive number.";
+                    return false;
+                }
+            } else if (arg == opt_damage_report) {
+                damage_report_wanted = true;
+            } else if (arg == opt_audio_index) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_audio_index;
+                    error += " requires a number.";
+                    return false;
+                }
+
+                std::string number(argv[i + 1]);
+                i++;
+
+                size_t converted_chars;
+                try {
+                    audio_index_interval = std::stoi(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid audio index interval '" + number + "'.";
+                    return false;
+                }
+
+                if (number.size() != converted_chars || audio_index_interval < 1) {
+                    error = "Audio index interval '" + number + "' is not a positive number.";
+                    return false;
+                }
+            } else if (arg == opt_split) {
+                split_wanted = true;
+            } else if (arg == opt_compress) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_compress;
+                    error += " requires the name of a compression algorithm.";
+                    return false;
+                }
+
+                std::string algorithm(argv[i + 1]);
+                i++;
+
+                compression = Compressor::getCompression(algorithm);
+                if (compression == Compressor::UNKNOWN_COMPRESSION) {
+                    error = "Unknown compression algorithm '" + algorithm + "'. Supported algorithms are 'gzip' and 'none'.";
+                    return false;
+                }
+            } else if (arg == opt_decompress) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_decompress;
+                    error += " requires a d2v file name.";
+                    return false;
+                }
+
+                decompress_path = argv[i + 1];
+                i++;
+            } else if (arg == opt_trace) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_trace;
+                    error += " requires a file name.";
+                    return false;
+                }
+
+                trace_path = argv[i + 1];
+                i++;
+            } else if (arg == opt_trace_sampling) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_trace_sampling;
+                    error += " requires a number.";
+                    return false;
+                }
+
+                std::string number(argv[i + 1]);
+                i++;
+
+                size_t converted_chars;
+                try {
+                    trace_sampling = std::stoi(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid sampling rate '" + number + "'.";
+                    return false;
+                }
+
+                if (number.size() != converted_chars || trace_sampling < 1) {
+                    error = "Sampling rate '" + number + "' is not a positive number.";
+                    return false;
+                }
+            } else if (arg == opt_trace_events) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_trace_events;
+                    error += " requires a number.";
+                    return false;
+                }
+
+                std::string number(argv[i + 1]);
+                i++;
+
+                size_t converted_chars;
+                try {
+                    trace_events = std::stoi(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid number of events '" + number + "'.";
+                    return false;
+                }
+
+                if (number.size() != converted_chars || trace_events < 1) {
+                    error = "Number of events '" + number + "' is not a positive number.";
+                    return false;
+                }
+            } else if (arg == opt_progress_fd) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_progress_fd;
+                    error += " requires a number.";
+                    return false;
+                }
+
+                std::string number(argv[i + 1]);
+                i++;
+
+                size_t converted_chars;
+                try {
+                    progress_fd = std::stoi(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid file descriptor '" + number + "'.";
+                    return false;
+                }
+
+                if (number.size() != converted_chars || progress_fd < 0) {
+                    error = "File descriptor '" + number + "' is not a valid number.";
+                    return false;
+                }
+            } else if (arg == opt_progress_rate) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_progress_rate;
+                    error += " requires a number.";
+                    return false;
+                }
+
+                std::string number(argv[i + 1]);
+                i++;
+
+                size_t converted_chars;
+                try {
+                    progress_rate = std::stod(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid progress rate '" + number + "'.";
+                    return false;
+                }
+
+                if (number.size() != converted_chars || progress_rate <= 0) {
+                    error = "Progress rate '" + number + "' is not a positive number.";
+                    return false;
+                }
+            } else if (arg == opt_watch) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_watch;
+                    error += " requires a directory name.";
+                    return false;
+                }
+
+                std::string directory(argv[i + 1]);
+                i++;
+
+                std::string err;
+                makeAbsolute(directory, err);
+                if (err.size()) {
+                    error = "Failed to turn '" + directory + "' into an absolute path: " + err;
+                    return false;
+                }
+
+                watch_directories.push_back(directory);
+            } else if (arg == opt_workers) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_workers;
+                    error += " requires a number.";
+                    return false;
+                }
+
+                std::string number(argv[i + 1]);
+                i++;
+
+                size_t converted_chars;
+                try {
+                    workers = std::stoi(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid number of workers '" + number + "'.";
+                    return false;
+                }
+
+                if (number.size() != converted_chars || workers < 1) {
+                    error = "Number of workers '" + number + "' is not a positive number.";
+                    return false;
+                }
+            } else if (arg == opt_stable_seconds) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_stable_seconds;
+                    error += " requires a number.";
+                    return false;
+                }
+
+                std::string number(argv[i + 1]);
+                i++;
+
+                size_t converted_chars;
+                try {
+                    stable_seconds = std::stoi(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid number of seconds '" + number + "'.";
+                    return false;
+                }
+
+                if (number.size() != converted_chars || stable_seconds < 0) {
+                    error = "Number of seconds '" + number + "' is not a valid number.";
+                    return false;
+                }
+            } else if (arg == opt_control_socket) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_control_socket;
+                    error += " requires a path.";
+                    return false;
+                }
+
+                control_socket = argv[i + 1];
+                i++;
+            } else if (arg == opt_pipeline) {
+                pipeline_wanted = true;
+            } else if (arg == opt_read_ahead) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_read_ahead;
+                    error += " requires a number.";
+                    return false;
+                }
+
+                std::string number(argv[i + 1]);
+                i++;
+
+                size_t converted_chars;
+                try {
+                    read_ahead = std::stoi(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid read-ahead size '" + number + "'.";
+                    return false;
+                }
+
+                if (number.size() != converted_chars || read_ahead < 0) {
+                    error = "Read-ahead size '" + number + "' is not a valid number.";
+                    return false;
+                }
+            } else if (arg == opt_coarse_index) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_coarse_index;
+                    error += " requires a number.";
+                    return false;
+                }
+
+                std::string number(argv[i + 1]);
+                i++;
+
+                size_t converted_chars;
+                try {
+                    coarse_samples = std::stoi(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid number of samples '" + number + "'.";
+                    return false;
+                }
+
+                if (number.size() != converted_chars || coarse_samples < 1) {
+                    error = "Number of samples '" + number + "' is not a positive number.";
+                    return false;
+                }
+            } else if (arg == opt_max_read_rate) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_max_read_rate;
+                    error += " requires a number.";
+                    return false;
+                }
+
+                std::string number(argv[i + 1]);
+                i++;
+
+                size_t converted_chars;
+                try {
+                    max_read_rate = std::stod(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid read rate '" + number + "'.";
+                    return false;
+                }
+
+                if (number.size() != converted_chars || max_read_rate <= 0) {
+                    error = "Read rate '" + number + "' is not a positive number.";
+                    return false;
+                }
+            } else if (arg == opt_read_latency) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_read_latency;
+                    error += " requires a number.";
+                    return false;
+                }
+
+                std::string number(argv[i + 1]);
+                i++;
+
+                size_t converted_chars;
+                try {
+                    read_latency = std::stod(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid latency '" + number + "'.";
+                    return false;
+                }
+
+                if (number.size() != converted_chars || read_latency <= 0) {
+                    error = "Latency '" + number + "' is not a positive number.";
+                    return false;
+                }
+            } else if (arg == opt_idle_io) {
+                idle_io_wanted = true;
+            } else if (arg == opt_health_check) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_health_check;
+                    error += " requires a number.";
+                    return false;
+                }
+
+                std::string number(argv[i + 1]);
+                i++;
+
+                size_t converted_chars;
+                try {
+                    health_window = std::stoi(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid window size '" + number + "'.";
+                    return false;
+                }
+
+                if (number.size() != converted_chars || health_window < 1) {
+                    error = "Window size '" + number + "' is not a positive number.";
+                    return false;
+                }
+            } else if (arg == opt_health_limits) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_health_limits;
+                    error += " requires a list of limits.";
+                    return false;
+                }
+
+                std::string limits(argv[i + 1]);
+                i++;
+
+                size_t limit_start = 0, limit_end;
+
+                do {
+                    limit_end = limits.find(',', limit_start);
+                    std::string limit;
+                    if (limit_end == std::string::npos)
+                        limit = limits.substr(limit_start);
+                    else
+                        limit = limits.substr(limit_start, limit_end - limit_start);
+
+                    size_t equals = limit.find('=');
+                    std::string name = limit.substr(0, equals);
+                    std::string number = equals == std::string::npos ? "" : limit.substr(equals + 1);
+
+                    size_t converted_chars = 0;
+                    double value = 0;
+                    try {
+                        value = std::stod(number, &converted_chars);
+                    } catch (...) {
+                    }
+
+                    if (!number.size() || number.size() != converted_chars || value < 0) {
+                        error = "Invalid limit '" + limit + "'.";
+                        return false;
+                    }
+
+                    if (name == "scrambled") {
+                        health_limits.scrambled = value;
+                    } else if (name == "cc") {
+                        health_limits.cc_errors = value;
+                    } else if (name == "resyncs") {
+                        health_limits.resyncs = value;
+                    } else if (name == "pictures") {
+                        health_limits.pictures = (int)value;
+                    } else {
+                        error = "Unknown limit '" + name + "'. The known limits are scrambled, cc, resyncs, and pictures.";
+                        return false;
+                    }
+
+                    limit_start = limit_end + 1;
+                } while (limit_end != std::string::npos);
+            } else if (arg == opt_continuous) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_continuous;
+                    error += " requires a directory name.";
+                    return false;
+                }
+
+                continuous_directory = argv[i + 1];
+                i++;
+
+                std::string err;
+                makeAbsolute(continuous_directory, err);
+                if (err.size()) {
+                    error = "Failed to turn '" + continuous_directory + "' into an absolute path: " + err;
+                    return false;
+                }
+            } else if (arg == opt_bucket_minutes) {
+                if (i == argc - 1 || valid_options.count(argv[i + 1])) {
+                    error = opt_bucket_minutes;
+                    error += " requires a number.";
+                    return false;
+                }
+
+                std::string number(argv[i + 1]);
+                i++;
+
+                size_t converted_chars;
+                try {
+                    bucket_minutes = std::stoi(number, &converted_chars);
+                } catch (...) {
+                    error = "Invalid number of minutes '" + number + "'.";
+                    return false;
+                }
+
+                if (number.size() != converted_chars || bucket_minutes < 1) {
+                    error = "Number of minutes '" + number + "' is not a positive number.";
+                    return false;
+                }
+            } else { // Input files.
+                std::string err;
+                makeAbsolute(arg, err);
+                if (err.size()) {
+                    error = "Failed to turn '" + arg + "' into an absolute path: " + err;
+                    return false;
+                }
+
+                fake_file.push_back(arg);
+            }
+        }
+
+        if (!fake_file.size() && !verify_path.size() && !query_path.size() && !decompress_path.size() && !watch_directories.size() && !continuous_directory.size()) {
+            error = "No files given. Try '--help'.";
+            return false;
+        }
+
+        bool dvd_input = fake_file.size() && DVDTitle::isIFOFile(fake_file[0].name);
+        for (size_t i = 1; i < fake_file.size(); i++) {
+            if (dvd_input || DVDTitle::isIFOFile(fake_file[i].name)) {
+                error = "An IFO file must be the only input file.";
+                return false;
+            }
+        }
+
+        if ((dvd_title || dvd_angle) && !dvd_input) {
+            error = "--title and --angle require an IFO file as input.";
+            return false;
+        }
+
+        if (dvd_input) {
+            if (!dvd_title)
+                dvd_title = 1;
+            if (!dvd_angle)
+                dvd_angle = 1;
+
+            if (hash_algorithm != Hasher::UNKNOWN_ALGORITHM) {
+                error = "--hash can't be used with DVD titles, because only parts of the VOB files are read.";
+                return false;
+            }
+        }
+
+        if (live_query_wanted && dvd_title) {
+            error = "--live-query can't be used with DVD titles.";
+            return false;
+        }
+
+        if (live_query_wanted && (watch_directories.size() || continuous_directory.size())) {
+            error = "--live-query can't be used with --watch or --continuous.";
+            return false;
+        }
+
+        if (resync_errors && pipeline_wanted) {
+            error = "--resync can't be used with --pipeline.";
+            return false;
+        }
+
+        if (split_wanted && d2v_path == "-") {
+            error = "--split can't be used when the D2V file is standard output.";
+            return false;
+        }
+
+        if (watch_directories.size()) {
+            if (fake_file.size()) {
+                error = "Input files can't be given together with --watch.";
+                return false;
+            }
+
+            if (d2v_path.size() || gop_stats_path.size() || keyframes_path.size() || timecodes_path.size() || gop_json_path.size() ||
+                captions_path.size() || afd_path.size() || thumbnail_directory.size() || trace_path.size() || info_wanted || analyze_wanted) {
+                error = "--output, --gop-stats, --keyframes, --timecodes, --gop-json, --captions, --afd, --thumbnails, --trace, --info, and --analyze can't be used with --watch.";
+                return false;
+            }
+        }
+
+        if (continuous_directory.size()) {
+            if (fake_file.size() || watch_directories.size()) {
+                error = "Input files and --watch can't be given together with --continuous.";
+                return false;
+            }
+
+            if (d2v_path == "-" || split_wanted || gop_stats_path.size() || keyframes_path.size() || timecodes_path.size() || gop_json_path.size() ||
+                captions_path.size() || afd_path.size() || thumbnail_directory.size() || trace_path.size() || info_wanted || analyze_wanted) {
+                error = "--output -, --split, --gop-stats, --keyframes, --timecodes, --gop-json, --captions, --afd, --thumbnails, --trace, --info, and --analyze can't be used with --continuous.";
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
+
+
+// Output files, optionally written under temporary names and renamed
+// once everything went well, so no one can see them half written.
+class OutputFiles {
+    struct Output {
+        FILE *file;
+        std::string path;
+        std::string temporary_path;
+    };
+
+    bool atomic;
+    std::vector<Output> outputs;
+
+public:
+    OutputFiles(bool _atomic)
+        : atomic(_atomic)
+        , outputs{ }
+    { }
+
+    ~OutputFiles() {
+        abort();
+    }
+
+    FILE *open(const std::string &path, const char *description, std::string &error) {
+        std::string temporary_path = path;
+        if (atomic)
+            temporary_path += ".part";
+
+        FILE *file = openFile(temporary_path.c_str(), "wb");
+        if (!file) {
+            error = "Failed to open ";
+            error += description;
+            error += " '" + temporary_path + "' for writing: " + strerror(errno);
+            return nullptr;
+        }
+
+        outputs.push_back({ file, path, temporary_path });
+
+        return file;
+    }
+
+    bool commit(std::string &error) {
+        bool okay = true;
+
+        for (auto it = outputs.begin(); it != outputs.end(); it++) {
+            if (fclose(it->file) && okay) {
+                error = "Failed to close '" + it->temporary_path + "': " + strerror(errno);
+                okay = false;
+            }
+
+            it->file = nullptr;
+        }
+
+        for (auto it = outputs.begin(); it != outputs.end() && okay; it++) {
+            if (atomic && rename(it->temporary_path.c_str(), it->path.c_str())) {
+                error = "Failed to rename '" + it->temporary_path + "' to '" + it->path + "': " + strerror(errno);
+                okay = false;
+            }
+        }
+
+        if (!okay) {
+            abort();
+            return false;
+        }
+
+        outputs.clear();
+
+        return true;
+    }
+
+    void abort() {
+        for (auto it = outputs.begin(); it != outputs.end(); it++) {
+            if (it->file)
+                fclose(it->file);
+
+            if (atomic)
+                remove(it->temporary_path.c_str());
+        }
+
+        outputs.clear();
+    }
+};
+
+
+// Opens the D2V files for the segments after the first one and keeps
+// the list of segments for the manifest.
+class SegmentWriter : public D2V::SegmentHandler {
+    struct Entry {
+        int number;
+        D2V::Segment segment;
+        std::string path;
+    };
+
+    OutputFiles &outputs;
+    std::string d2v_path;
+    int compression;
+    std::vector<std::unique_ptr<Compressor>> compressors;
+    std::vector<Entry> entries;
+
+    std::string getSegmentPath(int number) const {
+        if (number == 0)
+            return d2v_path;
+
+        std::string base = d2v_path;
+        std::string extension = ".d2v";
+
+        if (base.size() > 3 && base.compare(base.size() - 3, 3, ".gz") == 0) {
+            base.resize(base.size() - 3);
+            extension += ".gz";
+        }
+
+        if (base.size() > 4 && base.compare(base.size() - 4, 4, ".d2v") == 0)
+            base.resize(base.size() - 4);
+
+        return base + "." + std::to_string(number) + extension;
+    }
+
+public:
+    SegmentWriter(OutputFiles &_outputs, const std::string &_d2v_path, int _compression)
+        : outputs(_outputs)
+        , d2v_path(_d2v_path)
+        , compression(_compression)
+        , compressors{ }
+        , entries{ }
+    { }
+
+    FILE *startSegment(int number, const D2V::Segment &segment, std::string &err) override {
+        (void)segment;
+
+        FILE *file = outputs.open(getSegmentPath(number), "d2v file", err);
+        if (!file)
+            return nullptr;
+
+        if (compression != Compressor::GZIP_COMPRESSION)
+            return file;
+
+        compressors.emplace_back(new Compressor(file, Z_DEFAULT_COMPRESSION));
+        if (!compressors.back()->start()) {
+            err = compressors.back()->getError();
+            return nullptr;
+        }
+
+        return compressors.back()->getInput();
+    }
+
+    bool finishSegment(int number, const D2V::Segment &segment, std::string &err) override {
+        entries.push_back({ number, segment, getSegmentPath(number) });
+
+        // The first segment's compressor belongs to the caller.
+        if (number > 0 && compression == Compressor::GZIP_COMPRESSION && compressors.size()) {
+            if (!compressors.back()->finish()) {
+                err = compressors.back()->getError();
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool writeManifest(FILE *file, std::string &err) const {
+        if (fprintf(file, "# index first_picture pictures width height aspect_ratio frame_rate file position path\n") < 0) {
+            err = "Failed to write the segment list: fprintf() failed.";
+            return false;
+        }
+
+        for (auto it = entries.cbegin(); it != entries.cend(); it++) {
+            const D2V::Segment &s = it->segment;
+
+            if (fprintf(file, "%d %" PRId64 " %" PRId64 " %d %d %d:%d %d/%d %d %" PRId64 " %s\n",
+                        it->number,
+                        s.first_picture,
+                        s.pictures,
+                        s.width,
+                        s.height,
+                        s.display_aspect_ratio.num,
+                        s.display_aspect_ratio.den,
+                        s.frame_rate.num,
+                        s.frame_rate.den,
+                        s.file,
+                        s.position,
+                        it->path.c_str()) < 0) {
+                err = "Failed to write the segment list: fprintf() failed.";
+                return false;
+            }
+        }
+
+        return true;
+    }
+};
+
+
+// Does everything that needs the input files: printing information,
+// analyzing, or indexing.
+// throttle can be null.
+bool processFiles(CommandLine cmd, FakeFile &fake_file, Progress *progress, Throttle *throttle, bool atomic_outputs, std::string &error) {
+    // input opening
+    fake_file.setThrottle(throttle);
+
+    if (!fake_file.open()) {
+        error = fake_file.getError();
+
+        fake_file.close();
+
+        return false;
+    }
+
+
+    // hashing, which must see the probing done by ffmpeg
+    std::unique_ptr<Hasher> hasher;
+    if (cmd.hash_algorithm != Hasher::UNKNOWN_ALGORITHM && !cmd.info_wanted && !cmd.analyze_wanted) {
+        std::vector<Hasher::Digest> digests;
+        std::vector<int64_t> file_sizes;
+
+        for (auto it = fake_file.cbegin(); it != fake_file.cend(); it++) {
+            digests.push_back({ it->name, "" });
+            file_sizes.push_back(it->size);
+        }
+
+        hasher.reset(new Hasher(cmd.hash_algorithm, digests, file_sizes));
+        fake_file.setHasher(hasher.get());
+    }
+
+
+    // tracing, which should also see the probing
+    std::unique_ptr<Trace> trace;
+    if (cmd.trace_path.size() && !cmd.info_wanted && !cmd.analyze_wanted) {
+        trace.reset(new Trace(cmd.trace_events, cmd.trace_sampling));
+        fake_file.setTrace(trace.get());
+    }
+
+
+    // health checks, which should also see the probing
+    std::unique_ptr<HealthMonitor> health_monitor;
+    if (cmd.health_window > 0 && !cmd.info_wanted && !cmd.analyze_wanted) {
+        health_monitor.reset(new HealthMonitor((int64_t)cmd.health_window * 1024 * 1024, cmd.health_limits));
+        fake_file.setHealthMonitor(health_monitor.get());
+    }
+
+
+    FFMPEG f;
+
+    // ffmpeg init part 1
+    bool format_okay;
+    {
+        TraceScope scope(trace.get(), "demux", "FFMPEG::initFormat");
+        format_okay = f.initFormat(fake_file);
+    }
+
+    if (!format_okay) {
+        if (health_monitor && !health_monitor->isHealthy())
+            error = health_monitor->getError();
+        else
+            error = f.getError();
+
+        f.cleanup();
+        fake_file.close();
+
+        return false;
+    }
+
+
+    // info printing
     if (cmd.info_wanted) {
         printInfo(f.fctx, fake_file);
 
-        f.cleanup();
-        fake_file.close();
+        f.cleanup();
+        fake_file.close();
+
+        return true;
+    }
+
+
+    // container format check
+    if (getStreamType(f.fctx->iformat->name) == D2V::UNSUPPORTED_STREAM) {
+        error = "Unsupported container type '";
+        error += f.fctx->iformat->long_name ? f.fctx->iformat->long_name : f.fctx->iformat->name;
+        error += "'.";
+
+        f.cleanup();
+        fake_file.close();
+
+        return false;
+    }
+
+
+    // stream selection
+    deselectAllStreams(f.fctx);
+
+    AVStream *video_stream;
+    if (cmd.have_video_id) {
+        video_stream = selectVideoStreamById(f.fctx, cmd.video_id);
+        if (!video_stream) {
+            char id[20] = { 0 };
+            snprintf(id, 19, "%x", cmd.video_id);
+            error = "Couldn't find video track with id ";
+            error += id;
+            error += ".";
+
+            f.cleanup();
+            fake_file.close();
+
+            return false;
+        }
+    } else {
+        video_stream = selectFirstVideoStream(f.fctx);
+        if (!video_stream) {
+            error = "Couldn't find any video tracks.";
+
+            f.cleanup();
+            fake_file.close();
+
+            return false;
+        }
+    }
+
+    if (cmd.audio_ids.size()) {
+        if (!selectAudioStreamsById(f.fctx, cmd.audio_ids)) {
+            for (size_t i = 0; i < cmd.audio_ids.size(); i++) {
+                char id[20] = { 0 };
+                snprintf(id, 19, "%x", cmd.audio_ids[i]);
+                if (i)
+                    error += "\n";
+                error += "Couldn't find audio track with id ";
+                error += id;
+                error += ".";
+            }
+
+            f.cleanup();
+            fake_file.close();
+
+            return false;
+        }
+    } else if (cmd.audio_ids_all) {
+        if (!selectAllAudioStreams(f.fctx)) {
+            error = "Couldn't find any audio tracks.";
+
+            f.cleanup();
+            fake_file.close();
+
+            return false;
+        }
+    }
+
+
+    // video format check
+    std::unordered_set<int> supported_codec_ids = {
+        AV_CODEC_ID_MPEG1VIDEO,
+        AV_CODEC_ID_MPEG2VIDEO
+    };
+
+    if (!supported_codec_ids.count(video_stream->codec->codec_id)) {
+        const char *type = "unknown";
+        const AVCodecDescriptor *desc = av_codec_get_codec_descriptor(video_stream->codec);
+        if (desc)
+            type = desc->long_name ? desc->long_name : desc->name;
+
+        error = "Unsupported video codec: ";
+        error += type;
+        error += " (id: " + std::to_string(video_stream->codec->codec_id) + ")";
+
+        f.cleanup();
+        fake_file.close();
+
+        return false;
+    }
+
+
+    // analysis only
+    if (cmd.analyze_wanted) {
+        for (unsigned i = 0; i < f.fctx->nb_streams; i++)
+            if (f.fctx->streams[i] != video_stream)
+                f.fctx->streams[i]->discard = AVDISCARD_ALL;
+
+        Analyzer analyzer(&f, video_stream, cmd.analyze_seconds, cmd.analyze_confidence, cmd.stay_quiet ? nullptr : printWarnings);
+
+        if (!analyzer.engage()) {
+            error = analyzer.getError();
+
+            f.cleanup();
+            fake_file.close();
+
+            return false;
+        }
+
+        fprintf(stderr, "%s", analyzer.getReport().c_str());
+
+        f.cleanup();
+        fake_file.close();
+
+        return true;
+    }
+
+
+    OutputFiles outputs(atomic_outputs);
+
+    // d2v file opening
+    FILE *d2v_file;
+    if (cmd.d2v_path == "-") {
+        d2v_file = stdout;
+    } else {
+        if (!cmd.d2v_path.size()) {
+            cmd.d2v_path = fake_file[0].name + ".d2v";
+            if (cmd.compression == Compressor::GZIP_COMPRESSION)
+                cmd.d2v_path += ".gz";
+        }
+
+        d2v_file = outputs.open(cmd.d2v_path, "d2v file", error);
+        if (!d2v_file) {
+            f.cleanup();
+            fake_file.close();
+
+            return false;
+        }
+    }
+
+
+    // d2v compression
+    int compression = cmd.compression;
+    if (compression == Compressor::UNKNOWN_COMPRESSION)
+        compression = Compressor::getCompressionForPath(cmd.d2v_path);
+
+    std::unique_ptr<Compressor> compressor;
+    FILE *d2v_text_file = d2v_file;
+    if (compression == Compressor::GZIP_COMPRESSION) {
+        compressor.reset(new Compressor(d2v_file, Z_DEFAULT_COMPRESSION));
+        if (!compressor->start()) {
+            error = compressor->getError();
+
+            f.cleanup();
+            fake_file.close();
+
+            return false;
+        }
+
+        d2v_text_file = compressor->getInput();
+    }
+
+
+    // audio files opening
+    std::unordered_map<int, FILE *> audio_files;
+
+    std::unique_ptr<AudioIndex> audio_index;
+    if (cmd.audio_index_interval > 0)
+        audio_index.reset(new AudioIndex(cmd.audio_index_interval));
+
+    for (unsigned i = 0; i < f.fctx->nb_streams; i++) {
+        if (f.fctx->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO &&
+            f.fctx->streams[i]->discard != AVDISCARD_ALL) {
+            std::string path = cmd.d2v_path;
+
+            char id[20] = { 0 };
+            snprintf(id, 19, "%x", f.fctx->streams[i]->id);
+
+            path += " T";
+            path += id;
+
+            int64_t bit_rate, channel_layout;
+
+            if (av_opt_get_int(f.fctx->streams[i]->codec, "channel_layout", 0, &channel_layout) >= 0) {
+                char channels[512] = { 0 };
+                av_get_channel_layout_string(channels, 512, 0, channel_layout);
+                path += " ";
+                path += channels;
+            }
+
+            if (av_opt_get_int(f.fctx->streams[i]->codec, "ab", 0, &bit_rate) >= 0)
+                path += " " + std::to_string(bit_rate / 1000) + " kbps";
+
+            path += ".audio";
+
+            FILE *file = outputs.open(path, "audio file", error);
+            if (!file) {
+                f.cleanup();
+                fake_file.close();
+
+                return false;
+            }
+
+            audio_files.insert({ f.fctx->streams[i]->index, file });
+
+            if (audio_index) {
+                FILE *index_file = outputs.open(path + ".idx", "audio index", error);
+                if (!index_file || !audio_index->addTrack(f.fctx->streams[i]->index, index_file, f.fctx->streams[i])) {
+                    if (index_file)
+                        error = audio_index->getError();
+
+                    f.cleanup();
+                    fake_file.close();
+
+                    return false;
+                }
+            }
+        }
+    }
+
+
+    // GOP statistics file opening
+    FILE *gop_stats_file = nullptr;
+    if (cmd.gop_stats_path.size()) {
+        gop_stats_file = outputs.open(cmd.gop_stats_path, "GOP statistics file", error);
+        if (!gop_stats_file) {
+            f.cleanup();
+            fake_file.close();
+
+            return false;
+        }
+    }
+
+
+    // extra output files opening
+    FILE *keyframes_file = nullptr;
+    FILE *timecodes_file = nullptr;
+    FILE *gop_json_file = nullptr;
+    FILE *captions_file = nullptr;
+    FILE *afd_file = nullptr;
+
+    struct {
+        const std::string &path;
+        const char *description;
+        FILE **file;
+    } extra_outputs[] = {
+        { cmd.keyframes_path, "keyframe list", &keyframes_file },
+        { cmd.timecodes_path, "timecodes file", &timecodes_file },
+        { cmd.gop_json_path, "GOP list", &gop_json_file },
+        { cmd.captions_path, "captions file", &captions_file },
+        { cmd.afd_path, "active format file", &afd_file }
+    };
+
+    for (size_t i = 0; i < sizeof(extra_outputs) / sizeof(extra_outputs[0]); i++) {
+        if (!extra_outputs[i].path.size())
+            continue;
+
+        *extra_outputs[i].file = outputs.open(extra_outputs[i].path, extra_outputs[i].description, error);
+        if (!*extra_outputs[i].file) {
+            f.cleanup();
+            fake_file.close();
+
+            return false;
+        }
+    }
+
+
+    // trace file opening
+    FILE *trace_file = nullptr;
+    if (trace) {
+        trace_file = outputs.open(cmd.trace_path, "trace file", error);
+        if (!trace_file) {
+            f.cleanup();
+            fake_file.close();
+
+            return false;
+        }
+    }
+
+
+    // coarse index, for seeking while the D2V file is being made
+    std::string coarse_path;
+    if (cmd.coarse_samples > 0) {
+        coarse_path = cmd.d2v_path;
+        if (coarse_path == "-")
+            coarse_path = fake_file[0].name;
+        coarse_path += ".coarse";
+
+        if (!writeCoarseIndex(fake_file, cmd.coarse_samples, coarse_path, error)) {
+            f.cleanup();
+            fake_file.close();
+
+            return false;
+        }
+    }
+
+
+    // engage
+    D2V::LoggingFunction logging_func = printWarnings;
+    if (cmd.stay_quiet)
+        logging_func = nullptr;
+
+    D2V d2v(d2v_text_file, audio_files, &fake_file, &f, video_stream, logging_func);
+
+    if (cmd.pipeline_wanted)
+        d2v.setPipeline(256);
+
+    // Not earlier, because probing seeks around a lot.
+    int read_ahead = cmd.read_ahead;
+    if (read_ahead < 0)
+        read_ahead = cmd.pipeline_wanted ? 8 : 0;
+    fake_file.setReadAhead(1024 * 1024, read_ahead);
+
+    int progress_job = progress->startJob(fake_file[0].name, fake_file.getTotalSize());
+    d2v.setProgress(progress, progress_job);
+
+    std::unique_ptr<Thumbnailer> thumbnailer;
+    if (cmd.thumbnail_directory.size()) {
+        int threads = std::max(1u, std::thread::hardware_concurrency());
+
+        thumbnailer.reset(new Thumbnailer(video_stream->codec->codec_id,
+                                          video_stream->codec->extradata,
+                                          video_stream->codec->extradata_size,
+                                          threads,
+                                          cmd.thumbnail_directory,
+                                          160));
+        thumbnailer->setTrace(trace.get());
+        d2v.setThumbnailer(thumbnailer.get(), cmd.thumbnail_interval);
+    }
+
+    std::unique_ptr<GOPStats> gop_stats;
+    if (gop_stats_file) {
+        gop_stats.reset(new GOPStats(gop_stats_file, video_stream->codec->framerate));
+        d2v.setGOPStats(gop_stats.get());
+    }
+
+    std::unique_ptr<Timestamps> timestamps;
+    if (cmd.timestamps_wanted) {
+        timestamps.reset(new Timestamps);
+        d2v.setTimestamps(timestamps.get());
+    }
+
+    if (audio_index)
+        d2v.setAudioIndex(audio_index.get());
+
+    if (health_monitor)
+        d2v.setHealthMonitor(health_monitor.get());
+
+    std::unique_ptr<DamageReport> damage_report;
+    if (cmd.damage_report_wanted) {
+        damage_report.reset(new DamageReport(fake_file));
+        d2v.setDamageReport(damage_report.get());
+    }
+
+    if (cmd.resync_errors)
+        d2v.setResync(cmd.resync_errors);
+
+    // Declared first, so they are destroyed after the threads.
+    std::vector<std::unique_ptr<D2V::Sink>> sinks;
+    if (keyframes_file)
+        sinks.emplace_back(new KeyframeSink(keyframes_file));
+    if (timecodes_file)
+        sinks.emplace_back(new TimecodeSink(timecodes_file));
+    if (gop_json_file)
+        sinks.emplace_back(new GOPJSONSink(gop_json_file));
+    if (captions_file) {
+        std::string extension = cmd.captions_path.substr(cmd.captions_path.size() >= 4 ? cmd.captions_path.size() - 4 : 0);
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+        sinks.emplace_back(new CaptionSink(captions_file, extension == ".scc"));
+    }
+    if (afd_file)
+        sinks.emplace_back(new AFDSink(afd_file));
+
+    std::vector<std::unique_ptr<ThreadedSink>> threaded_sinks;
+    for (size_t i = 0; i < sinks.size(); i++) {
+        if (cmd.sink_threads) {
+            threaded_sinks.emplace_back(new ThreadedSink(sinks[i].get(), 64));
+            d2v.addSink(threaded_sinks.back().get());
+        } else {
+            d2v.addSink(sinks[i].get());
+        }
+    }
+
+    d2v.setTrace(trace.get());
+
+    std::unique_ptr<SegmentWriter> segment_writer;
+    if (cmd.split_wanted) {
+        segment_writer.reset(new SegmentWriter(outputs, cmd.d2v_path, compression));
+        d2v.setSegmentHandler(segment_writer.get());
+    }
+
+    if (!d2v.engage()) {
+        error = d2v.getError();
+
+        progress->finishJob(progress_job, false);
+        f.cleanup();
+        fake_file.close();
+
+        return false;
+    }
+
+    if (hasher) {
+        std::string hash_path = cmd.d2v_path;
+        if (hash_path == "-")
+            hash_path = fake_file[0].name;
+        hash_path += ".hash";
+
+        if (!fake_file.finishHashing()) {
+            error = fake_file.getError();
+
+            progress->finishJob(progress_job, false);
+            f.cleanup();
+            fake_file.close();
+
+            return false;
+        }
+
+        FILE *hash_file = outputs.open(hash_path, "hash file", error);
+        if (!hash_file || !writeHashes(hash_file, *hasher, error)) {
+            progress->finishJob(progress_job, false);
+            f.cleanup();
+            fake_file.close();
+
+            return false;
+        }
+    }
+
+    if (timestamps) {
+        for (auto it = audio_files.cbegin(); it != audio_files.cend(); it++) {
+            int64_t delay;
+            if (d2v.getAudioDelay(it->first, &delay))
+                timestamps->addAudioDelay(f.fctx->streams[it->first]->id, delay);
+        }
+
+        std::string timestamps_path = cmd.d2v_path;
+        if (timestamps_path == "-")
+            timestamps_path = fake_file[0].name;
+        timestamps_path += ".timestamps";
+
+        FILE *timestamps_file = outputs.open(timestamps_path, "timestamps file", error);
+        if (!timestamps_file || !timestamps->write(timestamps_file)) {
+            if (timestamps_file)
+                error = timestamps->getError();
+
+            progress->finishJob(progress_job, false);
+            f.cleanup();
+            fake_file.close();
+
+            return false;
+        }
+    }
+
+    if (damage_report) {
+        std::string damage_path = cmd.d2v_path;
+        if (damage_path == "-")
+            damage_path = fake_file[0].name;
+        damage_path += ".damage.json";
+
+        FILE *damage_file = outputs.open(damage_path, "damage report", error);
+        if (!damage_file || !damage_report->write(damage_file)) {
+            if (damage_file)
+                error = damage_report->getError();
+
+            progress->finishJob(progress_job, false);
+            f.cleanup();
+            fake_file.close();
+
+            return false;
+        }
+
+        if (!cmd.stay_quiet && damage_report->getRegions().size())
+            fprintf(stderr, "Damaged regions:     %d\n", (int)damage_report->getRegions().size());
+    }
+
+    if (segment_writer) {
+        std::string segments_path = cmd.d2v_path + ".segments";
+
+        FILE *segments_file = outputs.open(segments_path, "segment list", error);
+        if (!segments_file || !segment_writer->writeManifest(segments_file, error)) {
+            progress->finishJob(progress_job, false);
+            f.cleanup();
+            fake_file.close();
+
+            return false;
+        }
+    }
+
+    if (trace && !trace->write(trace_file)) {
+        error = trace->getError();
+
+        progress->finishJob(progress_job, false);
+        f.cleanup();
+        fake_file.close();
+
+        return false;
+    }
+
+    if (!cmd.stay_quiet) {
+        const D2V::Stats &stats = d2v.getStats();
+        fprintf(stderr,
+                "Video frames seen:   %d\n"
+                "    Progressive:     %d\n"
+                "    Top field first: %d\n"
+                "    Repeat:          %d\n",
+                stats.video_frames,
+                stats.progressive_frames,
+                stats.tff_frames,
+                stats.rff_frames);
+
+        for (auto it = audio_files.cbegin(); it != audio_files.cend(); it++) {
+            int64_t delay;
+            if (d2v.getAudioDelay(it->first, &delay))
+                fprintf(stderr, "Audio delay of track %x: %" PRId64 " ms\n", f.fctx->streams[it->first]->id, delay);
+        }
 
-        return 0;
+        if (health_monitor) {
+            HealthMonitor::Stats health_stats = health_monitor->getStats();
+
+            if (health_stats.transport_stream)
+                fprintf(stderr,
+                        "Transport packets:   %" PRId64 "\n"
+                        "    Scrambled:       %" PRId64 "\n"
+                        "    CC errors:       %" PRId64 "\n"
+                        "    Resyncs:         %" PRId64 "\n",
+                        health_stats.packets,
+                        health_stats.scrambled,
+                        health_stats.cc_errors,
+                        health_stats.resyncs);
+        }
+
+        if (throttle) {
+            Throttle::Stats throttle_stats = throttle->getStats();
+
+            fprintf(stderr,
+                    "Reads:               %" PRId64 "\n"
+                    "    Average latency: %.1f ms\n"
+                    "    Throttled for:   %.1f s\n"
+                    "    Backoffs:        %d\n",
+                    throttle_stats.reads,
+                    throttle_stats.average_latency_ms,
+                    throttle_stats.waited_seconds,
+                    throttle_stats.backoffs);
+
+            if (throttle_stats.current_rate > 0)
+                fprintf(stderr, "    Final rate:      %.2f MB/s\n", throttle_stats.current_rate / (1024 * 1024));
+            else
+                fprintf(stderr, "    Final rate:      unlimited\n");
+        }
     }
 
 
-    // container format check
-    if (getStreamType(f.fctx->iformat->name) == D2V::UNSUPPORTED_STREAM) {
-        fprintf(stderr, "Unsupported container type '%s'.\n", f.fctx->iformat->long_name ? f.fctx->iformat->long_name : f.fctx->iformat->name);
+    // some cleanup
+    bool okay = true;
+    if (compressor && !compressor->finish()) {
+        error = compressor->getError();
+        okay = false;
+    }
+    if (okay)
+        okay = outputs.commit(error);
+    if (d2v_file == stdout && fflush(stdout)) {
+        error = "Failed to flush standard output.";
+        okay = false;
+    }
+    // The D2V file replaces it.
+    if (okay && coarse_path.size())
+        remove(coarse_path.c_str());
+    progress->finishJob(progress_job, okay);
+    f.cleanup();
+    fake_file.close();
 
-        f.cleanup();
-        fake_file.close();
+    return okay;
+}
 
-        return 1;
+
+// Indexes every file with the options from the command line.
+class IndexingDaemon : public Daemon {
+    CommandLine cmd;
+    Progress *progress;
+    Throttle *throttle;
+
+protected:
+    bool indexFile(const std::string &path, std::string &err) override {
+        FakeFile fake_file;
+        fake_file.push_back(path);
+
+        return processFiles(cmd, fake_file, progress, throttle, true, err);
     }
 
+public:
+    IndexingDaemon(const CommandLine &_cmd, Progress *_progress, Throttle *_throttle)
+        : Daemon(_cmd.watch_directories, _cmd.workers, _cmd.stable_seconds, _cmd.control_socket, _cmd.stay_quiet ? nullptr : printWarnings)
+        , cmd(_cmd)
+        , progress(_progress)
+        , throttle(_throttle)
+    {
+        cmd.stay_quiet = true;
+    }
+};
 
-    // stream selection
-    deselectAllStreams(f.fctx);
 
-    AVStream *video_stream;
-    if (cmd.have_video_id) {
-        video_stream = selectVideoStreamById(f.fctx, cmd.video_id);
-        if (!video_stream) {
-            fprintf(stderr, "Couldn't find video track with id %x.\n", cmd.video_id);
+// Indexes the buckets of a rotating recording with the options from the
+// command line.
+class BucketIndexer : public ContinuousIndexer {
+    CommandLine cmd;
+    Progress *progress;
+    Throttle *throttle;
 
-            f.cleanup();
-            fake_file.close();
+protected:
+    bool indexBucket(const std::vector<std::string> &paths, const std::string &d2v_path, std::string &err) override {
+        FakeFile fake_file;
+        for (size_t i = 0; i < paths.size(); i++)
+            fake_file.push_back(paths[i]);
+
+        CommandLine bucket_cmd = cmd;
+        bucket_cmd.d2v_path = d2v_path;
+
+        return processFiles(bucket_cmd, fake_file, progress, throttle, true, err);
+    }
+
+public:
+    BucketIndexer(const CommandLine &_cmd, Progress *_progress, Throttle *_throttle)
+        : ContinuousIndexer(_cmd.continuous_directory,
+                            _cmd.d2v_path,
+                            _cmd.compression == Compressor::GZIP_COMPRESSION ? ".d2v.gz" : ".d2v",
+                            _cmd.bucket_minutes * 60,
+                            _cmd.stable_seconds,
+                            _cmd.stay_quiet ? nullptr : printWarnings)
+        , cmd(_cmd)
+        , progress(_progress)
+        , throttle(_throttle)
+    {
+        cmd.stay_quiet = true;
+    }
+};
+
+
+#ifdef _WIN32
+BOOL WINAPI HandlerRoutine(DWORD dwCtrlType) {
+    switch (dwCtrlType) {
+    case CTRL_C_EVENT:
+    case CTRL_BREAK_EVENT:
+    case CTRL_CLOSE_EVENT:
+        _exit(1);
+    default:
+        return FALSE;
+    }
+}
 
+
+int wmain(int argc, wchar_t **argvw) {
+    if (_setmode(_fileno(stdout), _O_BINARY) == -1)
+        fprintf(stderr, "Failed to set stdout to binary mode.\n");
+
+    SetConsoleCtrlHandler(HandlerRoutine, TRUE);
+
+    UTF16 utf16;
+
+    std::vector<std::string> argv;
+
+    for (int i = 0; i < argc; i++)
+        argv.push_back(utf16.to_bytes(argvw[i]));
+#else
+int main(int argc, char **argv) {
+#endif
+
+    // ffmpeg init part 0
+    av_log_set_level(AV_LOG_PANIC);
+    av_register_all();
+    avcodec_register_all();
+
+
+    // command line parsing
+    FakeFile fake_file;
+
+    CommandLine cmd;
+    if (!cmd.parse(argc, argv, fake_file)) {
+        fprintf(stderr, "%s\n", cmd.getError().c_str());
+        return 1;
+    }
+
+    if (cmd.help_wanted) {
+        printHelp();
+        return 0;
+    }
+
+    if (cmd.version_wanted) {
+        printVersions();
+        return 0;
+    }
+
+
+    // d2v editing
+    if (cmd.edit_wanted) {
+        if (!cmd.d2v_path.size()) {
+            fprintf(stderr, "--edit requires --output.\n");
             return 1;
         }
-    } else {
-        video_stream = selectFirstVideoStream(f.fctx);
-        if (!video_stream) {
-            fprintf(stderr, "Couldn't find any video tracks.\n");
 
-            f.cleanup();
-            fake_file.close();
+        int compression = cmd.compression;
+        if (compression == Compressor::UNKNOWN_COMPRESSION)
+            compression = Compressor::getCompressionForPath(cmd.d2v_path);
 
+        D2VFile d2v;
+        if (!d2v.parse(fake_file[0].name)) {
+            fprintf(stderr, "%s\n", d2v.getError().c_str());
             return 1;
         }
-    }
 
-    if (cmd.audio_ids.size()) {
-        if (!selectAudioStreamsById(f.fctx, cmd.audio_ids)) {
-            for (size_t i = 0; i < cmd.audio_ids.size(); i++)
-                fprintf(stderr, "Couldn't find audio track with id %x.\n", cmd.audio_ids[i]);
+        for (size_t i = 1; i < fake_file.size(); i++) {
+            D2VFile other;
+            if (!other.parse(fake_file[i].name)) {
+                fprintf(stderr, "%s\n", other.getError().c_str());
+                return 1;
+            }
 
-            f.cleanup();
-            fake_file.close();
+            if (!d2v.append(other)) {
+                fprintf(stderr, "Failed to append d2v file '%s': %s\n", fake_file[i].name.c_str(), d2v.getError().c_str());
+                return 1;
+            }
+        }
 
-            return 1;
+        if (cmd.edit_ranges.size()) {
+            D2VFile trimmed;
+            std::vector<D2VFile::FrameRange> actual_ranges;
+
+            if (!d2v.trim(cmd.edit_ranges, trimmed, actual_ranges)) {
+                fprintf(stderr, "%s\n", d2v.getError().c_str());
+                return 1;
+            }
+
+            if (!trimmed.write(cmd.d2v_path, compression)) {
+                fprintf(stderr, "%s\n", trimmed.getError().c_str());
+                return 1;
+            }
+
+            if (!cmd.stay_quiet) {
+                for (size_t i = 0; i < actual_ranges.size(); i++)
+                    fprintf(stderr, "Frames %" PRId64 "-%" PRId64 " are frames %" PRId64 "-%" PRId64 " in the new d2v file.\n",
+                            cmd.edit_ranges[i].first,
+                            cmd.edit_ranges[i].second,
+                            actual_ranges[i].first,
+                            actual_ranges[i].second);
+            }
+        } else {
+            if (!d2v.write(cmd.d2v_path, compression)) {
+                fprintf(stderr, "%s\n", d2v.getError().c_str());
+                return 1;
+            }
         }
-    } else if (cmd.audio_ids_all) {
-        if (!selectAllAudioStreams(f.fctx)) {
-            fprintf(stderr, "Couldn't find any audio tracks.\n");
 
-            f.cleanup();
-            fake_file.close();
+        return 0;
+    }
+
 
+    // decompression
+    if (cmd.decompress_path.size()) {
+        std::string err;
+        if (!Compressor::decompress(cmd.decompress_path, stdout, err)) {
+            fprintf(stderr, "%s\n", err.c_str());
             return 1;
         }
+
+        return 0;
     }
 
 
-    // video format check
-    std::unordered_set<int> supported_codec_ids = {
-        AV_CODEC_ID_MPEG1VIDEO,
-        AV_CODEC_ID_MPEG2VIDEO
-    };
+    // frame queries
+    if (cmd.query_path.size()) {
+        D2VFile d2v;
+        if (!d2v.parse(cmd.query_path)) {
+            fprintf(stderr, "%s\n", d2v.getError().c_str());
+            return 1;
+        }
 
-    if (!supported_codec_ids.count(video_stream->codec->codec_id)) {
-        const char *type = "unknown";
-        const AVCodecDescriptor *desc = av_codec_get_codec_descriptor(video_stream->codec);
-        if (desc)
-            type = desc->long_name ? desc->long_name : desc->name;
+        // Timecodes are more accurate with the timestamps, if they exist.
+        std::unique_ptr<Timestamps> timestamps;
+        std::string timestamps_path = cmd.query_path + ".timestamps";
 
-        fprintf(stderr, "Unsupported video codec: %s (id: %d)\n", type, video_stream->codec->codec_id);
+        FILE *timestamps_file = openFile(timestamps_path.c_str(), "rb");
+        if (timestamps_file) {
+            fclose(timestamps_file);
 
-        f.cleanup();
-        fake_file.close();
+            timestamps.reset(new Timestamps);
+            if (!timestamps->read(timestamps_path)) {
+                fprintf(stderr, "%s\n", timestamps->getError().c_str());
+                return 1;
+            }
+        }
 
-        return 1;
+        std::string err;
+        if (!queryFrames(d2v, timestamps.get(), stdin, stdout, err)) {
+            fprintf(stderr, "%s\n", err.c_str());
+            return 1;
+        }
+
+        return 0;
     }
 
 
-    // d2v file opening
-    FILE *d2v_file;
-    if (cmd.d2v_path == "-") {
-        d2v_file = stdout;
-    } else {
-        if (!cmd.d2v_path.size())
-            cmd.d2v_path = fake_file[0].name + ".d2v";
+    // frame queries while indexing
+    if (cmd.live_query_wanted) {
+        std::vector<std::string> files;
+        for (auto it = fake_file.cbegin(); it != fake_file.cend(); it++)
+            files.push_back(it->name);
 
-        d2v_file = openFile(cmd.d2v_path.c_str(), "wb");
-        if (!d2v_file) {
-            fprintf(stderr, "Failed to open d2v file '%s' for writing: %s\n", cmd.d2v_path.c_str(), strerror(errno));
+        IncrementalIndex index(files, cmd.have_video_id ? cmd.video_id : -1);
+        if (!index.open()) {
+            fprintf(stderr, "%s\n", index.getError().c_str());
+            return 1;
+        }
 
-            f.cleanup();
-            fake_file.close();
+        std::string err;
+
+        // The answers are only less precise without the coarse index.
+        if (cmd.coarse_samples > 0 && !index.buildCoarseIndex(cmd.coarse_samples, err) && !cmd.stay_quiet)
+            fprintf(stderr, "Failed to build the coarse index: %s\n", err.c_str());
 
+        if (!queryFramesLive(index, stdin, stdout, err)) {
+            fprintf(stderr, "%s\n", err.c_str());
             return 1;
         }
+
+        return 0;
     }
 
 
-    // audio files opening
-    std::unordered_map<int, FILE *> audio_files;
-    for (unsigned i = 0; i < f.fctx->nb_streams; i++) {
-        if (f.fctx->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO &&
-            f.fctx->streams[i]->discard != AVDISCARD_ALL) {
-            std::string path = cmd.d2v_path;
+    // d2v verification
+    if (cmd.verify_path.size()) {
+        D2VFile d2v;
+        if (!d2v.parse(cmd.verify_path)) {
+            fprintf(stderr, "%s\n", d2v.getError().c_str());
+            return 1;
+        }
 
-            char id[20] = { 0 };
-            snprintf(id, 19, "%x", f.fctx->streams[i]->id);
+        int threads = std::max(1u, std::min(4u, std::thread::hardware_concurrency()));
 
-            path += " T";
-            path += id;
+        Verifier verifier(d2v, cmd.verify_samples, threads, cmd.verify_decode);
+        if (!verifier.verify()) {
+            fprintf(stderr, "%s\n", verifier.getError().c_str());
+            return 1;
+        }
 
-            int64_t bit_rate, channel_layout;
+        std::vector<std::string> problems = verifier.getProblems();
+        for (size_t i = 0; i < problems.size(); i++)
+            fprintf(stderr, "%s\n", problems[i].c_str());
 
-            if (av_opt_get_int(f.fctx->streams[i]->codec, "channel_layout", 0, &channel_layout) >= 0) {
-                char channels[512] = { 0 };
-                av_get_channel_layout_string(channels, 512, 0, channel_layout);
-                path += " ";
-                path += channels;
-            }
+        if (!cmd.stay_quiet)
+            fprintf(stderr, "Checked %d of %d data lines, %d problems found.\n", verifier.getCheckedLines(), (int)d2v.lines.size(), (int)problems.size());
 
-            if (av_opt_get_int(f.fctx->streams[i]->codec, "ab", 0, &bit_rate) >= 0)
-                path += " " + std::to_string(bit_rate / 1000) + " kbps";
+        return problems.size() ? 1 : 0;
+    }
 
-            path += ".audio";
 
-            FILE *file = openFile(path.c_str(), "wb");
-            if (!file) {
-                fprintf(stderr, "Failed to open audio file '%s' for writing: %s\n", path.c_str(), strerror(errno));
+    // progress reporting
+    FILE *progress_file = nullptr;
+    if (cmd.progress_fd >= 0) {
+        progress_file = fdopen(cmd.progress_fd, "w");
+        if (!progress_file) {
+            fprintf(stderr, "Failed to open file descriptor %d for progress reports: %s\n", cmd.progress_fd, strerror(errno));
+            return 1;
+        }
+    }
 
-                for (auto it = audio_files.begin(); it != audio_files.end(); it++)
-                    fclose(it->second);
-                f.cleanup();
-                fake_file.close();
+    // Several files being indexed at once would fight over the console.
+    bool progress_console = !cmd.stay_quiet && !cmd.watch_directories.size() && !cmd.continuous_directory.size();
 
-                return 1;
-            }
+    Progress progress(progress_file, progress_console, cmd.progress_rate);
 
-            audio_files.insert({ f.fctx->streams[i]->index, file });
+
+    // read throttling, before any threads are started so they get the
+    // same I/O priority
+    if (cmd.idle_io_wanted) {
+        std::string err;
+        if (!Throttle::setIdleIOPriority(err)) {
+            fprintf(stderr, "%s\n", err.c_str());
+            return 1;
         }
     }
 
+    std::unique_ptr<Throttle> throttle;
+    if (cmd.max_read_rate > 0 || cmd.read_latency > 0)
+        throttle.reset(new Throttle(cmd.max_read_rate * 1024 * 1024, cmd.read_latency));
 
-    // engage
-    D2V::ProgressFunction progress_func = printProgress;
-    D2V::LoggingFunction logging_func = printWarnings;
-    if (cmd.stay_quiet) {
-        progress_func = nullptr;
-        logging_func = nullptr;
+
+    // watching directories
+    if (cmd.watch_directories.size()) {
+        IndexingDaemon daemon(cmd, &progress, throttle.get());
+
+        if (!daemon.run()) {
+            fprintf(stderr, "%s\n", daemon.getError().c_str());
+            return 1;
+        }
+
+        return 0;
     }
 
-    D2V d2v(d2v_file, audio_files, &fake_file, &f, video_stream, progress_func, logging_func);
 
-    if (!d2v.engage()) {
-        fprintf(stderr, "%s\n", d2v.getError().c_str());
+    // indexing rotating segments in time buckets
+    if (cmd.continuous_directory.size()) {
+        BucketIndexer indexer(cmd, &progress, throttle.get());
 
-        for (auto it = audio_files.begin(); it != audio_files.end(); it++)
-            fclose(it->second);
-        f.cleanup();
-        fake_file.close();
+        if (!indexer.run()) {
+            fprintf(stderr, "%s\n", indexer.getError().c_str());
+            return 1;
+        }
 
-        return 1;
+        return 0;
     }
 
-    if (!cmd.stay_quiet) {
-        const D2V::Stats &stats = d2v.getStats();
-        fprintf(stderr,
-                "Video frames seen:   %d\n"
-                "    Progressive:     %d\n"
-                "    Top field first: %d\n"
-                "    Repeat:          %d\n",
-                stats.video_frames,
-                stats.progressive_frames,
-                stats.tff_frames,
-                stats.rff_frames);
+
+    // DVD titles
+    if (cmd.dvd_title) {
+        DVDTitle title;
+        if (!title.open(fake_file[0].name, cmd.dvd_title, cmd.dvd_angle)) {
+            fprintf(stderr, "%s\n", title.getError().c_str());
+            return 1;
+        }
+
+        if (!cmd.d2v_path.size()) {
+            std::string base = fake_file[0].name.substr(0, fake_file[0].name.size() - 4);
+
+            cmd.d2v_path = base + ".title" + std::to_string(cmd.dvd_title);
+            if (cmd.dvd_angle > 1)
+                cmd.d2v_path += ".angle" + std::to_string(cmd.dvd_angle);
+            cmd.d2v_path += ".d2v";
+            if (cmd.compression == Compressor::GZIP_COMPRESSION)
+                cmd.d2v_path += ".gz";
+        }
+
+        fake_file.clear();
+
+        const std::vector<std::string> &vob_files = title.getVOBFiles();
+        for (size_t i = 0; i < vob_files.size(); i++)
+            fake_file.push_back(vob_files[i]);
+
+        const std::vector<DVDTitle::Range> &ranges = title.getRanges();
+        for (size_t i = 0; i < ranges.size(); i++)
+            fake_file.addRange(ranges[i].first_sector * DVDTitle::SECTOR_SIZE,
+                               (ranges[i].last_sector - ranges[i].first_sector + 1) * DVDTitle::SECTOR_SIZE,
+                               ranges[i].vob,
+                               ranges[i].cell);
     }
 
 
-    // some cleanup
-    for (auto it = audio_files.begin(); it != audio_files.end(); it++)
-        fclose(it->second);
-    fclose(d2v_file);
-    f.cleanup();
-    fake_file.close();
+    // indexing
+    std::string error;
+    if (!processFiles(cmd, fake_file, &progress, throttle.get(), false, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
 
     return 0;
 }
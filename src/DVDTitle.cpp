@@ -0,0 +1,468 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+
+#include "DVDTitle.h"
+#include "Bullshit.h"
+
+
+// Where things are in the IFO files and in the navigation packs.
+#define VMG_TT_SRPT 0xc4
+#define VTS_PTT_SRPT 0xc8
+#define VTS_PGCIT 0xcc
+#define PGC_NR_OF_CELLS 0x03
+#define PGC_CELL_PLAYBACK_OFFSET 0xe8
+#define PGC_CELL_POSITION_OFFSET 0xea
+#define PGC_SIZE 0xec
+#define CELL_PLAYBACK_SIZE 24
+#define CELL_POSITION_SIZE 4
+#define DSI_START 0x400
+#define DSI_VOBU_EA 0x40f
+#define DSI_NEXT_VOBU 0x541
+
+#define BLOCK_TYPE_ANGLE 1
+#define SRI_END_OF_CELL 0x3fffffff
+
+
+static uint32_t readBigEndian(const uint8_t *data, int bytes) {
+    uint32_t value = 0;
+    for (int i = 0; i < bytes; i++)
+        value = (value << 8) | data[i];
+
+    return value;
+}
+
+
+static bool inBounds(const std::vector<uint8_t> &data, uint64_t offset, uint64_t length) {
+    return offset <= data.size() && length <= data.size() - offset;
+}
+
+
+DVDTitle::DVDTitle()
+    : vob_files{ }
+    , vob_sizes{ }
+    , vob_streams{ }
+    , ranges{ }
+    , title_set(0)
+    , angles(1)
+    , error{ }
+{ }
+
+
+DVDTitle::~DVDTitle() {
+    closeVOBFiles();
+}
+
+
+bool DVDTitle::isIFOFile(const std::string &name) {
+    if (name.size() < 4)
+        return false;
+
+    std::string extension = name.substr(name.size() - 4);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+    return extension == ".ifo";
+}
+
+
+bool DVDTitle::readIFO(const std::string &path, const char *identifier, std::vector<uint8_t> &ifo) {
+    FILE *file = openFile(path.c_str(), "rb");
+    if (!file) {
+        error = "Failed to open IFO file '" + path + "': " + strerror(errno);
+        return false;
+    }
+
+    ifo.clear();
+
+    uint8_t buffer[SECTOR_SIZE];
+    size_t bytes_read;
+    while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        ifo.insert(ifo.end(), buffer, buffer + bytes_read);
+
+    bool failed = ferror(file);
+
+    fclose(file);
+
+    if (failed) {
+        error = "Failed to read IFO file '" + path + "'.";
+        return false;
+    }
+
+    if (ifo.size() < PGC_SIZE || memcmp(ifo.data(), identifier, strlen(identifier))) {
+        error = "'" + path + "' is not a " + identifier + " IFO file.";
+        return false;
+    }
+
+    return true;
+}
+
+
+bool DVDTitle::findTitleSet(const std::string &vmg_path, int title, int &vts, int &vts_title) {
+    std::vector<uint8_t> vmg;
+    if (!readIFO(vmg_path, "DVDVIDEO-VMG", vmg))
+        return false;
+
+    uint64_t tt_srpt = (uint64_t)readBigEndian(&vmg[VMG_TT_SRPT], 4) * SECTOR_SIZE;
+    if (!inBounds(vmg, tt_srpt, 8)) {
+        error = "The title table in '" + vmg_path + "' is damaged.";
+        return false;
+    }
+
+    int titles = readBigEndian(&vmg[tt_srpt], 2);
+    if (title < 1 || title > titles) {
+        error = "Title " + std::to_string(title) + " doesn't exist. The disc has " + std::to_string(titles) + " titles.";
+        return false;
+    }
+
+    uint64_t entry = tt_srpt + 8 + (uint64_t)(title - 1) * 12;
+    if (!inBounds(vmg, entry, 12)) {
+        error = "The title table in '" + vmg_path + "' is damaged.";
+        return false;
+    }
+
+    vts = vmg[entry + 6];
+    vts_title = vmg[entry + 7];
+
+    return true;
+}
+
+
+bool DVDTitle::findVOBFiles(const std::string &vts_path) {
+    // VTS_xx_0.IFO goes with VTS_xx_1.VOB to VTS_xx_9.VOB.
+    std::string base = vts_path.substr(0, vts_path.size() - 5);
+    std::string extension = vts_path.compare(vts_path.size() - 4, 4, ".IFO") == 0 ? ".VOB" : ".vob";
+
+    for (char number = '1'; number <= '9'; number++) {
+        std::string path = base + number + extension;
+
+        FILE *stream = openFile(path.c_str(), "rb");
+        if (!stream)
+            break;
+
+        vob_streams.push_back(stream);
+
+        int64_t size = -1;
+        if (!fseeko(stream, 0, SEEK_END))
+            size = ftello(stream);
+
+        if (size < 0) {
+            error = "Failed to find the size of '" + path + "': " + strerror(errno);
+            return false;
+        }
+
+        vob_files.push_back(path);
+        vob_sizes.push_back(size);
+    }
+
+    if (!vob_files.size()) {
+        error = "Failed to open '" + base + "1" + extension + "': " + strerror(errno);
+        return false;
+    }
+
+    return true;
+}
+
+
+void DVDTitle::closeVOBFiles() {
+    for (size_t i = 0; i < vob_streams.size(); i++)
+        fclose(vob_streams[i]);
+
+    vob_streams.clear();
+}
+
+
+bool DVDTitle::readSector(int64_t sector, uint8_t *buffer) {
+    int64_t position = sector * SECTOR_SIZE;
+
+    for (size_t i = 0; i < vob_streams.size(); i++) {
+        if (position >= vob_sizes[i]) {
+            position -= vob_sizes[i];
+            continue;
+        }
+
+        if (fseeko(vob_streams[i], position, SEEK_SET) ||
+            fread(buffer, 1, SECTOR_SIZE, vob_streams[i]) != (size_t)SECTOR_SIZE) {
+            error = "Failed to read sector " + std::to_string(sector) + " from '" + vob_files[i] + "'.";
+            return false;
+        }
+
+        return true;
+    }
+
+    error = "Sector " + std::to_string(sector) + " is past the end of the VOB files.";
+    return false;
+}
+
+
+void DVDTitle::addRange(const Range &range) {
+    if (ranges.size()) {
+        Range &last = ranges.back();
+
+        if (last.last_sector + 1 == range.first_sector && last.vob == range.vob && last.cell == range.cell) {
+            last.last_sector = range.last_sector;
+            return;
+        }
+    }
+
+    ranges.push_back(range);
+}
+
+
+bool DVDTitle::addInterleavedCell(const Range &cell) {
+    uint8_t nav[SECTOR_SIZE];
+
+    int64_t sector = cell.first_sector;
+
+    while (sector <= cell.last_sector) {
+        if (!readSector(sector, nav))
+            return false;
+
+        static const uint8_t pack_start[4] = { 0, 0, 1, 0xba };
+        static const uint8_t dsi_start[4] = { 0, 0, 1, 0xbf };
+
+        if (memcmp(nav, pack_start, 4) || memcmp(nav + DSI_START, dsi_start, 4) || nav[DSI_START + 6] != 1) {
+            error = "Expected a navigation pack at sector " + std::to_string(sector) + " of title set " + std::to_string(title_set) + ".";
+            return false;
+        }
+
+        int64_t vobu_end = sector + readBigEndian(nav + DSI_VOBU_EA, 4);
+
+        addRange({ sector, std::min(vobu_end, cell.last_sector), cell.vob, cell.cell });
+
+        // The next VOBU of the same angle, past any other angles stored in
+        // between.
+        uint32_t next_vobu = readBigEndian(nav + DSI_NEXT_VOBU, 4) & SRI_END_OF_CELL;
+        if (next_vobu == SRI_END_OF_CELL || next_vobu == 0)
+            break;
+
+        sector += next_vobu;
+    }
+
+    return true;
+}
+
+
+bool DVDTitle::open(const std::string &ifo_path, int title, int angle) {
+    closeVOBFiles();
+    vob_files.clear();
+    vob_sizes.clear();
+    ranges.clear();
+    angles = 1;
+
+    size_t slash = ifo_path.find_last_of("/\\");
+    std::string directory = slash == std::string::npos ? "" : ifo_path.substr(0, slash + 1);
+    std::string name = ifo_path.substr(directory.size());
+
+    std::string upper_name = name;
+    std::transform(upper_name.begin(), upper_name.end(), upper_name.begin(), ::toupper);
+
+    std::string vts_path = ifo_path;
+    int vts_title = title;
+
+    if (upper_name == "VIDEO_TS.IFO") {
+        if (!findTitleSet(ifo_path, title, title_set, vts_title))
+            return false;
+
+        char vts_name[16];
+        snprintf(vts_name, sizeof(vts_name), "VTS_%02d_0.IFO", title_set);
+
+        vts_path = directory + vts_name;
+        if (name != upper_name)
+            std::transform(vts_path.end() - 12, vts_path.end(), vts_path.end() - 12, ::tolower);
+    } else if (upper_name.size() == 12 && upper_name.compare(0, 4, "VTS_") == 0 &&
+               isdigit((unsigned char)upper_name[4]) && isdigit((unsigned char)upper_name[5]) &&
+               upper_name.compare(6, 6, "_0.IFO") == 0) {
+        title_set = std::stoi(upper_name.substr(4, 2));
+    } else {
+        error = "'" + ifo_path + "' is neither VIDEO_TS.IFO nor VTS_xx_0.IFO.";
+        return false;
+    }
+
+    std::vector<uint8_t> ifo;
+    if (!readIFO(vts_path, "DVDVIDEO-VTS", ifo))
+        return false;
+
+    if (!findVOBFiles(vts_path))
+        return false;
+
+    std::string damaged = "The IFO file '" + vts_path + "' is damaged: ";
+
+
+    // The program chains the title's chapters are in.
+    uint64_t ptt_srpt = (uint64_t)readBigEndian(&ifo[VTS_PTT_SRPT], 4) * SECTOR_SIZE;
+    if (!inBounds(ifo, ptt_srpt, 8)) {
+        error = damaged + "chapter table is outside the file.";
+        return false;
+    }
+
+    int titles = readBigEndian(&ifo[ptt_srpt], 2);
+    if (vts_title < 1 || vts_title > titles) {
+        error = "Title " + std::to_string(vts_title) + " doesn't exist. Title set " + std::to_string(title_set) + " has " + std::to_string(titles) + " titles.";
+        return false;
+    }
+
+    if (!inBounds(ifo, ptt_srpt + 8, (uint64_t)titles * 4)) {
+        error = damaged + "chapter table is truncated.";
+        return false;
+    }
+
+    uint64_t chapters_start = ptt_srpt + readBigEndian(&ifo[ptt_srpt + 8 + (vts_title - 1) * 4], 4);
+    uint64_t chapters_end;
+    if (vts_title < titles)
+        chapters_end = ptt_srpt + readBigEndian(&ifo[ptt_srpt + 8 + vts_title * 4], 4);
+    else
+        chapters_end = ptt_srpt + readBigEndian(&ifo[ptt_srpt + 4], 4) + 1;
+
+    if (chapters_end < chapters_start || !inBounds(ifo, chapters_start, chapters_end - chapters_start)) {
+        error = damaged + "chapter table is truncated.";
+        return false;
+    }
+
+    std::vector<int> program_chains;
+    for (uint64_t chapter = chapters_start; chapter + 4 <= chapters_end; chapter += 4) {
+        int pgcn = readBigEndian(&ifo[chapter], 2);
+
+        if (std::find(program_chains.begin(), program_chains.end(), pgcn) == program_chains.end())
+            program_chains.push_back(pgcn);
+    }
+
+    if (!program_chains.size()) {
+        error = "Title " + std::to_string(title) + " has no chapters.";
+        return false;
+    }
+
+
+    // Their cells.
+    uint64_t pgcit = (uint64_t)readBigEndian(&ifo[VTS_PGCIT], 4) * SECTOR_SIZE;
+    if (!inBounds(ifo, pgcit, 8)) {
+        error = damaged + "program chain table is outside the file.";
+        return false;
+    }
+
+    int pgc_count = readBigEndian(&ifo[pgcit], 2);
+
+    for (size_t i = 0; i < program_chains.size(); i++) {
+        int pgcn = program_chains[i];
+
+        if (pgcn < 1 || pgcn > pgc_count || !inBounds(ifo, pgcit + 8 + (pgcn - 1) * 8, 8)) {
+            error = damaged + "program chain " + std::to_string(pgcn) + " doesn't exist.";
+            return false;
+        }
+
+        uint64_t pgc = pgcit + readBigEndian(&ifo[pgcit + 8 + (pgcn - 1) * 8 + 4], 4);
+        if (!inBounds(ifo, pgc, PGC_SIZE)) {
+            error = damaged + "program chain " + std::to_string(pgcn) + " is outside the file.";
+            return false;
+        }
+
+        int cells = ifo[pgc + PGC_NR_OF_CELLS];
+        uint64_t cell_playback = pgc + readBigEndian(&ifo[pgc + PGC_CELL_PLAYBACK_OFFSET], 2);
+        uint64_t cell_position = pgc + readBigEndian(&ifo[pgc + PGC_CELL_POSITION_OFFSET], 2);
+
+        if (!inBounds(ifo, cell_playback, cells * CELL_PLAYBACK_SIZE) || !inBounds(ifo, cell_position, cells * CELL_POSITION_SIZE)) {
+            error = damaged + "cell tables of program chain " + std::to_string(pgcn) + " are outside the file.";
+            return false;
+        }
+
+        int angle_in_block = 0;
+
+        for (int c = 0; c < cells; c++) {
+            const uint8_t *playback = &ifo[cell_playback + c * CELL_PLAYBACK_SIZE];
+            const uint8_t *position = &ifo[cell_position + c * CELL_POSITION_SIZE];
+
+            int block_mode = playback[0] >> 6;
+            int block_type = (playback[0] >> 4) & 3;
+            bool interleaved = playback[0] & 4;
+
+            Range cell = {
+                readBigEndian(playback + 8, 4),
+                readBigEndian(playback + 20, 4),
+                (int)readBigEndian(position, 2),
+                position[3]
+            };
+
+            // Block mode 1 is the first cell of a block, 3 the last.
+            if (block_type == BLOCK_TYPE_ANGLE && block_mode != 0) {
+                if (block_mode == 1)
+                    angle_in_block = 0;
+                angle_in_block++;
+
+                angles = std::max(angles, angle_in_block);
+
+                if (angle_in_block != angle)
+                    continue;
+            }
+
+            if (cell.last_sector < cell.first_sector) {
+                error = damaged + "cell " + std::to_string(c + 1) + " of program chain " + std::to_string(pgcn) + " ends before it starts.";
+                return false;
+            }
+
+            if (interleaved) {
+                if (!addInterleavedCell(cell))
+                    return false;
+            } else {
+                addRange(cell);
+            }
+        }
+    }
+
+    if (angle < 1 || angle > angles) {
+        error = "Angle " + std::to_string(angle) + " doesn't exist. Title " + std::to_string(title) + " has " + std::to_string(angles) + " angles.";
+        return false;
+    }
+
+    if (!ranges.size()) {
+        error = "Title " + std::to_string(title) + " has no cells.";
+        return false;
+    }
+
+    closeVOBFiles();
+
+    return true;
+}
+
+
+const std::vector<std::string> &DVDTitle::getVOBFiles() const {
+    return vob_files;
+}
+
+
+const std::vector<DVDTitle::Range> &DVDTitle::getRanges() const {
+    return ranges;
+}
+
+
+int DVDTitle::getTitleSet() const {
+    return title_set;
+}
+
+
+int DVDTitle::getAngles() const {
+    return angles;
+}
+
+
+const std::string &DVDTitle::getError() const {
+    return error;
+}
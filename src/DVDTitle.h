@@ -0,0 +1,101 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#ifndef D2V_WITCH_DVDTITLE_H
+#define D2V_WITCH_DVDTITLE_H
+
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+// Finds where one title of a DVD is in its VOB files, using the IFO
+// files, so that only the title has to be read.
+//
+// The title's cells are taken from the program chains its chapters point
+// to, in playback order. In angle blocks only the cells of the chosen
+// angle are kept. Interleaved cells are followed VOBU by VOBU through
+// their navigation packs, which skips the other angles and branches
+// stored between their pieces.
+class DVDTitle {
+public:
+    // Sectors are counted from the start of VTS_xx_1.VOB, with the title
+    // set's VOB files taken as one.
+    struct Range {
+        int64_t first_sector;
+        int64_t last_sector;
+        int vob;
+        int cell;
+    };
+
+    static const int SECTOR_SIZE = 2048;
+
+private:
+    std::vector<std::string> vob_files;
+    std::vector<int64_t> vob_sizes;
+    std::vector<FILE *> vob_streams;
+    std::vector<Range> ranges;
+    int title_set;
+    int angles;
+
+    std::string error;
+
+
+    bool readIFO(const std::string &path, const char *identifier, std::vector<uint8_t> &ifo);
+
+    bool findTitleSet(const std::string &vmg_path, int title, int &vts, int &vts_title);
+
+    bool findVOBFiles(const std::string &vts_path);
+
+    void closeVOBFiles();
+
+    bool readSector(int64_t sector, uint8_t *buffer);
+
+    bool addInterleavedCell(const Range &cell);
+
+    void addRange(const Range &range);
+
+public:
+    DVDTitle();
+
+    ~DVDTitle();
+
+    static bool isIFOFile(const std::string &name);
+
+    // ifo_path can be VIDEO_TS.IFO, where title counts the titles of the
+    // whole disc, or VTS_xx_0.IFO, where it counts those of one title
+    // set. Both title and angle start at 1.
+    bool open(const std::string &ifo_path, int title, int angle);
+
+    const std::vector<std::string> &getVOBFiles() const;
+
+    const std::vector<Range> &getRanges() const;
+
+    int getTitleSet() const;
+
+    int getAngles() const;
+
+    const std::string &getError() const;
+};
+
+
+#endif // D2V_WITCH_DVDTITLE_H
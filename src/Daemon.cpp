@@ -0,0 +1,416 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "Daemon.h"
+#include "JSON.h"
+
+
+volatile int Daemon::stop_requested = 0;
+
+
+Daemon::Daemon(const std::vector<std::string> &_directories, int _workers, int _stable_seconds, const std::string &_control_socket, D2V::LoggingFunction _log_message)
+    : directories(_directories)
+    , workers(_workers)
+    , stable_seconds(_stable_seconds)
+    , control_socket(_control_socket)
+    , log_message(_log_message)
+    , next_sequence(0)
+    , done(0)
+    , failed(0)
+    , stopping(false)
+{ }
+
+
+bool Daemon::isMPEGFile(const std::string &name) {
+    static const char *extensions[] = {
+        ".mpg", ".mpeg", ".m1v", ".m2v", ".mpv", ".m2p", ".vob", ".ts", ".m2ts", ".mts", ".tp", ".trp"
+    };
+
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos)
+        return false;
+
+    std::string extension = name.substr(dot);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++)
+        if (extension == extensions[i])
+            return true;
+
+    return false;
+}
+
+
+void Daemon::signalHandler(int) {
+    stop_requested = 1;
+}
+
+
+void Daemon::log(const std::string &message) {
+    if (log_message)
+        log_message(message);
+}
+
+
+const std::string &Daemon::getError() const {
+    return error;
+}
+
+
+std::string Daemon::getStatus() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::string status = "{\"pending\":" + std::to_string(pending.size());
+    status += ",\"queued\":" + std::to_string(queue.size());
+    status += ",\"workers\":" + std::to_string(workers);
+
+    status += ",\"running\":[";
+    for (size_t i = 0; i < running.size(); i++) {
+        if (i)
+            status += ",";
+        status += "\"" + escapeJSON(running[i]) + "\"";
+    }
+    status += "]";
+
+    status += ",\"done\":" + std::to_string(done);
+    status += ",\"failed\":" + std::to_string(failed);
+
+    status += ",\"recent_failures\":[";
+    for (size_t i = 0; i < failures.size(); i++) {
+        if (i)
+            status += ",";
+        status += "{\"path\":\"" + escapeJSON(failures[i].path) + "\",\"error\":\"" + escapeJSON(failures[i].error) + "\"}";
+    }
+    status += "]";
+
+    status += ",\"stopping\":";
+    status += stopping ? "true" : "false";
+    status += "}\n";
+
+    return status;
+}
+
+
+void Daemon::work() {
+    while (true) {
+        Job job;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            queue_condition.wait(lock, [this] { return stopping || !queue.empty(); });
+
+            if (stopping)
+                return;
+
+            job = queue.top();
+            queue.pop();
+
+            running.push_back(job.path);
+        }
+
+        log("Indexing '" + job.path + "'.");
+
+        std::string err;
+        bool okay = indexFile(job.path, err);
+
+        if (okay)
+            log("Finished '" + job.path + "'.");
+        else
+            log("Failed to index '" + job.path + "': " + err);
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        running.erase(std::find(running.begin(), running.end(), job.path));
+        known.erase(job.path);
+
+        if (okay) {
+            done++;
+        } else {
+            failed++;
+
+            failures.push_back({ job.path, err });
+            if (failures.size() > 10)
+                failures.erase(failures.begin());
+        }
+    }
+}
+
+
+#ifdef __linux__
+
+void Daemon::fileChanged(int directory, const std::string &path) {
+    if (!isMPEGFile(path))
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Queued files are looked at when their turn comes. Files being
+        // indexed right now get indexed again once they stop changing.
+        if (known.count(path) && std::find(running.begin(), running.end(), path) == running.end())
+            return;
+    }
+
+    struct stat st;
+    if (stat(path.c_str(), &st) || !S_ISREG(st.st_mode)) {
+        pending.erase(path);
+        return;
+    }
+
+    auto it = pending.find(path);
+    if (it == pending.end() || it->second.size != st.st_size)
+        pending[path] = { directory, st.st_size, Clock::now() };
+}
+
+
+void Daemon::scanDirectory(int directory) {
+    DIR *dir = opendir(directories[directory].c_str());
+    if (!dir)
+        return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        std::string path = directories[directory] + "/" + entry->d_name;
+
+        if (!isMPEGFile(path))
+            continue;
+
+        // Skip files that were indexed during an earlier run.
+        struct stat st, d2v_st;
+        if (!stat(path.c_str(), &st) &&
+            ((!stat((path + ".d2v").c_str(), &d2v_st) && d2v_st.st_mtime >= st.st_mtime) ||
+             (!stat((path + ".d2v.gz").c_str(), &d2v_st) && d2v_st.st_mtime >= st.st_mtime)))
+            continue;
+
+        fileChanged(directory, path);
+    }
+
+    closedir(dir);
+}
+
+
+void Daemon::enqueueStableFiles() {
+    Clock::time_point now = Clock::now();
+
+    for (auto it = pending.begin(); it != pending.end(); ) {
+        struct stat st;
+        if (stat(it->first.c_str(), &st)) {
+            it = pending.erase(it);
+            continue;
+        }
+
+        if (st.st_size != it->second.size) {
+            it->second.size = st.st_size;
+            it->second.last_change = now;
+        }
+
+        if (now - it->second.last_change < std::chrono::seconds(stable_seconds)) {
+            it++;
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (known.count(it->first)) {
+                // Still running. Check again later.
+                it++;
+                continue;
+            }
+
+            known.insert(it->first);
+            queue.push({ it->second.directory, next_sequence++, it->first });
+        }
+
+        queue_condition.notify_one();
+
+        it = pending.erase(it);
+    }
+}
+
+
+bool Daemon::run() {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signalHandler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        error = "Failed to initialise inotify: ";
+        error += strerror(errno);
+        return false;
+    }
+
+    for (size_t i = 0; i < directories.size(); i++) {
+        int wd = inotify_add_watch(inotify_fd, directories[i].c_str(), IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (wd < 0) {
+            error = "Failed to watch directory '" + directories[i] + "': " + strerror(errno);
+            close(inotify_fd);
+            return false;
+        }
+
+        watch_descriptors.insert({ wd, (int)i });
+    }
+
+    int socket_fd = -1;
+    if (control_socket.size()) {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+
+        if (control_socket.size() >= sizeof(address.sun_path)) {
+            error = "Control socket path '" + control_socket + "' is too long.";
+            close(inotify_fd);
+            return false;
+        }
+
+        strcpy(address.sun_path, control_socket.c_str());
+
+        unlink(control_socket.c_str());
+
+        socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (socket_fd < 0 ||
+            bind(socket_fd, (struct sockaddr *)&address, sizeof(address)) ||
+            listen(socket_fd, 8)) {
+            error = "Failed to create control socket '" + control_socket + "': " + strerror(errno);
+            if (socket_fd >= 0)
+                close(socket_fd);
+            close(inotify_fd);
+            return false;
+        }
+    }
+
+    for (int i = 0; i < workers; i++)
+        threads.push_back(std::thread(&Daemon::work, this));
+
+    for (size_t i = 0; i < directories.size(); i++)
+        scanDirectory(i);
+
+    log("Watching " + std::to_string(directories.size()) + " directories.");
+
+    while (!stop_requested) {
+        struct pollfd fds[2] = {
+            { inotify_fd, POLLIN, 0 },
+            { socket_fd, POLLIN, 0 }
+        };
+
+        int ret = poll(fds, socket_fd >= 0 ? 2 : 1, 500);
+        if (ret < 0 && errno != EINTR) {
+            error = "poll() failed: ";
+            error += strerror(errno);
+            break;
+        }
+
+        if (ret > 0 && (fds[0].revents & POLLIN)) {
+            alignas(struct inotify_event) char buffer[4096];
+
+            ssize_t length;
+            while ((length = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+                for (char *ptr = buffer; ptr < buffer + length; ) {
+                    const struct inotify_event *event = (const struct inotify_event *)ptr;
+                    ptr += sizeof(struct inotify_event) + event->len;
+
+                    if (event->mask & IN_Q_OVERFLOW) {
+                        for (size_t i = 0; i < directories.size(); i++)
+                            scanDirectory(i);
+                        continue;
+                    }
+
+                    auto wd = watch_descriptors.find(event->wd);
+                    if (wd == watch_descriptors.end() || !event->len)
+                        continue;
+
+                    fileChanged(wd->second, directories[wd->second] + "/" + event->name);
+                }
+            }
+        }
+
+        if (ret > 0 && socket_fd >= 0 && (fds[1].revents & POLLIN)) {
+            int client = accept(socket_fd, nullptr, nullptr);
+            if (client >= 0) {
+                std::string status = getStatus();
+                send(client, status.c_str(), status.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+                close(client);
+            }
+        }
+
+        enqueueStableFiles();
+    }
+
+    if (stop_requested)
+        log("Stopping after the files being indexed now.");
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queue_condition.notify_all();
+
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    threads.clear();
+
+    if (socket_fd >= 0) {
+        close(socket_fd);
+        unlink(control_socket.c_str());
+    }
+    close(inotify_fd);
+
+    return !error.size();
+}
+
+#else // __linux__
+
+void Daemon::fileChanged(int, const std::string &) {
+}
+
+
+void Daemon::scanDirectory(int) {
+}
+
+
+void Daemon::enqueueStableFiles() {
+}
+
+
+bool Daemon::run() {
+    error = "Watching directories is only supported on Linux.";
+    return false;
+}
+
+#endif // __linux__
@@ -0,0 +1,132 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+#ifndef D2V_WITCH_DAEMON_H
+#define D2V_WITCH_DAEMON_H
+
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "D2V.h"
+
+
+// Watches some directories for new MPEG files and indexes each of them
+// once its size stopped changing. Subclasses do the actual indexing.
+//
+// Only implemented for Linux (inotify).
+class Daemon {
+    typedef std::chrono::steady_clock Clock;
+
+    struct PendingFile {
+        int directory;
+        int64_t size;
+        Clock::time_point last_change;
+    };
+
+    struct Job {
+        int directory;
+        uint64_t sequence;
+        std::string path;
+
+        // Earlier directories on the command line go first, then the
+        // files in the order they became stable.
+        bool operator<(const Job &other) const {
+            if (directory != other.directory)
+                return directory > other.directory;
+            return sequence > other.sequence;
+        }
+    };
+
+    struct Failure {
+        std::string path;
+        std::string error;
+    };
+
+    std::vector<std::string> directories;
+    int workers;
+    int stable_seconds;
+    std::string control_socket;
+    D2V::LoggingFunction log_message;
+
+    // Only touched by the thread that called run().
+    std::unordered_map<std::string, PendingFile> pending;
+    std::unordered_map<int, int> watch_descriptors;
+    uint64_t next_sequence;
+
+    // Shared with the workers.
+    std::mutex mutex;
+    std::condition_variable queue_condition;
+    std::priority_queue<Job> queue;
+    std::unordered_set<std::string> known; // queued or running
+    std::vector<std::string> running;
+    int done;
+    std::vector<Failure> failures;
+    int failed;
+    bool stopping;
+
+    std::vector<std::thread> threads;
+
+    std::string error;
+
+    static volatile int stop_requested;
+
+
+    static void signalHandler(int signum);
+
+    void log(const std::string &message);
+
+    void fileChanged(int directory, const std::string &path);
+
+    void scanDirectory(int directory);
+
+    void enqueueStableFiles();
+
+    std::string getStatus();
+
+    void work();
+
+protected:
+    // Called from the worker threads, possibly several at once.
+    virtual bool indexFile(const std::string &path, std::string &err) = 0;
+
+public:
+    static bool isMPEGFile(const std::string &name);
+
+    Daemon(const std::vector<std::string> &_directories, int _workers, int _stable_seconds, const std::string &_control_socket, D2V::LoggingFunction _log_message);
+
+    virtual ~Daemon() = default;
+
+    // Returns after SIGINT or SIGTERM, once the files being indexed are
+    // finished. Files still waiting are picked up again on the next run.
+    bool run();
+
+    const std::string &getError() const;
+};
+
+
+#endif // D2V_WITCH_DAEMON_H
@@ -0,0 +1,145 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+#include <cinttypes>
+
+#include "DamageReport.h"
+#include "JSON.h"
+
+
+DamageReport::DamageReport(const FakeFile &_fake_file)
+    : fake_file(_fake_file)
+    , regions{ }
+    , region_open(false)
+{ }
+
+
+DamageReport::Region &DamageReport::openRegion(int64_t position, int line_number) {
+    if (!region_open) {
+        Region region;
+        region.start = position;
+        region.end = -1;
+        region.skipped_bytes = 0;
+        region.bad_pictures = 0;
+        region.dropped_pictures = 0;
+        region.resyncs = 0;
+        region.last_line_before = line_number;
+        region.first_line_after = -1;
+
+        regions.push_back(region);
+        region_open = true;
+    }
+
+    return regions.back();
+}
+
+
+void DamageReport::badPicture(int64_t position, int line_number, const std::string &problem) {
+    Region &region = openRegion(position, line_number);
+
+    region.bad_pictures++;
+    if (!region.problem.size())
+        region.problem = problem;
+}
+
+
+void DamageReport::droppedPicture(int64_t position, int line_number) {
+    openRegion(position, line_number).dropped_pictures++;
+}
+
+
+void DamageReport::skipped(int64_t from, int64_t to, int line_number) {
+    Region &region = openRegion(from, line_number);
+
+    region.skipped_bytes += to - from;
+    region.resyncs++;
+}
+
+
+void DamageReport::lineStarted(int64_t position, int line_number) {
+    if (!region_open)
+        return;
+
+    regions.back().end = position;
+    regions.back().first_line_after = line_number;
+    region_open = false;
+}
+
+
+const std::vector<DamageReport::Region> &DamageReport::getRegions() const {
+    return regions;
+}
+
+
+const std::string &DamageReport::getError() const {
+    return error;
+}
+
+
+bool DamageReport::write(FILE *file) {
+    int64_t skipped_bytes = 0;
+    int bad_pictures = 0;
+    int dropped_pictures = 0;
+    int resyncs = 0;
+
+    std::string json = "{\n  \"regions\": [";
+
+    for (size_t i = 0; i < regions.size(); i++) {
+        const Region &region = regions[i];
+
+        skipped_bytes += region.skipped_bytes;
+        bad_pictures += region.bad_pictures;
+        dropped_pictures += region.dropped_pictures;
+        resyncs += region.resyncs;
+
+        char text[1024];
+        snprintf(text, sizeof(text),
+                 "%s\n    { \"start\": %" PRId64 ", \"end\": %" PRId64
+                 ", \"file\": %d, \"file_position\": %" PRId64
+                 ", \"skipped_bytes\": %" PRId64 ", \"bad_pictures\": %d, \"dropped_pictures\": %d, \"resyncs\": %d"
+                 ", \"last_line_before\": %d, \"first_line_after\": %d, \"problem\": \"",
+                 i ? "," : "",
+                 region.start,
+                 region.end,
+                 fake_file.getFileIndex(region.start),
+                 fake_file.getPositionInRealFile(region.start),
+                 region.skipped_bytes,
+                 region.bad_pictures,
+                 region.dropped_pictures,
+                 region.resyncs,
+                 region.last_line_before,
+                 region.first_line_after);
+
+        json += text;
+        json += escapeJSON(region.problem) + "\" }";
+    }
+
+    json += regions.size() ? "\n  ],\n" : "],\n";
+    json += "  \"bad_pictures\": " + std::to_string(bad_pictures) + ",\n";
+    json += "  \"dropped_pictures\": " + std::to_string(dropped_pictures) + ",\n";
+    json += "  \"skipped_bytes\": " + std::to_string(skipped_bytes) + ",\n";
+    json += "  \"resyncs\": " + std::to_string(resyncs) + "\n";
+    json += "}\n";
+
+    if (fwrite(json.data(), 1, json.size(), file) < json.size()) {
+        error = "Failed to write the damage report: fwrite() failed.";
+        return false;
+    }
+
+    return true;
+}
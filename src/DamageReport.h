@@ -0,0 +1,89 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#ifndef D2V_WITCH_DAMAGEREPORT_H
+#define D2V_WITCH_DAMAGEREPORT_H
+
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "FakeFile.h"
+
+
+// Collects what was lost to damaged data while indexing, and writes it as
+// JSON.
+//
+// A damaged region starts with the first picture that had to be skipped
+// and ends with the next I picture that starts a data line. The data line
+// that was being filled when the damage started is affected too, because
+// its last pictures may refer to the skipped ones.
+class DamageReport {
+public:
+    struct Region {
+        int64_t start;
+        // -1 if the input ended first.
+        int64_t end;
+        int64_t skipped_bytes;
+        int bad_pictures;
+        int dropped_pictures;
+        int resyncs;
+        // -1 if there was none.
+        int last_line_before;
+        int first_line_after;
+        std::string problem;
+    };
+
+    DamageReport(const FakeFile &_fake_file);
+
+    // A picture that couldn't be indexed.
+    void badPicture(int64_t position, int line_number, const std::string &problem);
+
+    // A picture thrown away while waiting for the next I picture after
+    // jumping over damaged data.
+    void droppedPicture(int64_t position, int line_number);
+
+    // Bytes jumped over.
+    void skipped(int64_t from, int64_t to, int line_number);
+
+    void lineStarted(int64_t position, int line_number);
+
+    const std::vector<Region> &getRegions() const;
+
+    bool write(FILE *file);
+
+    const std::string &getError() const;
+
+private:
+    const FakeFile &fake_file;
+
+    std::vector<Region> regions;
+    bool region_open;
+
+    std::string error;
+
+
+    Region &openRegion(int64_t position, int line_number);
+};
+
+
+#endif // D2V_WITCH_DAMAGEREPORT_H
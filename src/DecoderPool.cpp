@@ -0,0 +1,227 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#include "DecoderPool.h"
+#include "FFMPEG.h"
+
+
+DecoderPool::DecoderPool(AVCodecID _codec_id, const uint8_t *_extradata, int _extradata_size, int _threads)
+    : codec_id(_codec_id)
+    , extradata{ }
+    , threads(_threads)
+    , jobs{ }
+    , finishing(false)
+    , workers{ }
+    , trace(nullptr)
+    , error{ }
+{
+    if (_extradata && _extradata_size > 0)
+        extradata.assign(_extradata, _extradata + _extradata_size);
+
+    if (threads < 1)
+        threads = 1;
+}
+
+
+DecoderPool::~DecoderPool() {
+    // The derived class must call finish() in its own destructor,
+    // because the workers call its member functions.
+    finish();
+}
+
+
+void DecoderPool::start() {
+    for (int i = 0; i < threads; i++)
+        workers.push_back(std::thread(&DecoderPool::work, this, i));
+}
+
+
+bool DecoderPool::submit(int line_number, int expected_frames, const std::vector<AVPacket *> &packets) {
+    {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (error.size())
+            return false;
+    }
+
+    Job job;
+    job.line_number = line_number;
+    job.expected_frames = expected_frames;
+
+    for (size_t i = 0; i < packets.size(); i++) {
+        AVPacket copy;
+        av_init_packet(&copy);
+
+        if (av_copy_packet(&copy, packets[i]) < 0) {
+            for (size_t j = 0; j < job.packets.size(); j++)
+                av_free_packet(&job.packets[j]);
+
+            setError("Failed to copy a packet for the decoder threads: av_copy_packet() failed.");
+            return false;
+        }
+
+        job.packets.push_back(copy);
+    }
+
+    std::unique_lock<std::mutex> lock(jobs_mutex);
+
+    jobs_consumed.wait(lock, [this] { return jobs.size() < (size_t)threads * 2; });
+
+    jobs.push_back(std::move(job));
+
+    jobs_available.notify_one();
+
+    return true;
+}
+
+
+bool DecoderPool::finish() {
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        finishing = true;
+        jobs_available.notify_all();
+    }
+
+    for (size_t i = 0; i < workers.size(); i++)
+        if (workers[i].joinable())
+            workers[i].join();
+
+    std::lock_guard<std::mutex> lock(error_mutex);
+    return !error.size();
+}
+
+
+void DecoderPool::setTrace(Trace *_trace) {
+    trace = _trace;
+}
+
+
+const std::string &DecoderPool::getError() const {
+    return error;
+}
+
+
+bool DecoderPool::finishJob(const Job &job, int decoded_frames, std::string &err) {
+    (void)job;
+    (void)decoded_frames;
+    (void)err;
+
+    return true;
+}
+
+
+void DecoderPool::setError(const std::string &err) {
+    std::lock_guard<std::mutex> lock(error_mutex);
+
+    // Only the first error is interesting.
+    if (!error.size())
+        error = err;
+}
+
+
+void DecoderPool::work(int worker) {
+    FFMPEG f;
+
+    bool thread_named = false;
+
+    bool decoder_okay = f.initCodec(codec_id, extradata.data(), extradata.size());
+    if (!decoder_okay)
+        setError("Failed to initialise the decoder: " + f.getError());
+
+    AVFrame *frame = av_frame_alloc();
+    if (!frame) {
+        setError("Failed to allocate AVFrame for the decoder.");
+        decoder_okay = false;
+    }
+
+    while (true) {
+        Job job;
+
+        {
+            std::unique_lock<std::mutex> lock(jobs_mutex);
+
+            jobs_available.wait(lock, [this] { return jobs.size() || finishing; });
+
+            if (!jobs.size())
+                break;
+
+            job = std::move(jobs.front());
+            jobs.pop_front();
+
+            jobs_consumed.notify_one();
+        }
+
+        if (trace && !thread_named) {
+            trace->setThreadName("decoder " + std::to_string(worker));
+            thread_named = true;
+        }
+
+        // Jobs must still be taken out of the queue after an error,
+        // otherwise submit() could wait forever.
+        if (decoder_okay) {
+            TraceScope scope(trace, "decode", "DecoderPool job");
+
+            int decoded_frames = 0;
+            bool okay = true;
+            std::string err;
+
+            for (size_t i = 0; i <= job.packets.size() && okay; i++) {
+                AVPacket flush_packet;
+                av_init_packet(&flush_packet);
+                flush_packet.data = nullptr;
+                flush_packet.size = 0;
+
+                // The last iteration drains the decoder.
+                bool draining = i == job.packets.size();
+                AVPacket *packet = draining ? &flush_packet : &job.packets[i];
+
+                int got_frame;
+
+                do {
+                    got_frame = 0;
+
+                    // Errors in individual packets are not fatal. It's what the decoder does with them.
+                    if (avcodec_decode_video2(f.avctx, frame, &got_frame, packet) < 0)
+                        break;
+
+                    if (got_frame) {
+                        okay = handleFrame(job, decoded_frames, frame, err);
+                        decoded_frames++;
+                        av_frame_unref(frame);
+                    }
+                } while (draining && got_frame && okay);
+            }
+
+            avcodec_flush_buffers(f.avctx);
+
+            if (okay)
+                okay = finishJob(job, decoded_frames, err);
+
+            if (!okay) {
+                setError(err);
+                decoder_okay = false;
+            }
+        }
+
+        for (size_t i = 0; i < job.packets.size(); i++)
+            av_free_packet(&job.packets[i]);
+    }
+
+    av_frame_free(&frame);
+}
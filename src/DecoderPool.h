@@ -0,0 +1,104 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#ifndef D2V_WITCH_DECODERPOOL_H
+#define D2V_WITCH_DECODERPOOL_H
+
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include "Trace.h"
+
+
+// Decodes groups of video packets on a few threads, so that the indexing
+// loop doesn't have to wait for the decoder. Each job is decoded from a
+// flushed decoder, as if it were the result of a seek.
+class DecoderPool {
+public:
+    struct Job {
+        int line_number;
+        int expected_frames;
+        std::vector<AVPacket> packets;
+
+        Job()
+            : line_number(0)
+            , expected_frames(0)
+            , packets{ }
+        { }
+    };
+
+    DecoderPool(AVCodecID _codec_id, const uint8_t *_extradata, int _extradata_size, int _threads);
+    virtual ~DecoderPool();
+
+    // Copies the packets, so the caller can free them right away.
+    bool submit(int line_number, int expected_frames, const std::vector<AVPacket *> &packets);
+
+    // Must be called before the first job is submitted.
+    void setTrace(Trace *_trace);
+
+    // Waits for all the jobs to be done.
+    bool finish();
+
+    const std::string &getError() const;
+
+protected:
+    // Called from the worker threads, once for every frame the decoder returns.
+    virtual bool handleFrame(const Job &job, int frame_number, const AVFrame *frame, std::string &err) = 0;
+
+    // Called from the worker threads after all the job's frames were returned.
+    virtual bool finishJob(const Job &job, int decoded_frames, std::string &err);
+
+    void start();
+
+private:
+    AVCodecID codec_id;
+    std::vector<uint8_t> extradata;
+    int threads;
+
+    std::deque<Job> jobs;
+    bool finishing;
+    std::mutex jobs_mutex;
+    std::condition_variable jobs_available;
+    std::condition_variable jobs_consumed;
+    std::vector<std::thread> workers;
+
+    Trace *trace;
+
+    std::mutex error_mutex;
+    std::string error;
+
+
+    void setError(const std::string &err);
+
+    void work(int worker);
+};
+
+
+#endif // D2V_WITCH_DECODERPOOL_H
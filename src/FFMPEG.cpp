@@ -18,6 +18,8 @@ SOFTWARE.
 */
 
 
+#include <cstring>
+
 #include "FFMPEG.h"
 
 
@@ -87,7 +89,7 @@ bool FFMPEG::initFormat(FakeFile &fake_file) {
 }
 
 
-bool FFMPEG::initCodec(AVCodecID video_codec_id) {
+bool FFMPEG::initCodec(AVCodecID video_codec_id, const uint8_t *extradata, int extradata_size) {
     avcodec = avcodec_find_decoder(video_codec_id);
     if (!avcodec) {
         error = "Couldn't find decoder for ";
@@ -101,6 +103,17 @@ bool FFMPEG::initCodec(AVCodecID video_codec_id) {
         return false;
     }
 
+    if (extradata && extradata_size > 0) {
+        avctx->extradata = (uint8_t *)av_mallocz(extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+        if (!avctx->extradata) {
+            error = "Couldn't allocate " + std::to_string(extradata_size) + " bytes for the extradata.";
+            return false;
+        }
+
+        memcpy(avctx->extradata, extradata, extradata_size);
+        avctx->extradata_size = extradata_size;
+    }
+
     if (avcodec_open2(avctx, avcodec, nullptr) < 0) {
         error = "Couldn't open AVCodecContext.";
         return false;
@@ -32,6 +32,11 @@ extern "C" {
 #include "FakeFile.h"
 
 
+#ifndef AV_INPUT_BUFFER_PADDING_SIZE
+#define AV_INPUT_BUFFER_PADDING_SIZE FF_INPUT_BUFFER_PADDING_SIZE
+#endif
+
+
 class FFMPEG {
     uint8_t *io_buffer;
 
@@ -49,7 +54,9 @@ public:
 
     bool initFormat(FakeFile &fake_file);
 
-    bool initCodec(AVCodecID video_codec_id);
+    // The extradata usually holds the sequence header, which the decoder
+    // needs when it doesn't start at the beginning of the stream.
+    bool initCodec(AVCodecID video_codec_id, const uint8_t *extradata = nullptr, int extradata_size = 0);
 
     void cleanup();
 };
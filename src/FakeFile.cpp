@@ -18,19 +18,137 @@ SOFTWARE.
 */
 
 
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
 extern "C" {
 #include <libavformat/avformat.h>
 }
 
 #include "FakeFile.h"
+#include "SPSCQueue.h"
 
 #include "Bullshit.h"
 
 
+struct FakeFile::ReadAhead {
+    struct Block {
+        std::vector<uint8_t> data;
+        // Empty unless reading failed. An empty block without an error
+        // means the end of the files.
+        std::string error;
+    };
+
+    SPSCQueue<Block> blocks;
+    std::thread reader;
+
+    // The block being consumed.
+    Block current;
+    size_t current_offset;
+
+    ReadAhead(size_t queue_length)
+        : blocks(queue_length)
+        , reader{ }
+        , current{ }
+        , current_offset(0)
+    { }
+};
+
+
+FakeFile::FakeFile()
+    : total_size(0)
+    , current_position(0)
+    , ranges{ }
+    , extents{ }
+    , current_extent(0)
+    , current_extent_offset(0)
+    , hasher(nullptr)
+    , trace(nullptr)
+    , throttle(nullptr)
+    , health_monitor(nullptr)
+    , read_ahead_block_size(0)
+    , read_ahead_blocks(0)
+    , read_ahead{ }
+{ }
+
+
+FakeFile::~FakeFile() {
+    stopReadAhead();
+}
+
+
+void FakeFile::addRange(int64_t start, int64_t size, int vob, int cell) {
+    ranges.push_back({ -1, start, 0, size, vob, cell });
+}
+
+
+bool FakeFile::buildExtents() {
+    extents.clear();
+    total_size = 0;
+
+    if (!ranges.size()) {
+        for (size_t i = 0; i < this->size(); i++) {
+            extents.push_back({ (int)i, 0, total_size, at(i).size, 0, 0 });
+            total_size += at(i).size;
+        }
+
+        return true;
+    }
+
+    for (auto range = ranges.cbegin(); range != ranges.cend(); range++) {
+        int64_t start = range->start;
+        int64_t size = range->size;
+        int64_t file_start = 0;
+
+        for (size_t i = 0; i < this->size() && size > 0; i++) {
+            int64_t file_end = file_start + at(i).size;
+
+            if (start < file_end) {
+                int64_t piece = std::min(size, file_end - start);
+
+                extents.push_back({ (int)i, start - file_start, total_size, piece, range->vob, range->cell });
+                total_size += piece;
+
+                start += piece;
+                size -= piece;
+            }
+
+            file_start = file_end;
+        }
+
+        if (size > 0) {
+            error = "Range of " + std::to_string(range->size) + " bytes at " + std::to_string(range->start) + " goes past the end of the input files.";
+            return false;
+        }
+    }
+
+    if (!extents.size()) {
+        error = "The ranges to read are all empty.";
+        return false;
+    }
+
+    return true;
+}
+
+
+int FakeFile::findExtent(int64_t position) const {
+    if (position < 0 || position >= total_size)
+        return -1;
+
+    auto it = std::upper_bound(extents.cbegin(), extents.cend(), position, [] (int64_t pos, const FileExtent &extent) {
+        return pos < extent.position;
+    });
+
+    return (int)(it - extents.cbegin()) - 1;
+}
+
+
 bool FakeFile::open() {
     total_size = 0;
     current_position = 0;
-    current_file = begin();
+    current_extent = 0;
+    current_extent_offset = 0;
 
     auto it = begin();
     for ( ; it != end(); it++) {
@@ -59,8 +177,6 @@ bool FakeFile::open() {
             error += strerror(errno);
             break;
         }
-
-        total_size += it->size;
     }
 
     if (error.size()) {
@@ -68,11 +184,22 @@ bool FakeFile::open() {
         return false;
     }
 
+    if (!buildExtents())
+        return false;
+
+    if (extents.size() && fseeko(at(extents[0].file).stream, extents[0].start, SEEK_SET)) {
+        error = "Failed to seek to the first range: ";
+        error += strerror(errno);
+        return false;
+    }
+
     return true;
 }
 
 
 void FakeFile::close() {
+    stopReadAhead();
+
     for (auto it = begin(); it != end(); it++) {
         if (it->stream) {
             fclose(it->stream);
@@ -98,26 +225,179 @@ const std::string &FakeFile::getError() const {
 
 
 int FakeFile::getFileIndex(int64_t position) const {
-    for (size_t i = 0; i < size(); i++) {
-        if (position < at(i).size)
-            return i;
-        else
-            position -= at(i).size;
-    }
+    int extent = findExtent(position);
+    if (extent < 0)
+        return -1;
 
-    return -1;
+    return extents[extent].file;
 }
 
 
 int64_t FakeFile::getPositionInRealFile(int64_t position) const {
-    for (size_t i = 0; i < size(); i++) {
-        if (position < at(i).size)
-            return position;
-        else
-            position -= at(i).size;
+    int extent = findExtent(position);
+    if (extent < 0)
+        return -1;
+
+    return extents[extent].start + position - extents[extent].position;
+}
+
+
+int FakeFile::getVobId(int64_t position) const {
+    int extent = findExtent(position);
+    if (extent < 0)
+        return 0;
+
+    return extents[extent].vob;
+}
+
+
+int FakeFile::getCellId(int64_t position) const {
+    int extent = findExtent(position);
+    if (extent < 0)
+        return 0;
+
+    return extents[extent].cell;
+}
+
+
+void FakeFile::setHasher(Hasher *_hasher) {
+    hasher = _hasher;
+}
+
+
+void FakeFile::setTrace(Trace *_trace) {
+    trace = _trace;
+}
+
+
+void FakeFile::setThrottle(Throttle *_throttle) {
+    throttle = _throttle;
+}
+
+
+void FakeFile::setHealthMonitor(HealthMonitor *_health_monitor) {
+    health_monitor = _health_monitor;
+}
+
+
+void FakeFile::setReadAhead(size_t block_size, size_t blocks) {
+    stopReadAhead();
+
+    read_ahead_block_size = block_size;
+    read_ahead_blocks = blocks;
+}
+
+
+bool FakeFile::startReadAhead() {
+    // The reader thread may have left the real files anywhere.
+    if (seek(this, current_position, SEEK_SET) < 0)
+        return false;
+
+    read_ahead.reset(new ReadAhead(read_ahead_blocks));
+
+    ReadAhead *ra = read_ahead.get();
+
+    ra->reader = std::thread([this, ra] {
+        if (trace)
+            trace->setThreadName("reader");
+
+        while (true) {
+            ReadAhead::Block block;
+            block.data.resize(read_ahead_block_size);
+
+            int bytes_read;
+            {
+                TraceScope scope(trace, "io", "FakeFile read-ahead");
+                bytes_read = readFromFiles(block.data.data(), block.data.size(), block.error);
+            }
+
+            block.data.resize(bytes_read > 0 ? bytes_read : 0);
+
+            bool last = bytes_read <= 0;
+
+            if (!ra->blocks.push(block) || last)
+                break;
+        }
+
+        ra->blocks.close();
+    });
+
+    return true;
+}
+
+
+void FakeFile::stopReadAhead() {
+    if (!read_ahead)
+        return;
+
+    read_ahead->blocks.abort();
+    read_ahead->reader.join();
+    read_ahead.reset();
+}
+
+
+int FakeFile::readFromReadAhead(uint8_t *buf, int bytes_to_read) {
+    if (!read_ahead && !startReadAhead())
+        return -1;
+
+    ReadAhead *ra = read_ahead.get();
+
+    int bytes_read = 0;
+
+    while (bytes_read < bytes_to_read) {
+        if (ra->current_offset == ra->current.data.size()) {
+            if (!ra->blocks.pop(ra->current))
+                break;
+
+            ra->current_offset = 0;
+
+            if (ra->current.error.size()) {
+                error = ra->current.error;
+                return -1;
+            }
+
+            if (!ra->current.data.size())
+                break;
+        }
+
+        size_t bytes = std::min((size_t)(bytes_to_read - bytes_read), ra->current.data.size() - ra->current_offset);
+        memcpy(buf + bytes_read, ra->current.data.data() + ra->current_offset, bytes);
+
+        ra->current_offset += bytes;
+        bytes_read += bytes;
     }
 
-    return -1;
+    return bytes_read;
+}
+
+
+bool FakeFile::finishHashing() {
+    if (!hasher)
+        return true;
+
+    if (hasher->getHashedSize() < total_size) {
+        if (seek(this, hasher->getHashedSize(), SEEK_SET) < 0) {
+            error = "Failed to seek while hashing: " + error;
+            return false;
+        }
+
+        std::vector<uint8_t> buffer(1024 * 1024);
+
+        while (hasher->getHashedSize() < total_size) {
+            int bytes_read = readPacket(this, buffer.data(), buffer.size());
+            if (bytes_read < 0) {
+                error = "Failed to read while hashing: " + error;
+                return false;
+            } else if (bytes_read == 0) {
+                error = "Failed to read while hashing: unexpected end of file.";
+                return false;
+            }
+        }
+    }
+
+    hasher->finish();
+
+    return true;
 }
 
 
@@ -127,9 +407,13 @@ int64_t FakeFile::seek(void *opaque, int64_t offset, int whence) {
 
     FakeFile *ff = (FakeFile *)opaque;
 
-    if (whence == AVSEEK_SIZE) {
+    if (whence == AVSEEK_SIZE)
         return ff->total_size;
-    } else if (whence == SEEK_SET) {
+
+    // The reader thread uses the real files.
+    ff->stopReadAhead();
+
+    if (whence == SEEK_SET) {
     } else if (whence == SEEK_CUR) {
         offset += ff->current_position;
     } else if (whence == SEEK_END) {
@@ -139,64 +423,104 @@ int64_t FakeFile::seek(void *opaque, int64_t offset, int whence) {
         return -1;
     }
 
-    int64_t offset_in_current_file = offset;
+    int extent = ff->findExtent(offset);
+    if (extent < 0)
+        extent = offset < 0 ? 0 : ff->extents.size() - 1;
 
-    if (offset_in_current_file >= ff->total_size) {
-        ff->current_file = ff->cend();
-        ff->current_file--;
-        offset_in_current_file = offset - ff->total_size + ff->crbegin()->size;
-    } else {
-        for (auto it = ff->begin(); it != ff->cend(); it++) {
-            if (offset_in_current_file < it->size) {
-                ff->current_file = it;
-                break;
-            } else {
-                offset_in_current_file -= it->size;
-            }
-        }
-    }
+    const FileExtent &e = ff->extents[extent];
 
-    if (fseeko(ff->current_file->stream, offset_in_current_file, SEEK_SET)) {
+    if (fseeko(ff->at(e.file).stream, e.start + offset - e.position, SEEK_SET)) {
         ff->error = strerror(errno);
         return -1;
     }
 
+    ff->current_extent = extent;
+    ff->current_extent_offset = offset - e.position;
+
     ff->current_position = offset;
     return 0;
 }
 
 
-int FakeFile::readPacket(void *opaque, uint8_t *buf, int bytes_to_read) {
-    FakeFile *ff = (FakeFile *)opaque;
+int FakeFile::readFromFiles(uint8_t *buf, int bytes_to_read, std::string &err) {
+    if (!throttle)
+        return readFromStreams(buf, bytes_to_read, err);
+
+    throttle->acquire(bytes_to_read);
+
+    Throttle::Clock::time_point start = Throttle::Clock::now();
 
-    size_t bytes_read = fread(buf, 1, bytes_to_read, ff->current_file->stream);
+    int bytes_read = readFromStreams(buf, bytes_to_read, err);
 
-    if (bytes_read < (size_t)bytes_to_read) {
-        if (ferror(ff->current_file->stream)) {
-            ff->error = "fread() failed.";
+    if (bytes_read > 0)
+        throttle->finishRead(bytes_read, Throttle::Clock::now() - start);
+
+    return bytes_read;
+}
+
+
+int FakeFile::readFromStreams(uint8_t *buf, int bytes_to_read, std::string &err) {
+    size_t bytes_read = 0;
+
+    while (bytes_read < (size_t)bytes_to_read) {
+        const FileExtent &extent = extents[current_extent];
+        FILE *stream = at(extent.file).stream;
+
+        // Whole files are read to the end, even if they grew since
+        // they were opened.
+        size_t wanted = bytes_to_read - bytes_read;
+        if (ranges.size())
+            wanted = (size_t)std::max((int64_t)0, std::min((int64_t)wanted, extent.size - current_extent_offset));
+
+        size_t got = wanted ? fread(buf + bytes_read, 1, wanted, stream) : 0;
+
+        if (got < wanted && ferror(stream)) {
+            err = "fread() failed.";
             return -1;
         }
 
-        ff->current_file++;
-        if (ff->current_file == ff->cend()) {
-            ff->current_file--;
-        } else {
-            if (fseeko(ff->current_file->stream, 0, SEEK_SET)) {
-                ff->error = strerror(errno);
-                return -1;
-            }
+        bytes_read += got;
+        current_extent_offset += got;
 
-            size_t leftover = bytes_to_read - bytes_read;
-            size_t bytes_read2 = fread(buf + bytes_read, 1, leftover, ff->current_file->stream);
+        if (bytes_read == (size_t)bytes_to_read || current_extent + 1 == extents.size())
+            break;
 
-            if (bytes_read2 < leftover && ferror(ff->current_file->stream)) {
-                ff->error = "fread() failed.";
-                return -1;
-            }
+        current_extent++;
+        current_extent_offset = 0;
 
-            bytes_read += bytes_read2;
+        if (fseeko(at(extents[current_extent].file).stream, extents[current_extent].start, SEEK_SET)) {
+            err = strerror(errno);
+            return -1;
         }
     }
 
     return (int)bytes_read;
 }
+
+
+int FakeFile::readPacket(void *opaque, uint8_t *buf, int bytes_to_read) {
+    FakeFile *ff = (FakeFile *)opaque;
+
+    TraceScope scope(ff->trace, "io", "FakeFile::readPacket");
+
+    int bytes_read;
+    if (ff->read_ahead_blocks > 0)
+        bytes_read = ff->readFromReadAhead(buf, bytes_to_read);
+    else
+        bytes_read = ff->readFromFiles(buf, bytes_to_read, ff->error);
+
+    if (bytes_read < 0)
+        return -1;
+
+    if (ff->hasher)
+        ff->hasher->feed(ff->current_position, buf, bytes_read);
+
+    if (ff->health_monitor && !ff->health_monitor->feed(ff->current_position, buf, bytes_read)) {
+        ff->error = ff->health_monitor->getError();
+        return -1;
+    }
+
+    ff->current_position += bytes_read;
+
+    return (int)bytes_read;
+}
@@ -22,9 +22,16 @@ SOFTWARE.
 #define D2V_WITCH_FAKEFILE_H
 
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "Hash.h"
+#include "HealthMonitor.h"
+#include "Throttle.h"
+#include "Trace.h"
+
 
 struct RealFile {
     std::string name;
@@ -39,14 +46,70 @@ struct RealFile {
 };
 
 
+// A piece of one of the real files.
+struct FileExtent {
+    int file;
+    // Where the piece starts in the real file, and in the fake file.
+    int64_t start;
+    int64_t position;
+    int64_t size;
+    // DVD VOB and cell ids, or 0.
+    int vob;
+    int cell;
+};
+
+
 class FakeFile : public std::vector<RealFile> {
+    struct ReadAhead;
+
     int64_t total_size;
     int64_t current_position;
-    const_iterator current_file;
     std::string error;
+    // Parts of the real files to read, as given to addRange, with
+    // positions in the real files taken as one.
+    std::vector<FileExtent> ranges;
+    // What the fake file is made of. Without ranges, the whole of every
+    // real file.
+    std::vector<FileExtent> extents;
+    // Where the real files are being read. Reading and seeking only use
+    // these, because the reader thread reads ahead of current_position.
+    size_t current_extent;
+    int64_t current_extent_offset;
+    Hasher *hasher;
+    Trace *trace;
+    Throttle *throttle;
+    HealthMonitor *health_monitor;
+
+    size_t read_ahead_block_size;
+    size_t read_ahead_blocks;
+    std::unique_ptr<ReadAhead> read_ahead;
+
+
+    // Reads from the real files, starting with current_extent, without
+    // touching current_position or the hasher.
+    int readFromFiles(uint8_t *buf, int bytes_to_read, std::string &err);
+
+    int readFromStreams(uint8_t *buf, int bytes_to_read, std::string &err);
+
+    bool buildExtents();
+
+    // Returns -1 if position is outside the fake file.
+    int findExtent(int64_t position) const;
 
+    bool startReadAhead();
+
+    void stopReadAhead();
+
+    int readFromReadAhead(uint8_t *buf, int bytes_to_read);
 
 public:
+    FakeFile();
+    ~FakeFile();
+
+    // Makes the fake file out of the given ranges of the real files,
+    // taken as one, instead of the whole files. Ranges are read in the
+    // order they are added. Must be called before open().
+    void addRange(int64_t start, int64_t size, int vob, int cell);
 
     bool open();
 
@@ -62,6 +125,30 @@ public:
 
     int64_t getPositionInRealFile(int64_t position) const;
 
+    int getVobId(int64_t position) const;
+
+    int getCellId(int64_t position) const;
+
+    void setHasher(Hasher *_hasher);
+
+    void setTrace(Trace *_trace);
+
+    // Must be called before reading starts.
+    void setThrottle(Throttle *_throttle);
+
+    // Reading fails once the health monitor finds the input unhealthy,
+    // with its diagnosis as the error.
+    void setHealthMonitor(HealthMonitor *_health_monitor);
+
+    // Reads up to blocks blocks of block_size bytes ahead on a separate
+    // thread. Seeking throws away what was read ahead. blocks = 0 turns
+    // it off, which is the default.
+    void setReadAhead(size_t block_size, size_t blocks);
+
+    // Reads whatever the hasher hasn't seen yet, which is normally nothing,
+    // then waits for it to finish.
+    bool finishHashing();
+
     static int64_t seek(void *opaque, int64_t offset, int whence);
 
     static int readPacket(void *opaque, uint8_t *buf, int bytes_to_read);
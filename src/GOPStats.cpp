@@ -0,0 +1,163 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#include <cinttypes>
+
+#include "GOPStats.h"
+#include "MPEGParser.h"
+
+
+GOPStats::GOPStats(FILE *_file, AVRational _frame_rate)
+    : file(_file)
+    , frame_rate(_frame_rate)
+    , error{ }
+    , gop{ }
+    , have_gop(false)
+    , gops(0)
+    , total_bytes(0)
+    , total_fields(0)
+    , total_pictures{ 0, 0, 0, 0 }
+    , peak_bitrate(0)
+    , length_histogram{ }
+    , bitrate_histogram{ }
+{
+    if (frame_rate.num <= 0 || frame_rate.den <= 0)
+        frame_rate = { 25, 1 };
+}
+
+
+const std::string &GOPStats::getError() const {
+    return error;
+}
+
+
+double GOPStats::getBitrate(int64_t bytes, int fields) const {
+    if (!fields)
+        return 0;
+
+    double seconds = (double)fields * frame_rate.den / (2.0 * frame_rate.num);
+
+    return bytes * 8 / seconds;
+}
+
+
+bool GOPStats::printHeader() {
+    if (fprintf(file, "line,file,position,span,bytes,frames,i,p,b,fields,kbps\n") < 0) {
+        error = "Failed to print GOP statistics header: fprintf() failed.";
+        return false;
+    }
+
+    return true;
+}
+
+
+bool GOPStats::printGOP(int64_t next_fake_position) {
+    double bitrate = getBitrate(gop.bytes, gop.fields);
+
+    // The span is how much must be read from the start of the GOP
+    // to reach the start of the next one.
+    if (fprintf(file, "%d,%d,%" PRId64 ",%" PRId64 ",%" PRId64 ",%d,%d,%d,%d,%d,%d\n",
+                gop.line_number,
+                gop.file,
+                gop.position,
+                next_fake_position - gop.fake_position,
+                gop.bytes,
+                gop.frames,
+                gop.pictures[MPEGParser::I_PICTURE],
+                gop.pictures[MPEGParser::P_PICTURE],
+                gop.pictures[MPEGParser::B_PICTURE],
+                gop.fields,
+                (int)(bitrate / 1000)) < 0) {
+        error = "Failed to print GOP statistics: fprintf() failed.";
+        return false;
+    }
+
+    gops++;
+    total_bytes += gop.bytes;
+    total_fields += gop.fields;
+    for (int i = 0; i < 4; i++)
+        total_pictures[i] += gop.pictures[i];
+    if (bitrate > peak_bitrate)
+        peak_bitrate = bitrate;
+
+    length_histogram[gop.frames]++;
+    bitrate_histogram[(int)(bitrate / 1000000)]++;
+
+    return true;
+}
+
+
+bool GOPStats::startGOP(int line_number, int real_file, int64_t position, int64_t fake_position) {
+    if (have_gop && !printGOP(fake_position))
+        return false;
+
+    gop = GOP();
+    gop.line_number = line_number;
+    gop.file = real_file;
+    gop.position = position;
+    gop.fake_position = fake_position;
+    have_gop = true;
+
+    return true;
+}
+
+
+void GOPStats::addPicture(int picture_type, int size, bool repeat_first_field) {
+    // Pictures before the first I picture don't go in the D2V file either.
+    if (!have_gop)
+        return;
+
+    gop.bytes += size;
+    gop.frames++;
+    gop.fields += repeat_first_field ? 3 : 2;
+    if (picture_type >= MPEGParser::I_PICTURE && picture_type <= MPEGParser::B_PICTURE)
+        gop.pictures[picture_type]++;
+}
+
+
+bool GOPStats::finish(int64_t total_size) {
+    if (have_gop && !printGOP(total_size))
+        return false;
+
+    have_gop = false;
+
+    std::string summary;
+
+    summary += "# gops: " + std::to_string(gops) + "\n";
+    summary += "# frames: " + std::to_string(total_pictures[MPEGParser::I_PICTURE] + total_pictures[MPEGParser::P_PICTURE] + total_pictures[MPEGParser::B_PICTURE]) + "\n";
+    summary += "# i/p/b: " + std::to_string(total_pictures[MPEGParser::I_PICTURE]) + "/" + std::to_string(total_pictures[MPEGParser::P_PICTURE]) + "/" + std::to_string(total_pictures[MPEGParser::B_PICTURE]) + "\n";
+    summary += "# average kbps: " + std::to_string((int)(getBitrate(total_bytes, total_fields) / 1000)) + "\n";
+    summary += "# peak kbps: " + std::to_string((int)(peak_bitrate / 1000)) + "\n";
+
+    summary += "# gop length histogram (frames: gops):\n";
+    for (auto it = length_histogram.cbegin(); it != length_histogram.cend(); it++)
+        summary += "#     " + std::to_string(it->first) + ": " + std::to_string(it->second) + "\n";
+
+    summary += "# gop bitrate histogram (Mbps: gops):\n";
+    for (auto it = bitrate_histogram.cbegin(); it != bitrate_histogram.cend(); it++)
+        summary += "#     " + std::to_string(it->first) + "-" + std::to_string(it->first + 1) + ": " + std::to_string(it->second) + "\n";
+
+    if (fprintf(file, "%s", summary.c_str()) < 0) {
+        error = "Failed to print GOP statistics summary: fprintf() failed.";
+        return false;
+    }
+
+    return true;
+}
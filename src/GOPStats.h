@@ -0,0 +1,85 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#ifndef D2V_WITCH_GOPSTATS_H
+#define D2V_WITCH_GOPSTATS_H
+
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+
+extern "C" {
+#include <libavutil/rational.h>
+}
+
+
+// Collects the size, the picture types and the bitrate of every GOP,
+// and writes them to a CSV file, followed by a summary.
+class GOPStats {
+    struct GOP {
+        int line_number;
+        int file;
+        int64_t position;
+        int64_t fake_position;
+        int64_t bytes;
+        int frames;
+        int fields;
+        int pictures[4];
+    };
+
+    FILE *file;
+    AVRational frame_rate;
+    std::string error;
+
+    GOP gop;
+    bool have_gop;
+
+    int gops;
+    int64_t total_bytes;
+    int64_t total_fields;
+    int total_pictures[4];
+    double peak_bitrate;
+    std::map<int, int> length_histogram;
+    std::map<int, int> bitrate_histogram;
+
+
+    double getBitrate(int64_t bytes, int fields) const;
+
+    bool printGOP(int64_t next_fake_position);
+
+public:
+    GOPStats(FILE *_file, AVRational _frame_rate);
+
+    const std::string &getError() const;
+
+    bool printHeader();
+
+    bool startGOP(int line_number, int real_file, int64_t position, int64_t fake_position);
+
+    // Picture types are MPEGParser::PictureCodingType.
+    void addPicture(int picture_type, int size, bool repeat_first_field);
+
+    bool finish(int64_t total_size);
+};
+
+
+#endif // D2V_WITCH_GOPSTATS_H
@@ -0,0 +1,438 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "Hash.h"
+
+
+static inline uint32_t rotr32(uint32_t x, int bits) {
+    return (x >> bits) | (x << (32 - bits));
+}
+
+
+static inline uint64_t rotl64(uint64_t x, int bits) {
+    return (x << bits) | (x >> (64 - bits));
+}
+
+
+static inline uint32_t readBE32(const uint8_t *data) {
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+
+static inline uint32_t readLE32(const uint8_t *data) {
+    return ((uint32_t)data[3] << 24) | ((uint32_t)data[2] << 16) | ((uint32_t)data[1] << 8) | data[0];
+}
+
+
+static inline uint64_t readLE64(const uint8_t *data) {
+    return ((uint64_t)readLE32(data + 4) << 32) | readLE32(data);
+}
+
+
+static const uint32_t sha256_constants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+SHA256::SHA256()
+    : state{ 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 }
+    , block_size(0)
+    , total_size(0)
+{ }
+
+
+void SHA256::processBlock(const uint8_t *data) {
+    uint32_t w[64];
+
+    for (int i = 0; i < 16; i++)
+        w[i] = readBE32(data + i * 4);
+
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+    uint32_t e = state[4];
+    uint32_t f = state[5];
+    uint32_t g = state[6];
+    uint32_t h = state[7];
+
+    for (int i = 0; i < 64; i++) {
+        uint32_t s1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t temp1 = h + s1 + ch + sha256_constants[i] + w[i];
+        uint32_t s0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t temp2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + temp1;
+        d = c;
+        c = b;
+        b = a;
+        a = temp1 + temp2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+
+void SHA256::update(const uint8_t *data, size_t size) {
+    total_size += size;
+
+    if (block_size) {
+        size_t needed = std::min(size, sizeof(block) - block_size);
+        memcpy(block + block_size, data, needed);
+        block_size += needed;
+        data += needed;
+        size -= needed;
+
+        if (block_size < sizeof(block))
+            return;
+
+        processBlock(block);
+        block_size = 0;
+    }
+
+    while (size >= sizeof(block)) {
+        processBlock(data);
+        data += sizeof(block);
+        size -= sizeof(block);
+    }
+
+    memcpy(block, data, size);
+    block_size = size;
+}
+
+
+std::string SHA256::hexDigest() {
+    uint64_t total_bits = total_size * 8;
+
+    uint8_t padding[72] = { 0x80 };
+    size_t padding_size = (block_size < 56 ? 56 : 120) - block_size;
+    for (int i = 0; i < 8; i++)
+        padding[padding_size + i] = (uint8_t)(total_bits >> (56 - i * 8));
+
+    update(padding, padding_size + 8);
+
+    std::string hex;
+    for (int i = 0; i < 8; i++) {
+        char word[9] = { 0 };
+        snprintf(word, 9, "%08x", state[i]);
+        hex += word;
+    }
+
+    return hex;
+}
+
+
+static const uint64_t xxh64_prime1 = 11400714785074694791ULL;
+static const uint64_t xxh64_prime2 = 14029467366897019727ULL;
+static const uint64_t xxh64_prime3 = 1609587929392839161ULL;
+static const uint64_t xxh64_prime4 = 9650029242287828579ULL;
+static const uint64_t xxh64_prime5 = 2870177450012600261ULL;
+
+
+static inline uint64_t xxh64Round(uint64_t accumulator, uint64_t input) {
+    accumulator += input * xxh64_prime2;
+    accumulator = rotl64(accumulator, 31);
+    return accumulator * xxh64_prime1;
+}
+
+
+static inline uint64_t xxh64MergeRound(uint64_t accumulator, uint64_t value) {
+    accumulator ^= xxh64Round(0, value);
+    return accumulator * xxh64_prime1 + xxh64_prime4;
+}
+
+
+XXH64::XXH64()
+    : accumulators{ xxh64_prime1 + xxh64_prime2, xxh64_prime2, 0, 0 - xxh64_prime1 }
+    , stripe_size(0)
+    , total_size(0)
+{ }
+
+
+void XXH64::update(const uint8_t *data, size_t size) {
+    total_size += size;
+
+    if (stripe_size) {
+        size_t needed = std::min(size, sizeof(stripe) - stripe_size);
+        memcpy(stripe + stripe_size, data, needed);
+        stripe_size += needed;
+        data += needed;
+        size -= needed;
+
+        if (stripe_size < sizeof(stripe))
+            return;
+
+        for (int i = 0; i < 4; i++)
+            accumulators[i] = xxh64Round(accumulators[i], readLE64(stripe + i * 8));
+        stripe_size = 0;
+    }
+
+    while (size >= sizeof(stripe)) {
+        for (int i = 0; i < 4; i++)
+            accumulators[i] = xxh64Round(accumulators[i], readLE64(data + i * 8));
+        data += sizeof(stripe);
+        size -= sizeof(stripe);
+    }
+
+    memcpy(stripe, data, size);
+    stripe_size = size;
+}
+
+
+std::string XXH64::hexDigest() {
+    uint64_t hash;
+
+    if (total_size >= sizeof(stripe)) {
+        hash = rotl64(accumulators[0], 1) + rotl64(accumulators[1], 7) + rotl64(accumulators[2], 12) + rotl64(accumulators[3], 18);
+        for (int i = 0; i < 4; i++)
+            hash = xxh64MergeRound(hash, accumulators[i]);
+    } else {
+        hash = xxh64_prime5;
+    }
+
+    hash += total_size;
+
+    const uint8_t *data = stripe;
+    const uint8_t *data_end = stripe + stripe_size;
+
+    for ( ; data + 8 <= data_end; data += 8) {
+        hash ^= xxh64Round(0, readLE64(data));
+        hash = rotl64(hash, 27) * xxh64_prime1 + xxh64_prime4;
+    }
+
+    if (data + 4 <= data_end) {
+        hash ^= (uint64_t)readLE32(data) * xxh64_prime1;
+        hash = rotl64(hash, 23) * xxh64_prime2 + xxh64_prime3;
+        data += 4;
+    }
+
+    for ( ; data < data_end; data++) {
+        hash ^= *data * xxh64_prime5;
+        hash = rotl64(hash, 11) * xxh64_prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= xxh64_prime2;
+    hash ^= hash >> 29;
+    hash *= xxh64_prime3;
+    hash ^= hash >> 32;
+
+    char hex[17] = { 0 };
+    snprintf(hex, 17, "%016llx", (unsigned long long)hash);
+
+    return hex;
+}
+
+
+Hasher::Hasher(int _algorithm, const std::vector<Digest> &_files, const std::vector<int64_t> &_file_sizes)
+    : algorithm(_algorithm)
+    , files(_files)
+    , file_sizes(_file_sizes)
+    , total_digest{ }
+    , hashed_size(0)
+    , current_file(0)
+    , position_in_current_file(0)
+    , file_hash(nullptr)
+    , total_hash(nullptr)
+    , chunks{ }
+    , finishing(false)
+{
+    file_hash = createHashFunction();
+    total_hash = createHashFunction();
+
+    worker = std::thread(&Hasher::work, this);
+}
+
+
+Hasher::~Hasher() {
+    finish();
+
+    delete file_hash;
+    delete total_hash;
+}
+
+
+HashFunction *Hasher::createHashFunction() const {
+    if (algorithm == ALGORITHM_SHA256)
+        return new SHA256;
+
+    return new XXH64;
+}
+
+
+void Hasher::feed(int64_t position, const uint8_t *data, size_t size) {
+    // Already hashed, or there is a gap before it.
+    if (position + (int64_t)size <= hashed_size || position > hashed_size)
+        return;
+
+    size_t skip = hashed_size - position;
+
+    std::vector<uint8_t> chunk(data + skip, data + size);
+
+    hashed_size += chunk.size();
+
+    std::unique_lock<std::mutex> lock(chunks_mutex);
+
+    // Don't let the reading run too far ahead of the hashing.
+    chunks_consumed.wait(lock, [this] { return chunks.size() < 64; });
+
+    chunks.push_back(std::move(chunk));
+
+    chunks_available.notify_one();
+}
+
+
+int64_t Hasher::getHashedSize() const {
+    return hashed_size;
+}
+
+
+void Hasher::finish() {
+    {
+        std::lock_guard<std::mutex> lock(chunks_mutex);
+        finishing = true;
+        chunks_available.notify_one();
+    }
+
+    if (worker.joinable())
+        worker.join();
+}
+
+
+int Hasher::getAlgorithm() const {
+    return algorithm;
+}
+
+
+const std::vector<Hasher::Digest> &Hasher::getFileDigests() const {
+    return files;
+}
+
+
+const std::string &Hasher::getTotalDigest() const {
+    return total_digest;
+}
+
+
+int Hasher::getAlgorithm(const std::string &name) {
+    if (name == "xxh64")
+        return ALGORITHM_XXH64;
+    else if (name == "sha256")
+        return ALGORITHM_SHA256;
+
+    return UNKNOWN_ALGORITHM;
+}
+
+
+const char *Hasher::getAlgorithmName(int algorithm) {
+    if (algorithm == ALGORITHM_SHA256)
+        return "sha256";
+
+    return "xxh64";
+}
+
+
+void Hasher::hashChunk(const std::vector<uint8_t> &chunk) {
+    total_hash->update(chunk.data(), chunk.size());
+
+    size_t offset = 0;
+
+    while (offset < chunk.size() && current_file < files.size()) {
+        size_t bytes = std::min((int64_t)(chunk.size() - offset), file_sizes[current_file] - position_in_current_file);
+
+        file_hash->update(chunk.data() + offset, bytes);
+        offset += bytes;
+        position_in_current_file += bytes;
+
+        if (position_in_current_file == file_sizes[current_file])
+            nextFile();
+    }
+}
+
+
+void Hasher::nextFile() {
+    do {
+        files[current_file].hex = file_hash->hexDigest();
+        delete file_hash;
+        file_hash = createHashFunction();
+
+        current_file++;
+        position_in_current_file = 0;
+
+        // Empty files never get any chunks.
+    } while (current_file < files.size() && !file_sizes[current_file]);
+}
+
+
+void Hasher::work() {
+    if (files.size() && !file_sizes[0])
+        nextFile();
+
+    while (true) {
+        std::vector<uint8_t> chunk;
+
+        {
+            std::unique_lock<std::mutex> lock(chunks_mutex);
+
+            chunks_available.wait(lock, [this] { return chunks.size() || finishing; });
+
+            if (!chunks.size())
+                break;
+
+            chunk = std::move(chunks.front());
+            chunks.pop_front();
+
+            chunks_consumed.notify_one();
+        }
+
+        hashChunk(chunk);
+    }
+
+    total_digest = total_hash->hexDigest();
+}
@@ -0,0 +1,148 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#ifndef D2V_WITCH_HASH_H
+#define D2V_WITCH_HASH_H
+
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+class HashFunction {
+public:
+    virtual ~HashFunction() { }
+
+    virtual void update(const uint8_t *data, size_t size) = 0;
+
+    // Can only be called once.
+    virtual std::string hexDigest() = 0;
+};
+
+
+class SHA256 : public HashFunction {
+    uint32_t state[8];
+    uint8_t block[64];
+    size_t block_size;
+    uint64_t total_size;
+
+    void processBlock(const uint8_t *data);
+
+public:
+    SHA256();
+
+    void update(const uint8_t *data, size_t size);
+
+    std::string hexDigest();
+};
+
+
+class XXH64 : public HashFunction {
+    uint64_t accumulators[4];
+    uint8_t stripe[32];
+    size_t stripe_size;
+    uint64_t total_size;
+
+public:
+    XXH64();
+
+    void update(const uint8_t *data, size_t size);
+
+    std::string hexDigest();
+};
+
+
+// Hashes the bytes of a FakeFile in file order, on a separate thread.
+// The bytes are fed from FakeFile::readPacket, which means they can arrive
+// out of order because of the seeking done by libavformat while probing.
+// Anything that doesn't continue exactly where the previous chunk ended
+// is ignored here, and read again later.
+class Hasher {
+public:
+    enum Algorithms {
+        UNKNOWN_ALGORITHM = -1,
+        ALGORITHM_XXH64 = 0,
+        ALGORITHM_SHA256 = 1
+    };
+
+    struct Digest {
+        std::string name;
+        std::string hex;
+    };
+
+    Hasher(int _algorithm, const std::vector<Digest> &_files, const std::vector<int64_t> &_file_sizes);
+    ~Hasher();
+
+    void feed(int64_t position, const uint8_t *data, size_t size);
+
+    int64_t getHashedSize() const;
+
+    int getAlgorithm() const;
+
+    // Waits for the worker thread to hash everything fed so far.
+    void finish();
+
+    const std::vector<Digest> &getFileDigests() const;
+
+    const std::string &getTotalDigest() const;
+
+    static int getAlgorithm(const std::string &name);
+
+    static const char *getAlgorithmName(int algorithm);
+
+private:
+    int algorithm;
+    std::vector<Digest> files;
+    std::vector<int64_t> file_sizes;
+    std::string total_digest;
+
+    // Only touched by the thread calling feed().
+    int64_t hashed_size;
+
+    // Only touched by the worker thread.
+    size_t current_file;
+    int64_t position_in_current_file;
+    HashFunction *file_hash;
+    HashFunction *total_hash;
+
+    std::deque<std::vector<uint8_t> > chunks;
+    bool finishing;
+    std::mutex chunks_mutex;
+    std::condition_variable chunks_available;
+    std::condition_variable chunks_consumed;
+    std::thread worker;
+
+
+    HashFunction *createHashFunction() const;
+
+    void hashChunk(const std::vector<uint8_t> &chunk);
+
+    void nextFile();
+
+    void work();
+};
+
+
+#endif // D2V_WITCH_HASH_H
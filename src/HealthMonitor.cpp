@@ -0,0 +1,295 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+#include <algorithm>
+#include <cstring>
+
+#include "HealthMonitor.h"
+
+
+static const int64_t MB = 1024 * 1024;
+
+
+HealthMonitor::HealthMonitor(int64_t _window_size, const Limits &_limits)
+    : window_size(_window_size)
+    , limits(_limits)
+    , checked(0)
+    , window_end(_window_size)
+    , window_number(0)
+    , packet_size(UNKNOWN_PACKET_SIZE)
+    , pending{ }
+    , synced(false)
+    , window{ }
+    , stats{ }
+    , window_pictures{ }
+    , next_picture_window(0)
+    , last_picture_position(0)
+    // Enough for the demuxer's probing and buffering, and the read ahead.
+    , picture_lag(std::max(_window_size, 32 * MB))
+    , healthy(true)
+{
+    memset(continuity_counters, -1, sizeof(continuity_counters));
+}
+
+
+bool HealthMonitor::isHealthy() const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return healthy;
+}
+
+
+HealthMonitor::Stats HealthMonitor::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Stats copy = stats;
+    copy.transport_stream = packet_size > 0;
+
+    return copy;
+}
+
+
+const std::string &HealthMonitor::getError() const {
+    return error;
+}
+
+
+void HealthMonitor::fail(const std::string &diagnosis) {
+    if (!healthy)
+        return;
+
+    healthy = false;
+
+    std::string where;
+    if (window_number == 0)
+        where = "in the first " + std::to_string(window_size / MB) + " MB";
+    else
+        where = "at " + std::to_string(checked / MB) + " MB";
+
+    error = "Giving up " + where + ": " + diagnosis;
+}
+
+
+void HealthMonitor::detectPacketSize() {
+    // A few sync bytes in a row, somewhere near the start.
+    const int sizes[] = { 188, 192 };
+    const size_t needed = 4096 + 3 * 192;
+
+    if (pending.size() < needed)
+        return;
+
+    for (size_t offset = 0; offset < 4096; offset++) {
+        for (int i = 0; i < 2; i++) {
+            if (pending[offset] == 0x47 &&
+                pending[offset + sizes[i]] == 0x47 &&
+                pending[offset + 2 * sizes[i]] == 0x47 &&
+                pending[offset + 3 * sizes[i]] == 0x47) {
+                packet_size = sizes[i];
+                pending.erase(pending.begin(), pending.begin() + offset);
+                synced = true;
+                return;
+            }
+        }
+    }
+
+    packet_size = NOT_TRANSPORT_STREAM;
+    pending.clear();
+}
+
+
+void HealthMonitor::handlePacket(const uint8_t *packet) {
+    int pid = ((packet[1] & 0x1f) << 8) | packet[2];
+    if (pid == 0x1fff)
+        return;
+
+    window.packets++;
+    stats.packets++;
+
+    int scrambling_control = packet[3] >> 6;
+    int adaptation_field_control = (packet[3] >> 4) & 3;
+    int continuity_counter = packet[3] & 15;
+
+    if (scrambling_control) {
+        window.scrambled++;
+        stats.scrambled++;
+        window.scrambled_pids[pid]++;
+    }
+
+    // The counter only counts packets with payload, and the transport
+    // error indicator means the header itself can't be trusted.
+    if (!(adaptation_field_control & 1) || (packet[1] & 0x80))
+        return;
+
+    bool discontinuity = (adaptation_field_control & 2) && packet[4] > 0 && (packet[5] & 0x80);
+
+    int previous = continuity_counters[pid];
+    continuity_counters[pid] = continuity_counter;
+
+    // One duplicate packet is allowed.
+    if (previous < 0 || discontinuity || continuity_counter == previous)
+        return;
+
+    if (continuity_counter != ((previous + 1) & 15)) {
+        window.cc_errors++;
+        stats.cc_errors++;
+    }
+}
+
+
+void HealthMonitor::parsePending() {
+    size_t offset = 0;
+
+    while (pending.size() - offset >= (size_t)packet_size) {
+        if (synced) {
+            if (pending[offset] == 0x47) {
+                handlePacket(pending.data() + offset);
+                offset += packet_size;
+                continue;
+            }
+
+            synced = false;
+            window.resyncs++;
+            stats.resyncs++;
+        }
+
+        // Three sync bytes in a row.
+        size_t found = offset;
+        while (found + 2 * packet_size < pending.size() &&
+               !(pending[found] == 0x47 && pending[found + packet_size] == 0x47 && pending[found + 2 * packet_size] == 0x47))
+            found++;
+
+        offset = found;
+
+        if (found + 2 * packet_size >= pending.size())
+            break;
+
+        synced = true;
+    }
+
+    pending.erase(pending.begin(), pending.begin() + offset);
+}
+
+
+void HealthMonitor::checkWindow() {
+    if (packet_size > 0 && window.packets) {
+        double scrambled = 100.0 * window.scrambled / window.packets;
+        double cc_errors = 1000.0 * window.cc_errors / window.packets;
+        double resyncs = (double)window.resyncs * MB / window_size;
+
+        char text[512];
+
+        if (scrambled > limits.scrambled) {
+            int worst_pid = -1;
+            int64_t worst_count = 0;
+            for (auto it = window.scrambled_pids.cbegin(); it != window.scrambled_pids.cend(); it++) {
+                if (it->second > worst_count) {
+                    worst_pid = it->first;
+                    worst_count = it->second;
+                }
+            }
+
+            snprintf(text, sizeof(text), "%.1f%% of the transport packets are scrambled, most of them on PID 0x%x (the limit is %g%%). The stream is encrypted, and the pictures can't be parsed.", scrambled, worst_pid, limits.scrambled);
+            fail(text);
+        } else if (cc_errors > limits.cc_errors) {
+            snprintf(text, sizeof(text), "%.1f continuity counter errors per 1000 transport packets (the limit is %g). Packets were lost during the recording.", cc_errors, limits.cc_errors);
+            fail(text);
+        } else if (resyncs > limits.resyncs) {
+            snprintf(text, sizeof(text), "the transport stream sync was lost %.1f times per MB (the limit is %g). The file is mostly garbage, or not a transport stream after all.", resyncs, limits.resyncs);
+            fail(text);
+        }
+    }
+
+    window = Window{ };
+}
+
+
+void HealthMonitor::checkPictures() {
+    while ((next_picture_window + 1) * window_size + picture_lag <= checked) {
+        int64_t pictures = 0;
+
+        auto it = window_pictures.find(next_picture_window);
+        if (it != window_pictures.end()) {
+            pictures = it->second;
+            window_pictures.erase(it);
+        }
+
+        if (pictures < limits.pictures) {
+            char text[512];
+            snprintf(text, sizeof(text), "found %d video pictures between %d MB and %d MB (the limit is %d). The video stream carries no pictures, or they can't be parsed.",
+                     (int)pictures, (int)(next_picture_window * window_size / MB), (int)((next_picture_window + 1) * window_size / MB), limits.pictures);
+            fail(text);
+            return;
+        }
+
+        next_picture_window++;
+    }
+}
+
+
+bool HealthMonitor::feed(int64_t position, const uint8_t *data, int size) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!healthy)
+        return false;
+
+    // Only what continues the bytes already looked at. The demuxer
+    // reads the start again after probing, and maybe the end earlier.
+    if (position > checked || position + size <= checked)
+        return true;
+
+    int skip = (int)(checked - position);
+
+    if (packet_size != NOT_TRANSPORT_STREAM) {
+        pending.insert(pending.end(), data + skip, data + size);
+
+        if (packet_size == UNKNOWN_PACKET_SIZE)
+            detectPacketSize();
+
+        if (packet_size > 0)
+            parsePending();
+    }
+
+    checked += size - skip;
+
+    while (healthy && checked >= window_end) {
+        checkWindow();
+
+        window_end += window_size;
+        window_number++;
+    }
+
+    if (healthy)
+        checkPictures();
+
+    return healthy;
+}
+
+
+void HealthMonitor::addPicture(int64_t position) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (position < 0)
+        position = last_picture_position;
+    last_picture_position = position;
+
+    int64_t number = position / window_size;
+    if (number >= next_picture_window)
+        window_pictures[number]++;
+
+    stats.pictures++;
+}
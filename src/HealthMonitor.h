@@ -0,0 +1,152 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#ifndef D2V_WITCH_HEALTHMONITOR_H
+#define D2V_WITCH_HEALTHMONITOR_H
+
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// Looks at the input while it is being indexed and gives up early when it
+// can't produce a useful D2V file: scrambled transport streams, damaged
+// recordings that keep losing packets, files that are mostly garbage, and
+// video streams without pictures.
+//
+// The raw bytes come from FakeFile::readPacket, the pictures from D2V.
+// Both are counted in windows of a fixed number of bytes, and every
+// window is checked against the limits when the reading gets past it.
+// The first window is the early check. Pictures are checked a little
+// later than the rest, because the demuxer reads ahead of the parser.
+//
+// The transport stream checks are skipped for other kinds of input.
+class HealthMonitor {
+public:
+    struct Limits {
+        // Percentage of transport packets with transport_scrambling_control set.
+        double scrambled;
+        // Continuity counter errors per 1000 transport packets.
+        double cc_errors;
+        // Times the transport stream sync was lost, per MB.
+        double resyncs;
+        // Video pictures per window.
+        int pictures;
+
+        Limits()
+            : scrambled(10)
+            , cc_errors(20)
+            , resyncs(5)
+            , pictures(1)
+        { }
+    };
+
+    struct Stats {
+        int64_t packets;
+        int64_t scrambled;
+        int64_t cc_errors;
+        int64_t resyncs;
+        int64_t pictures;
+        bool transport_stream;
+    };
+
+    HealthMonitor(int64_t _window_size, const Limits &_limits);
+
+    // Sees everything FakeFile returns, which can be the same bytes more
+    // than once after seeking backwards. Returns false once the input was
+    // found unhealthy.
+    bool feed(int64_t position, const uint8_t *data, int size);
+
+    // Called for every picture the parser accepts, with the position of
+    // its packet.
+    void addPicture(int64_t position);
+
+    bool isHealthy() const;
+
+    Stats getStats() const;
+
+    // The diagnosis.
+    const std::string &getError() const;
+
+private:
+    struct Window {
+        int64_t packets;
+        int64_t scrambled;
+        int64_t cc_errors;
+        int64_t resyncs;
+        std::unordered_map<int, int64_t> scrambled_pids;
+    };
+
+    enum {
+        UNKNOWN_PACKET_SIZE = -1,
+        NOT_TRANSPORT_STREAM = 0
+    };
+
+    int64_t window_size;
+    Limits limits;
+
+    mutable std::mutex mutex;
+
+    // Everything before this was looked at.
+    int64_t checked;
+    int64_t window_end;
+    int window_number;
+
+    // 188, 192 (with a four byte timestamp before each packet), or one of
+    // the above.
+    int packet_size;
+    std::vector<uint8_t> pending;
+    bool synced;
+    int8_t continuity_counters[8192];
+
+    Window window;
+    Stats stats;
+
+    // Pictures by window number, until they are checked.
+    std::map<int64_t, int64_t> window_pictures;
+    int64_t next_picture_window;
+    int64_t last_picture_position;
+    int64_t picture_lag;
+
+    bool healthy;
+    std::string error;
+
+
+    void detectPacketSize();
+
+    void handlePacket(const uint8_t *packet);
+
+    void parsePending();
+
+    void resetSync();
+
+    void checkWindow();
+
+    void checkPictures();
+
+    void fail(const std::string &diagnosis);
+};
+
+
+#endif // D2V_WITCH_HEALTHMONITOR_H
@@ -0,0 +1,290 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "IncrementalIndex.h"
+
+
+IncrementalIndex::IncrementalIndex(const std::vector<std::string> &files, int _video_id)
+    : fake_file{ }
+    , f{ }
+    , video_id(_video_id)
+    , d2v{ }
+    , coarse_index{ }
+    , worker{ }
+    , gops{ }
+    , indexed_pictures(0)
+    , wanted_picture(-1)
+    , background(false)
+    , finished(false)
+    , stopping(false)
+    , error{ }
+{
+    for (size_t i = 0; i < files.size(); i++)
+        fake_file.push_back(files[i]);
+}
+
+
+IncrementalIndex::~IncrementalIndex() {
+    if (worker.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+
+        work_wanted.notify_all();
+        worker.join();
+    }
+
+    d2v.reset();
+    f.cleanup();
+    fake_file.close();
+}
+
+
+bool IncrementalIndex::open() {
+    if (!fake_file.size()) {
+        error = "No files given.";
+        return false;
+    }
+
+    if (!fake_file.open()) {
+        error = fake_file.getError();
+        return false;
+    }
+
+    if (!f.initFormat(fake_file)) {
+        error = f.getError();
+        return false;
+    }
+
+    if (getStreamType(f.fctx->iformat->name) == D2V::UNSUPPORTED_STREAM) {
+        error = "Unsupported container type '";
+        error += f.fctx->iformat->long_name ? f.fctx->iformat->long_name : f.fctx->iformat->name;
+        error += "'.";
+        return false;
+    }
+
+    AVStream *video_stream = nullptr;
+    for (unsigned i = 0; i < f.fctx->nb_streams; i++) {
+        AVStream *stream = f.fctx->streams[i];
+        stream->discard = AVDISCARD_ALL;
+
+        if (!video_stream && stream->codec->codec_type == AVMEDIA_TYPE_VIDEO && (video_id == -1 || stream->id == video_id)) {
+            stream->discard = AVDISCARD_DEFAULT;
+            video_stream = stream;
+        }
+    }
+
+    if (!video_stream) {
+        error = "Couldn't find the video track.";
+        return false;
+    }
+
+    if (video_stream->codec->codec_id != AV_CODEC_ID_MPEG1VIDEO && video_stream->codec->codec_id != AV_CODEC_ID_MPEG2VIDEO) {
+        error = "Unsupported video codec: ";
+        error += avcodec_get_name(video_stream->codec->codec_id);
+        return false;
+    }
+
+    d2v.reset(new D2V(nullptr, std::unordered_map<int, FILE *>(), &fake_file, &f, video_stream, nullptr));
+    d2v->addSink(this);
+
+    if (!d2v->begin()) {
+        error = d2v->getError();
+        return false;
+    }
+
+    worker = std::thread(&IncrementalIndex::work, this);
+
+    return true;
+}
+
+
+bool IncrementalIndex::buildCoarseIndex(int samples, std::string &err) {
+    std::unique_ptr<CoarseIndex> index(new CoarseIndex(fake_file, samples));
+
+    if (!index->build()) {
+        err = index->getError();
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!finished)
+        coarse_index = std::move(index);
+
+    return true;
+}
+
+
+bool IncrementalIndex::ensureFrame(int64_t frame) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (frame > wanted_picture) {
+        wanted_picture = frame;
+        work_wanted.notify_all();
+    }
+
+    gops_added.wait(lock, [this, frame] { return indexed_pictures > frame || finished; });
+
+    return error.empty();
+}
+
+
+void IncrementalIndex::setBackground(bool _background) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        background = _background;
+    }
+
+    work_wanted.notify_all();
+}
+
+
+std::vector<IncrementalIndex::GOP> IncrementalIndex::getGOPs(size_t first_gop) const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (first_gop >= gops.size())
+        return std::vector<GOP>();
+
+    return std::vector<GOP>(gops.begin() + first_gop, gops.end());
+}
+
+
+bool IncrementalIndex::findGOP(int64_t frame, GOP *gop) const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (frame < 0 || frame >= indexed_pictures)
+        return false;
+
+    auto it = std::upper_bound(gops.begin(), gops.end(), frame, [] (int64_t value, const GOP &element) {
+        return value < element.first_picture;
+    });
+
+    *gop = *(it - 1);
+
+    return true;
+}
+
+
+bool IncrementalIndex::findSeekPoint(int64_t frame, SeekPoint *point) const {
+    GOP gop;
+    if (findGOP(frame, &gop)) {
+        *point = { gop.line.file, gop.line.position, gop.first_picture, true };
+        return true;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    CoarseIndex::Entry entry;
+    if (!coarse_index || !coarse_index->findEntry(frame, &entry))
+        return false;
+
+    // The indexed GOPs are better, as long as the coarse index has
+    // nothing closer.
+    if (gops.size() && entry.frame <= gops.back().first_picture) {
+        const GOP &last = gops.back();
+        *point = { last.line.file, last.line.position, last.first_picture, true };
+        return true;
+    }
+
+    *point = { entry.file, entry.file_position, entry.frame, false };
+
+    return true;
+}
+
+
+int64_t IncrementalIndex::getIndexedPictures() const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return indexed_pictures;
+}
+
+
+bool IncrementalIndex::isFinished() const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return finished;
+}
+
+
+std::string IncrementalIndex::getError() const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return error;
+}
+
+
+bool IncrementalIndex::handleLine(const D2V::LineEvent &event, std::string &err) {
+    (void)err;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        gops.push_back({ *event.line, event.first_picture });
+        indexed_pictures = event.first_picture + event.line->flags.size();
+    }
+
+    gops_added.notify_all();
+
+    return true;
+}
+
+
+void IncrementalIndex::work() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            work_wanted.wait(lock, [this] { return stopping || background || wanted_picture >= indexed_pictures; });
+
+            if (stopping)
+                return;
+        }
+
+        // A few packets at a time, so the lock isn't taken for every one.
+        bool done = false;
+        bool okay = true;
+        for (int i = 0; i < 64 && okay && !done; i++)
+            okay = d2v->step(&done);
+
+        if (okay && done)
+            okay = d2v->finish();
+
+        if (!okay || done) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                if (!okay)
+                    error = d2v->getError();
+                else
+                    coarse_index.reset();
+                finished = true;
+            }
+
+            gops_added.notify_all();
+
+            return;
+        }
+    }
+}
@@ -0,0 +1,137 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#ifndef D2V_WITCH_INCREMENTALINDEX_H
+#define D2V_WITCH_INCREMENTALINDEX_H
+
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CoarseIndex.h"
+#include "D2V.h"
+#include "FakeFile.h"
+#include "FFMPEG.h"
+
+
+// Indexes the video track of some files a bit at a time on a separate
+// thread, for programs that want to use the first GOPs long before the
+// whole input is indexed. Nothing is written anywhere: the GOPs are only
+// kept in memory.
+//
+// The thread only reads as far as someone asked for with ensureFrame(),
+// unless background indexing is turned on. When it stops, it keeps its
+// place, and continues from there with the next request.
+class IncrementalIndex : private D2V::Sink {
+public:
+    struct GOP {
+        D2V::DataLine line;
+
+        // The number of pictures in all the GOPs before this one.
+        int64_t first_picture;
+    };
+
+    struct SeekPoint {
+        int file;
+        int64_t position;
+        int64_t first_picture;
+
+        // False if it came from the coarse index.
+        bool exact;
+    };
+
+    // video_id = -1 means the first video track.
+    IncrementalIndex(const std::vector<std::string> &files, int _video_id);
+    ~IncrementalIndex();
+
+    // Opens the files and starts the indexing thread.
+    bool open();
+
+    // Builds a coarse index with the given number of samples, which
+    // findSeekPoint() uses for the pictures that aren't indexed yet,
+    // until the whole input is indexed. Takes milliseconds. Failing
+    // leaves the indexing alone, so the error goes to err, not to
+    // getError().
+    bool buildCoarseIndex(int samples, std::string &err);
+
+    // The functions below are thread safe.
+
+    // Waits until the GOP with picture number frame (in the order of the
+    // D2V file) is indexed, or until the end of the input. Returns false
+    // if indexing failed.
+    bool ensureFrame(int64_t frame);
+
+    // Whether to keep indexing while no one is waiting. Off by default.
+    void setBackground(bool _background);
+
+    // Copies of the GOPs indexed so far, from first_gop on.
+    std::vector<GOP> getGOPs(size_t first_gop) const;
+
+    // Finds the indexed GOP that contains picture number frame.
+    bool findGOP(int64_t frame, GOP *gop) const;
+
+    // Where to start reading to get picture number frame: its GOP, if it's
+    // indexed, otherwise the closest point in the coarse index before it.
+    bool findSeekPoint(int64_t frame, SeekPoint *point) const;
+
+    int64_t getIndexedPictures() const;
+
+    // Whether the whole input was indexed, or indexing failed.
+    bool isFinished() const;
+
+    std::string getError() const;
+
+private:
+    FakeFile fake_file;
+    FFMPEG f;
+    int video_id;
+    std::unique_ptr<D2V> d2v;
+    // Thrown away once everything is indexed.
+    std::unique_ptr<CoarseIndex> coarse_index;
+
+    mutable std::mutex mutex;
+    std::condition_variable work_wanted;
+    std::condition_variable gops_added;
+    std::thread worker;
+
+    std::vector<GOP> gops;
+    int64_t indexed_pictures;
+    // The highest picture number someone waits for.
+    int64_t wanted_picture;
+    bool background;
+    bool finished;
+    bool stopping;
+
+    std::string error;
+
+
+    // Called by D2V, on the indexing thread.
+    bool handleLine(const D2V::LineEvent &event, std::string &err) override;
+
+    void work();
+};
+
+
+#endif // D2V_WITCH_INCREMENTALINDEX_H
@@ -24,6 +24,7 @@ such things.
 */
 
 
+#include <algorithm>
 #include <cstring>
 
 #include "MPEGParser.h"
@@ -32,6 +33,10 @@ such things.
 MPEGParser::MPEGParser()
     : width(-1)
     , height(-1)
+    , aspect_ratio_information(0)
+    , frame_rate_code(0)
+    , frame_rate_extension_n(0)
+    , frame_rate_extension_d(0)
     , progressive_sequence(false)
 {
     clear();
@@ -40,12 +45,64 @@ MPEGParser::MPEGParser()
 
 void MPEGParser::clear() {
     picture_coding_type = 0;
+    temporal_reference = 0;
+    sequence_header = false;
     top_field_first = false;
     repeat_first_field = false;
     progressive_frame = false;
     group_of_pictures_header = false;
     closed_gop = false;
     matrix_coefficients = MATRIX_UNSPECIFIED;
+
+    // Keeps the vector's memory.
+    user_data.cc_data.clear();
+    user_data.active_format = -1;
+    user_data.bar_top = -1;
+    user_data.bar_bottom = -1;
+    user_data.bar_left = -1;
+    user_data.bar_right = -1;
+}
+
+
+void MPEGParser::parseUserData(const uint8_t *data, int bytes_left) {
+    if (bytes_left < 5)
+        return;
+
+    uint32_t identifier = (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+
+    if (identifier == 0x47413934) { // "GA94"
+        int user_data_type_code = data[4];
+
+        if (user_data_type_code == 0x03 && bytes_left >= 7) {
+            bool process_cc_data = data[5] & (1 << 6);
+            int cc_count = data[5] & 0x1f;
+
+            if (process_cc_data) {
+                cc_count = std::min(cc_count, (bytes_left - 7) / 3);
+                user_data.cc_data.insert(user_data.cc_data.end(), data + 7, data + 7 + cc_count * 3);
+            }
+        } else if (user_data_type_code == 0x06 && bytes_left >= 6) {
+            int flags = data[5];
+            int *bars[4] = { &user_data.bar_top, &user_data.bar_bottom, &user_data.bar_left, &user_data.bar_right };
+
+            const uint8_t *bar = data + 6;
+            for (int i = 0; i < 4; i++) {
+                if (!(flags & (0x80 >> i)))
+                    continue;
+
+                if (bar + 2 > data + bytes_left)
+                    break;
+
+                *bars[i] = ((bar[0] & 0x3f) << 8) | bar[1];
+                bar += 2;
+            }
+        }
+    } else if (identifier == 0x44544731) { // "DTG1"
+        bool active_format_flag = data[4] & (1 << 6);
+
+        if (active_format_flag && bytes_left >= 6)
+            user_data.active_format = data[5] & 0xf;
+    }
 }
 
 
@@ -79,12 +136,23 @@ void MPEGParser::parseData(const uint8_t *data, int data_size) {
         int bytes_left = data_end - data;
 
         if (start_code == PICTURE_START_CODE) {
-            if (bytes_left >= 2)
+            if (bytes_left >= 2) {
+                temporal_reference = (data[0] << 2) | (data[1] >> 6);
                 picture_coding_type = (data[1] >> 3) & 7;
+            }
         } else if (start_code == SEQUENCE_HEADER_CODE) {
             if (bytes_left >= 3) {
                 width = (((int)data[0]) << 4) | (data[1] >> 4);
                 height = ((data[1] & 0xf) << 8) | data[2];
+                sequence_header = true;
+
+                // MPEG-1 streams don't have the extension.
+                frame_rate_extension_n = 0;
+                frame_rate_extension_d = 0;
+            }
+            if (bytes_left >= 4) {
+                aspect_ratio_information = data[3] >> 4;
+                frame_rate_code = data[3] & 0xf;
             }
         } else if (start_code == EXTENSION_START_CODE) {
             if (bytes_left >= 1) {
@@ -100,6 +168,10 @@ void MPEGParser::parseData(const uint8_t *data, int data_size) {
                         }
                         progressive_sequence = data[1] & (1 << 3);
                     }
+                    if (bytes_left >= 6) {
+                        frame_rate_extension_n = (data[5] >> 5) & 3;
+                        frame_rate_extension_d = data[5] & 0x1f;
+                    }
                 } else if (extension_type == SEQUENCE_DISPLAY_EXTENSION) {
                     if (bytes_left >= 1) {
                         bool colour_description = data[0] & 1;
@@ -117,6 +189,8 @@ void MPEGParser::parseData(const uint8_t *data, int data_size) {
                     }
                 }
             }
+        } else if (start_code == USER_DATA_START_CODE) {
+            parseUserData(data, bytes_left);
         } else if (start_code == GROUP_START_CODE) {
             if (bytes_left >= 4) {
                 group_of_pictures_header = true;
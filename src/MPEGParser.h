@@ -23,6 +23,7 @@ SOFTWARE.
 
 
 #include <cstdint>
+#include <vector>
 
 
 struct MPEGParser {
@@ -32,6 +33,30 @@ struct MPEGParser {
         B_PICTURE = 3
     };
 
+    // What the picture's user_data says, from ATSC A/53 (GA94) and the
+    // DTG's Active Format Description (DTG1).
+    struct UserData {
+        // The cc_data constructs, three bytes each: marker bits, cc_valid,
+        // and cc_type in the first, then cc_data_1 and cc_data_2.
+        std::vector<uint8_t> cc_data;
+        // -1 when the picture didn't say.
+        int active_format;
+        // Lines or pixels, -1 when the picture didn't say.
+        int bar_top;
+        int bar_bottom;
+        int bar_left;
+        int bar_right;
+
+        UserData()
+            : cc_data{ }
+            , active_format(-1)
+            , bar_top(-1)
+            , bar_bottom(-1)
+            , bar_left(-1)
+            , bar_right(-1)
+        { }
+    };
+
     enum MatrixCoefficients {
         MATRIX_FORBIDDEN = 0,
         MATRIX_BT709 = 1,
@@ -46,7 +71,13 @@ struct MPEGParser {
 
     int width;
     int height;
+    int aspect_ratio_information;
+    int frame_rate_code;
+    int frame_rate_extension_n;
+    int frame_rate_extension_d;
+    bool sequence_header;
     int picture_coding_type;
+    int temporal_reference;
     bool progressive_sequence;
     bool top_field_first;
     bool repeat_first_field;
@@ -54,6 +85,7 @@ struct MPEGParser {
     bool group_of_pictures_header;
     bool closed_gop;
     uint8_t matrix_coefficients;
+    UserData user_data;
 
 
     MPEGParser();
@@ -61,10 +93,9 @@ struct MPEGParser {
     void parseData(const uint8_t *data, int data_size);
 
 
-private:
-
     enum StartCodes {
         PICTURE_START_CODE = 0x00,
+        USER_DATA_START_CODE = 0xb2,
         SEQUENCE_HEADER_CODE = 0xb3,
         EXTENSION_START_CODE = 0xb5,
         GROUP_START_CODE = 0xb8,
@@ -79,9 +110,16 @@ private:
     };
 
 
+    // Returns the byte after the next start code, and the start code's
+    // value, or data_end if there is none.
+    static const uint8_t *findStartCode(const uint8_t *data, const uint8_t *data_end, uint32_t *start_code);
+
+
+private:
+
     void clear();
 
-    const uint8_t *findStartCode(const uint8_t *data, const uint8_t *data_end, uint32_t *start_code);
+    void parseUserData(const uint8_t *data, int bytes_left);
 };
 
 #endif // D2V_WITCH_MPEGPARSER_H
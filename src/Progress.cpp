@@ -0,0 +1,190 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+#include <cinttypes>
+
+#include "JSON.h"
+#include "Progress.h"
+
+
+Progress::Progress(FILE *_json_file, bool _console, double _max_rate)
+    : json_file(_json_file)
+    , console(_console)
+    , interval(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(_max_rate > 0 ? 1 / _max_rate : 0)))
+    , next_job(0)
+    , done_jobs(0)
+    , failed_jobs(0)
+    , start(Clock::now())
+    , last_report(start)
+{ }
+
+
+double Progress::getSeconds(Clock::time_point time) const {
+    return std::chrono::duration<double>(time - start).count();
+}
+
+
+int Progress::startJob(const std::string &name, int64_t total_bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Clock::time_point now = Clock::now();
+
+    int id = next_job++;
+    jobs.insert({ id, { name, 0, total_bytes, 0, 0, now, 0, now, 0 } });
+
+    return id;
+}
+
+
+void Progress::update(int job, int64_t bytes, int64_t frames, int64_t gops) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = jobs.find(job);
+    if (it == jobs.end())
+        return;
+
+    it->second.bytes = bytes;
+    it->second.frames = frames;
+    it->second.gops = gops;
+
+    Clock::time_point now = Clock::now();
+    if (now - last_report >= interval)
+        report(now);
+}
+
+
+void Progress::updateThroughput(Job &job, Clock::time_point now) {
+    double seconds = std::chrono::duration<double>(now - job.last_time).count();
+    if (seconds <= 0)
+        return;
+
+    double rate = (job.bytes - job.last_bytes) / seconds;
+
+    // Smoothed, so the ETA doesn't jump around with every GOP size.
+    if (job.last_bytes == 0)
+        job.bytes_per_second = rate;
+    else
+        job.bytes_per_second = 0.7 * job.bytes_per_second + 0.3 * rate;
+
+    job.last_bytes = job.bytes;
+    job.last_time = now;
+}
+
+
+static std::string formatETA(int64_t remaining_bytes, double bytes_per_second) {
+    if (bytes_per_second <= 0)
+        return "null";
+
+    char eta[30] = { 0 };
+    snprintf(eta, 29, "%.1f", remaining_bytes / bytes_per_second);
+    return eta;
+}
+
+
+void Progress::report(Clock::time_point now) {
+    last_report = now;
+
+    int64_t bytes = 0, total_bytes = 0, frames = 0, gops = 0;
+    double bytes_per_second = 0;
+
+    std::string job_list;
+
+    for (auto it = jobs.begin(); it != jobs.end(); it++) {
+        Job &job = it->second;
+
+        updateThroughput(job, now);
+
+        bytes += job.bytes;
+        total_bytes += job.total_bytes;
+        frames += job.frames;
+        gops += job.gops;
+        bytes_per_second += job.bytes_per_second;
+
+        if (!json_file)
+            continue;
+
+        char numbers[300] = { 0 };
+        snprintf(numbers, 299,
+                 "\"bytes\":%" PRId64 ",\"total\":%" PRId64 ",\"frames\":%" PRId64 ",\"gops\":%" PRId64 ",\"bytes_per_second\":%.0f,\"eta\":%s",
+                 job.bytes,
+                 job.total_bytes,
+                 job.frames,
+                 job.gops,
+                 job.bytes_per_second,
+                 formatETA(job.total_bytes - job.bytes, job.bytes_per_second).c_str());
+
+        if (job_list.size())
+            job_list += ",";
+        job_list += "{\"name\":\"" + escapeJSON(job.name) + "\"," + numbers + "}";
+    }
+
+    if (json_file) {
+        fprintf(json_file,
+                "{\"event\":\"progress\",\"time\":%.3f,\"bytes\":%" PRId64 ",\"total\":%" PRId64 ",\"frames\":%" PRId64 ",\"gops\":%" PRId64 ",\"bytes_per_second\":%.0f,\"eta\":%s,\"running\":%d,\"done\":%d,\"failed\":%d,\"jobs\":[%s]}\n",
+                getSeconds(now),
+                bytes,
+                total_bytes,
+                frames,
+                gops,
+                bytes_per_second,
+                formatETA(total_bytes - bytes, bytes_per_second).c_str(),
+                (int)jobs.size(),
+                done_jobs,
+                failed_jobs,
+                job_list.c_str());
+        fflush(json_file);
+    }
+
+    if (console && total_bytes > 0)
+        fprintf(stderr, "%3d%%\r", (int)(bytes * 100 / total_bytes));
+}
+
+
+void Progress::finishJob(int job, bool success) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = jobs.find(job);
+    if (it == jobs.end())
+        return;
+
+    Clock::time_point now = Clock::now();
+
+    if (success)
+        done_jobs++;
+    else
+        failed_jobs++;
+
+    if (json_file) {
+        double seconds = std::chrono::duration<double>(now - it->second.start).count();
+
+        fprintf(json_file,
+                "{\"event\":\"%s\",\"time\":%.3f,\"name\":\"%s\",\"bytes\":%" PRId64 ",\"frames\":%" PRId64 ",\"gops\":%" PRId64 ",\"seconds\":%.3f,\"bytes_per_second\":%.0f}\n",
+                success ? "done" : "failed",
+                getSeconds(now),
+                escapeJSON(it->second.name).c_str(),
+                it->second.bytes,
+                it->second.frames,
+                it->second.gops,
+                seconds,
+                seconds > 0 ? it->second.bytes / seconds : 0);
+        fflush(json_file);
+    }
+
+    jobs.erase(it);
+}
@@ -0,0 +1,90 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+#ifndef D2V_WITCH_PROGRESS_H
+#define D2V_WITCH_PROGRESS_H
+
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+
+
+// Collects the progress of one or more indexing jobs, which may run at
+// the same time, and reports it at most a few times per second: as a
+// percentage on the console, and/or as JSON lines for other programs.
+class Progress {
+    typedef std::chrono::steady_clock Clock;
+
+    struct Job {
+        std::string name;
+        int64_t bytes;
+        int64_t total_bytes;
+        int64_t frames;
+        int64_t gops;
+        Clock::time_point start;
+
+        // For the current throughput.
+        int64_t last_bytes;
+        Clock::time_point last_time;
+        double bytes_per_second;
+    };
+
+    FILE *json_file;
+    bool console;
+    Clock::duration interval;
+
+    std::mutex mutex;
+    std::map<int, Job> jobs;
+    int next_job;
+    int done_jobs;
+    int failed_jobs;
+    Clock::time_point start;
+    Clock::time_point last_report;
+
+
+    double getSeconds(Clock::time_point time) const;
+
+    // Must be called with the mutex locked.
+    void updateThroughput(Job &job, Clock::time_point now);
+
+    // Must be called with the mutex locked.
+    void report(Clock::time_point now);
+
+public:
+    // json_file can be null. max_rate is in reports per second.
+    Progress(FILE *_json_file, bool _console, double _max_rate);
+
+    // The functions below are thread safe.
+
+    // Returns the job's id.
+    int startJob(const std::string &name, int64_t total_bytes);
+
+    // Cheap enough to call for every GOP.
+    void update(int job, int64_t bytes, int64_t frames, int64_t gops);
+
+    // Always reported, regardless of the rate limit.
+    void finishJob(int job, bool success);
+};
+
+
+#endif // D2V_WITCH_PROGRESS_H
@@ -0,0 +1,168 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#ifndef D2V_WITCH_SPSCQUEUE_H
+#define D2V_WITCH_SPSCQUEUE_H
+
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+// A bounded queue between exactly one producer thread and one consumer
+// thread, without locks. A full queue makes the producer wait, so a slow
+// consumer slows the producer down instead of using more memory.
+//
+// The producer calls close() when it has nothing more to push. The
+// consumer calls abort() when it stops early, so the producer doesn't
+// wait forever. Whatever is left in the queue after both threads are
+// done must be taken out with tryPop().
+template<typename T>
+class SPSCQueue {
+    // One slot is always empty, to tell a full queue from an empty one.
+    std::vector<T> slots;
+
+    // Written only by the consumer.
+    std::atomic<size_t> head;
+
+    // Written only by the producer.
+    std::atomic<size_t> tail;
+
+    std::atomic<bool> closed;
+    std::atomic<bool> aborted;
+
+
+    size_t next(size_t index) const {
+        return index + 1 == slots.size() ? 0 : index + 1;
+    }
+
+
+    // Spins briefly, then yields, then sleeps, so a stage waiting for a
+    // much slower one doesn't keep a core busy.
+    static void backOff(int &attempts) {
+        attempts++;
+
+        if (attempts < 64)
+            return;
+        else if (attempts < 128)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+public:
+    explicit SPSCQueue(size_t capacity)
+        : slots(capacity + 1)
+        , head(0)
+        , tail(0)
+        , closed(false)
+        , aborted(false)
+    { }
+
+    SPSCQueue(const SPSCQueue &) = delete;
+    SPSCQueue &operator=(const SPSCQueue &) = delete;
+
+
+    // Producer only. Moves the item into the queue, unless it's full.
+    bool tryPush(T &item) {
+        size_t current_tail = tail.load(std::memory_order_relaxed);
+        size_t next_tail = next(current_tail);
+
+        if (next_tail == head.load(std::memory_order_acquire))
+            return false;
+
+        slots[current_tail] = std::move(item);
+        tail.store(next_tail, std::memory_order_release);
+
+        return true;
+    }
+
+
+    // Consumer only.
+    bool tryPop(T &item) {
+        size_t current_head = head.load(std::memory_order_relaxed);
+
+        if (current_head == tail.load(std::memory_order_acquire))
+            return false;
+
+        item = std::move(slots[current_head]);
+        head.store(next(current_head), std::memory_order_release);
+
+        return true;
+    }
+
+
+    // Producer only. Waits while the queue is full. Returns false, without
+    // touching the item, if the consumer aborted.
+    bool push(T &item) {
+        int attempts = 0;
+
+        while (!aborted.load(std::memory_order_acquire)) {
+            if (tryPush(item))
+                return true;
+
+            backOff(attempts);
+        }
+
+        return false;
+    }
+
+
+    // Consumer only. Waits while the queue is empty. Returns false when
+    // the queue is empty and closed.
+    bool pop(T &item) {
+        int attempts = 0;
+
+        while (true) {
+            if (tryPop(item))
+                return true;
+
+            // Something may have been pushed right before close().
+            if (closed.load(std::memory_order_acquire))
+                return tryPop(item);
+
+            backOff(attempts);
+        }
+    }
+
+
+    // Producer only.
+    void close() {
+        closed.store(true, std::memory_order_release);
+    }
+
+
+    // Consumer only.
+    void abort() {
+        aborted.store(true, std::memory_order_release);
+    }
+
+
+    bool isAborted() const {
+        return aborted.load(std::memory_order_acquire);
+    }
+};
+
+
+#endif // D2V_WITCH_SPSCQUEUE_H
@@ -0,0 +1,386 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#include <algorithm>
+#include <cinttypes>
+
+#include "Sinks.h"
+
+
+static char getPictureType(uint8_t flags) {
+    uint8_t type = flags & D2V::FLAGS_B_PICTURE;
+
+    if (type == D2V::FLAGS_I_PICTURE)
+        return 'I';
+    else if (type == D2V::FLAGS_P_PICTURE)
+        return 'P';
+    else if (type == D2V::FLAGS_B_PICTURE)
+        return 'B';
+
+    return '?';
+}
+
+
+KeyframeSink::KeyframeSink(FILE *_file)
+    : file(_file)
+{ }
+
+
+bool KeyframeSink::start(AVRational time_base, AVRational frame_rate, std::string &err) {
+    (void)time_base;
+
+    double fps = frame_rate.den ? (double)frame_rate.num / frame_rate.den : 0;
+
+    if (fprintf(file, "# keyframe format v1\nfps %.6f\n", fps) < 0) {
+        err = "Failed to write the keyframe list: fprintf() failed.";
+        return false;
+    }
+
+    return true;
+}
+
+
+bool KeyframeSink::handleLine(const D2V::LineEvent &event, std::string &err) {
+    const std::vector<uint8_t> &flags = event.line->flags;
+
+    for (size_t i = 0; i < flags.size(); i++) {
+        if (getPictureType(flags[i]) != 'I')
+            continue;
+
+        if (fprintf(file, "%" PRId64 "\n", event.first_picture + (int64_t)i) < 0) {
+            err = "Failed to write the keyframe list: fprintf() failed.";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+TimecodeSink::TimecodeSink(FILE *_file)
+    : file(_file)
+    , time_base{ 1, 90000 }
+    , frame_duration(0)
+    , first_pts(AV_NOPTS_VALUE)
+    , last_time(0)
+    , have_time(false)
+{ }
+
+
+bool TimecodeSink::start(AVRational _time_base, AVRational frame_rate, std::string &err) {
+    time_base = _time_base;
+
+    if (frame_rate.num > 0 && frame_rate.den > 0)
+        frame_duration = 1000.0 * frame_rate.den / frame_rate.num;
+    else
+        frame_duration = 40;
+
+    if (fprintf(file, "# timecode format v2\n") < 0) {
+        err = "Failed to write the timecodes: fprintf() failed.";
+        return false;
+    }
+
+    return true;
+}
+
+
+bool TimecodeSink::handleLine(const D2V::LineEvent &event, std::string &err) {
+    const std::vector<int64_t> &pts = *event.pts;
+
+    // The first displayed picture has the lowest timestamp of the first GOP.
+    if (first_pts == AV_NOPTS_VALUE)
+        for (size_t i = 0; i < pts.size(); i++)
+            if (pts[i] != AV_NOPTS_VALUE && (first_pts == AV_NOPTS_VALUE || pts[i] < first_pts))
+                first_pts = pts[i];
+
+    for (size_t i = 0; i < pts.size(); i++) {
+        double time;
+
+        if (pts[i] != AV_NOPTS_VALUE && first_pts != AV_NOPTS_VALUE)
+            time = (pts[i] - first_pts) * 1000.0 * time_base.num / time_base.den;
+        else
+            time = have_time ? last_time + frame_duration : 0;
+
+        if (have_time && time <= last_time)
+            time = last_time + frame_duration;
+
+        if (fprintf(file, "%.3f\n", time) < 0) {
+            err = "Failed to write the timecodes: fprintf() failed.";
+            return false;
+        }
+
+        last_time = time;
+        have_time = true;
+    }
+
+    return true;
+}
+
+
+GOPJSONSink::GOPJSONSink(FILE *_file)
+    : file(_file)
+{ }
+
+
+bool GOPJSONSink::handleLine(const D2V::LineEvent &event, std::string &err) {
+    const D2V::DataLine &line = *event.line;
+
+    std::string types;
+    std::string pts = "[";
+
+    for (size_t i = 0; i < line.flags.size(); i++) {
+        types += getPictureType(line.flags[i]);
+
+        if (i)
+            pts += ",";
+
+        int64_t value = (*event.pts)[i];
+        pts += value == AV_NOPTS_VALUE ? "null" : std::to_string(value);
+    }
+
+    pts += "]";
+
+    if (fprintf(file,
+                "{\"line\":%d,\"file\":%d,\"position\":%" PRId64 ",\"first_picture\":%" PRId64 ",\"pictures\":%d,"
+                "\"new_gop\":%s,\"closed_gop\":%s,\"progressive_sequence\":%s,\"skip\":%d,\"types\":\"%s\",\"pts\":%s}\n",
+                event.line_number,
+                line.file,
+                line.position,
+                event.first_picture,
+                (int)line.flags.size(),
+                (line.info & D2V::INFO_STARTS_NEW_GOP) ? "true" : "false",
+                (line.info & D2V::INFO_CLOSED_GOP) ? "true" : "false",
+                (line.info & D2V::INFO_PROGRESSIVE_SEQUENCE) ? "true" : "false",
+                line.skip,
+                types.c_str(),
+                pts.c_str()) < 0) {
+        err = "Failed to write the GOP list: fprintf() failed.";
+        return false;
+    }
+
+    return true;
+}
+
+
+CaptionSink::CaptionSink(FILE *_file, bool _scc)
+    : file(_file)
+    , scc(_scc)
+    , frame_rate{ 30000, 1001 }
+    , fields(0)
+    , next_frame(0)
+    , in_scc_line(false)
+{ }
+
+
+std::string CaptionSink::getTimecode(int64_t frame) const {
+    char timecode[20] = { 0 };
+
+    if (frame_rate.num == 30000 && frame_rate.den == 1001) {
+        // Drop frame: frames 0 and 1 of every minute don't exist, except
+        // every tenth minute.
+        int64_t ten_minutes = frame / 17982;
+        int64_t rest = frame % 17982;
+        int64_t dropped = 18 * ten_minutes;
+        if (rest >= 2)
+            dropped += 2 * ((rest - 2) / 1798);
+
+        int64_t n = frame + dropped;
+
+        snprintf(timecode, sizeof(timecode), "%02d:%02d:%02d;%02d", (int)(n / 108000), (int)(n / 1800 % 60), (int)(n / 30 % 60), (int)(n % 30));
+    } else {
+        int fps = (int)((frame_rate.num + frame_rate.den / 2) / frame_rate.den);
+        if (fps <= 0)
+            fps = 30;
+
+        int64_t seconds = frame / fps;
+
+        snprintf(timecode, sizeof(timecode), "%02d:%02d:%02d:%02d", (int)(seconds / 3600), (int)(seconds / 60 % 60), (int)(seconds % 60), (int)(frame % fps));
+    }
+
+    return timecode;
+}
+
+
+bool CaptionSink::start(AVRational time_base, AVRational _frame_rate, std::string &err) {
+    (void)time_base;
+
+    if (_frame_rate.num > 0 && _frame_rate.den > 0)
+        frame_rate = _frame_rate;
+
+    // The SCC lines each start with an empty line.
+    const char *header = scc ? "Scenarist_SCC V1.0" : "# cc_data v1\n# picture cc_data...\n";
+
+    if (fprintf(file, "%s", header) < 0) {
+        err = "Failed to write the captions: fprintf() failed.";
+        return false;
+    }
+
+    return true;
+}
+
+
+bool CaptionSink::handleLine(const D2V::LineEvent &event, std::string &err) {
+    const std::vector<MPEGParser::UserData> &user_data = *event.user_data;
+
+    for (size_t i = 0; i < user_data.size(); i++) {
+        const std::vector<uint8_t> &cc_data = user_data[i].cc_data;
+        int64_t picture = event.first_picture + (int64_t)i;
+
+        // The first frame that starts during this picture. A picture with
+        // repeat_first_field lasts three fields and normally carries two
+        // words for the first field.
+        int64_t first_frame = (fields + 1) / 2;
+        fields += (i < event.line->flags.size() && (event.line->flags[i] & D2V::FLAGS_RFF)) ? 3 : 2;
+
+        std::string text;
+
+        if (scc) {
+            int words = 0;
+
+            for (size_t j = 0; j + 2 < cc_data.size(); j += 3) {
+                bool cc_valid = cc_data[j] & 4;
+                int cc_type = cc_data[j] & 3;
+
+                // Field 1 only.
+                if (!cc_valid || cc_type != 0)
+                    continue;
+
+                int64_t frame = std::max(first_frame + words, next_frame);
+                words++;
+
+                // After a gap, a new SCC line starts.
+                bool line_goes_on = in_scc_line && frame == next_frame;
+
+                next_frame = frame + 1;
+
+                if (cc_data[j + 1] == 0x80 && cc_data[j + 2] == 0x80) {
+                    in_scc_line = false;
+                    continue;
+                }
+
+                if (line_goes_on)
+                    text += " ";
+                else
+                    text += "\n\n" + getTimecode(frame) + "\t";
+
+                char word[8] = { 0 };
+                snprintf(word, sizeof(word), "%02x%02x", cc_data[j + 1], cc_data[j + 2]);
+                text += word;
+
+                in_scc_line = true;
+            }
+
+            if (!text.size())
+                continue;
+        } else {
+            if (cc_data.size() < 3)
+                continue;
+
+            text = std::to_string(picture);
+
+            for (size_t j = 0; j + 2 < cc_data.size(); j += 3) {
+                char triple[8] = { 0 };
+                snprintf(triple, sizeof(triple), " %02x%02x%02x", cc_data[j], cc_data[j + 1], cc_data[j + 2]);
+                text += triple;
+            }
+
+            text += "\n";
+        }
+
+        if (fprintf(file, "%s", text.c_str()) < 0) {
+            err = "Failed to write the captions: fprintf() failed.";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool CaptionSink::finish(std::string &err) {
+    if (scc && fprintf(file, "\n") < 0) {
+        err = "Failed to write the captions: fprintf() failed.";
+        return false;
+    }
+
+    return true;
+}
+
+
+AFDSink::AFDSink(FILE *_file)
+    : file(_file)
+    , last{ }
+{ }
+
+
+bool AFDSink::start(AVRational time_base, AVRational frame_rate, std::string &err) {
+    (void)time_base;
+    (void)frame_rate;
+
+    if (fprintf(file, "# picture active_format bar_top bar_bottom bar_left bar_right\n") < 0) {
+        err = "Failed to write the active format descriptions: fprintf() failed.";
+        return false;
+    }
+
+    return true;
+}
+
+
+bool AFDSink::handleLine(const D2V::LineEvent &event, std::string &err) {
+    const std::vector<MPEGParser::UserData> &user_data = *event.user_data;
+
+    for (size_t i = 0; i < user_data.size(); i++) {
+        const MPEGParser::UserData &data = user_data[i];
+
+        MPEGParser::UserData current = last;
+        if (data.active_format >= 0)
+            current.active_format = data.active_format;
+
+        // Bar data always comes as a whole.
+        if (data.bar_top >= 0 || data.bar_bottom >= 0 || data.bar_left >= 0 || data.bar_right >= 0) {
+            current.bar_top = data.bar_top;
+            current.bar_bottom = data.bar_bottom;
+            current.bar_left = data.bar_left;
+            current.bar_right = data.bar_right;
+        }
+
+        if (current.active_format == last.active_format &&
+            current.bar_top == last.bar_top &&
+            current.bar_bottom == last.bar_bottom &&
+            current.bar_left == last.bar_left &&
+            current.bar_right == last.bar_right)
+            continue;
+
+        if (fprintf(file, "%" PRId64 " %d %d %d %d %d\n",
+                    event.first_picture + (int64_t)i,
+                    current.active_format,
+                    current.bar_top,
+                    current.bar_bottom,
+                    current.bar_left,
+                    current.bar_right) < 0) {
+            err = "Failed to write the active format descriptions: fprintf() failed.";
+            return false;
+        }
+
+        last = current;
+    }
+
+    return true;
+}
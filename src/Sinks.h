@@ -0,0 +1,126 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#ifndef D2V_WITCH_SINKS_H
+#define D2V_WITCH_SINKS_H
+
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+extern "C" {
+#include <libavutil/rational.h>
+}
+
+#include "D2V.h"
+
+
+// The picture numbers of the I pictures, in Aegisub's keyframe format.
+class KeyframeSink : public D2V::Sink {
+    FILE *file;
+
+public:
+    KeyframeSink(FILE *_file);
+
+    bool start(AVRational time_base, AVRational frame_rate, std::string &err) override;
+
+    bool handleLine(const D2V::LineEvent &event, std::string &err) override;
+};
+
+
+// The time of every picture in milliseconds, in mkvmerge's timecode
+// format v2, from the PTS. Pictures without a PTS, or whose PTS would make
+// the times go backwards, get the previous time plus one frame.
+class TimecodeSink : public D2V::Sink {
+    FILE *file;
+    AVRational time_base;
+    double frame_duration;
+    int64_t first_pts;
+    double last_time;
+    bool have_time;
+
+public:
+    TimecodeSink(FILE *_file);
+
+    bool start(AVRational _time_base, AVRational frame_rate, std::string &err) override;
+
+    bool handleLine(const D2V::LineEvent &event, std::string &err) override;
+};
+
+
+// One JSON object per GOP, one per line of the file.
+class GOPJSONSink : public D2V::Sink {
+    FILE *file;
+
+public:
+    GOPJSONSink(FILE *_file);
+
+    bool handleLine(const D2V::LineEvent &event, std::string &err) override;
+};
+
+
+// The closed captions from the pictures' ATSC A/53 user data, in display
+// order. Either the raw cc_data of every picture that has some, as hex
+// after the picture number, or, in SCC format, the CEA-608 data of the
+// first field. The SCC timecodes count frames from the pictures' fields,
+// so pictures with repeat_first_field take one and a half frames, and
+// every caption word takes one frame.
+class CaptionSink : public D2V::Sink {
+    FILE *file;
+    bool scc;
+    AVRational frame_rate;
+    // The fields of all the pictures so far.
+    int64_t fields;
+    // The frame after the last caption word or padding.
+    int64_t next_frame;
+    // The current SCC line goes on at next_frame.
+    bool in_scc_line;
+
+    std::string getTimecode(int64_t frame) const;
+
+public:
+    CaptionSink(FILE *_file, bool _scc);
+
+    bool start(AVRational time_base, AVRational _frame_rate, std::string &err) override;
+
+    bool handleLine(const D2V::LineEvent &event, std::string &err) override;
+
+    bool finish(std::string &err) override;
+};
+
+
+// The Active Format Description and bar data, with the number of the
+// picture where they change. Pictures that don't have them keep the
+// previous values.
+class AFDSink : public D2V::Sink {
+    FILE *file;
+    MPEGParser::UserData last;
+
+public:
+    AFDSink(FILE *_file);
+
+    bool start(AVRational time_base, AVRational frame_rate, std::string &err) override;
+
+    bool handleLine(const D2V::LineEvent &event, std::string &err) override;
+};
+
+
+#endif // D2V_WITCH_SINKS_H
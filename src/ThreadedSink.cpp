@@ -0,0 +1,93 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#include "ThreadedSink.h"
+
+
+ThreadedSink::ThreadedSink(D2V::Sink *_sink, size_t queue_length)
+    : sink(_sink)
+    , queue(queue_length)
+    , thread{ }
+    , sink_error{ }
+{ }
+
+
+ThreadedSink::~ThreadedSink() {
+    stop();
+}
+
+
+void ThreadedSink::work() {
+    Item item;
+
+    while (queue.pop(item)) {
+        D2V::LineEvent event = { item.line_number, &item.line, item.first_picture, &item.pts, &item.user_data };
+
+        if (!sink->handleLine(event, sink_error)) {
+            queue.abort();
+            break;
+        }
+    }
+}
+
+
+// Lets the thread handle whatever is still queued.
+void ThreadedSink::stop() {
+    if (!thread.joinable())
+        return;
+
+    queue.close();
+    thread.join();
+}
+
+
+bool ThreadedSink::start(AVRational time_base, AVRational frame_rate, std::string &err) {
+    if (!sink->start(time_base, frame_rate, err))
+        return false;
+
+    thread = std::thread(&ThreadedSink::work, this);
+
+    return true;
+}
+
+
+bool ThreadedSink::handleLine(const D2V::LineEvent &event, std::string &err) {
+    Item item = { event.line_number, *event.line, event.first_picture, *event.pts, *event.user_data };
+
+    if (!queue.push(item)) {
+        stop();
+        err = sink_error;
+        return false;
+    }
+
+    return true;
+}
+
+
+bool ThreadedSink::finish(std::string &err) {
+    stop();
+
+    if (queue.isAborted()) {
+        err = sink_error;
+        return false;
+    }
+
+    return sink->finish(err);
+}
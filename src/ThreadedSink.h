@@ -0,0 +1,70 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#ifndef D2V_WITCH_THREADEDSINK_H
+#define D2V_WITCH_THREADEDSINK_H
+
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "D2V.h"
+#include "SPSCQueue.h"
+
+
+// Runs another sink on its own thread, so that a slow sink doesn't slow
+// the indexing down, until its queue is full. The events are copied.
+class ThreadedSink : public D2V::Sink {
+    struct Item {
+        int line_number;
+        D2V::DataLine line;
+        int64_t first_picture;
+        std::vector<int64_t> pts;
+        std::vector<MPEGParser::UserData> user_data;
+    };
+
+    D2V::Sink *sink;
+    SPSCQueue<Item> queue;
+    std::thread thread;
+
+    // Only touched by the thread until the queue is aborted.
+    std::string sink_error;
+
+
+    void work();
+
+    void stop();
+
+public:
+    ThreadedSink(D2V::Sink *_sink, size_t queue_length);
+    ~ThreadedSink();
+
+    // The wrapped sink's start() and finish() are called on the calling thread.
+    bool start(AVRational time_base, AVRational frame_rate, std::string &err) override;
+
+    bool handleLine(const D2V::LineEvent &event, std::string &err) override;
+
+    bool finish(std::string &err) override;
+};
+
+
+#endif // D2V_WITCH_THREADEDSINK_H
@@ -0,0 +1,169 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "Throttle.h"
+
+
+// Never go below this, or a very slow disk could stop indexing entirely.
+static const double minimum_rate = 64 * 1024;
+
+// How often the rate may change, in seconds.
+static const double adjustment_interval = 1;
+
+
+Throttle::Throttle(double _max_rate, double _latency_threshold)
+    : max_rate(_max_rate)
+    , latency_threshold(_latency_threshold)
+    , rate(_max_rate)
+    , tokens(0)
+    , last_refill(Clock::now())
+    , smoothed_latency(0)
+    , last_adjustment(last_refill)
+    , bytes_since_adjustment(0)
+    , stats{ 0, 0, 0, 0, 0, _max_rate }
+{ }
+
+
+void Throttle::refill(Clock::time_point now) {
+    double seconds = std::chrono::duration<double>(now - last_refill).count();
+    last_refill = now;
+
+    if (rate <= 0)
+        return;
+
+    // A quarter of a second of reading can happen at full speed.
+    double burst = std::max(rate / 4, 256.0 * 1024);
+
+    tokens = std::min(burst, tokens + rate * seconds);
+}
+
+
+void Throttle::acquire(int64_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    refill(Clock::now());
+
+    if (rate <= 0)
+        return;
+
+    // Going into debt makes the next reader wait longer, so several
+    // threads sharing the throttle queue up fairly.
+    tokens -= bytes;
+    if (tokens >= 0)
+        return;
+
+    double wait = -tokens / rate;
+    stats.waited_seconds += wait;
+
+    lock.unlock();
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+}
+
+
+void Throttle::adjustRate(Clock::time_point now) {
+    double seconds = std::chrono::duration<double>(now - last_adjustment).count();
+    if (seconds < adjustment_interval)
+        return;
+
+    double throughput = bytes_since_adjustment / seconds;
+
+    last_adjustment = now;
+    bytes_since_adjustment = 0;
+
+    if (smoothed_latency > latency_threshold) {
+        // Without a limit, start from what was actually read.
+        double current = rate > 0 ? rate : throughput;
+
+        rate = std::max(minimum_rate, current / 2);
+        stats.backoffs++;
+    } else if (smoothed_latency < latency_threshold / 2 && rate > 0) {
+        rate *= 1.25;
+
+        if (max_rate > 0)
+            rate = std::min(rate, max_rate);
+        else if (rate > throughput * 4)
+            // Far more than is being read anyway, so the limit does nothing.
+            rate = 0;
+    }
+
+    stats.current_rate = rate;
+}
+
+
+void Throttle::finishRead(int64_t bytes, Clock::duration latency) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    double milliseconds = std::chrono::duration<double, std::milli>(latency).count();
+
+    stats.bytes += bytes;
+    stats.reads++;
+    stats.average_latency_ms += (milliseconds - stats.average_latency_ms) / stats.reads;
+
+    if (latency_threshold <= 0)
+        return;
+
+    bytes_since_adjustment += bytes;
+
+    if (stats.reads == 1)
+        smoothed_latency = milliseconds;
+    else
+        smoothed_latency = smoothed_latency * 0.9 + milliseconds * 0.1;
+
+    adjustRate(Clock::now());
+}
+
+
+Throttle::Stats Throttle::getStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return stats;
+}
+
+
+bool Throttle::setIdleIOPriority(std::string &err) {
+#if defined(__linux__) && defined(SYS_ioprio_set)
+    // From linux/ioprio.h, which isn't always installed.
+    const int ioprio_who_process = 1;
+    const int ioprio_class_idle = 3;
+    const int ioprio_class_shift = 13;
+
+    if (syscall(SYS_ioprio_set, ioprio_who_process, 0, ioprio_class_idle << ioprio_class_shift) < 0) {
+        err = "Failed to set the idle I/O priority: ";
+        err += strerror(errno);
+        return false;
+    }
+
+    return true;
+#else
+    err = "Setting the I/O priority is only supported on Linux.";
+    return false;
+#endif
+}
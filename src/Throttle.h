@@ -0,0 +1,93 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#ifndef D2V_WITCH_THROTTLE_H
+#define D2V_WITCH_THROTTLE_H
+
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+
+// Limits how fast the input files are read, so that indexing doesn't
+// starve other users of the same storage. A token bucket enforces the
+// rate. When a latency threshold is given, the rate is halved whenever
+// reads get slower than that, and slowly raised again when they are fast.
+// One throttle can be shared by several threads and files.
+class Throttle {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Stats {
+        int64_t bytes;
+        int64_t reads;
+        double waited_seconds;
+        double average_latency_ms;
+        int backoffs;
+        // Bytes per second. 0 means unlimited.
+        double current_rate;
+    };
+
+    // max_rate is in bytes per second, latency_threshold in milliseconds.
+    // 0 means no limit, or no latency check.
+    Throttle(double _max_rate, double _latency_threshold);
+
+    // Call before reading. Waits until the bytes may be read.
+    void acquire(int64_t bytes);
+
+    // Call after reading, with the time the read took.
+    void finishRead(int64_t bytes, Clock::duration latency);
+
+    Stats getStats();
+
+    // Puts the calling thread, and the threads it starts afterwards, in the
+    // idle I/O scheduling class, so their reads are only served when no one
+    // else wants the disk. Only on Linux.
+    static bool setIdleIOPriority(std::string &err);
+
+private:
+    double max_rate;
+    double latency_threshold;
+
+    std::mutex mutex;
+
+    // The rate currently enforced. 0 means unlimited.
+    double rate;
+    double tokens;
+    Clock::time_point last_refill;
+
+    double smoothed_latency;
+    Clock::time_point last_adjustment;
+    int64_t bytes_since_adjustment;
+
+    Stats stats;
+
+
+    // Must be called with the mutex locked.
+    void refill(Clock::time_point now);
+
+    // Must be called with the mutex locked.
+    void adjustRate(Clock::time_point now);
+};
+
+
+#endif // D2V_WITCH_THROTTLE_H
@@ -0,0 +1,98 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "Bullshit.h"
+#include "Thumbnailer.h"
+
+
+Thumbnailer::Thumbnailer(AVCodecID _codec_id, const uint8_t *_extradata, int _extradata_size, int _threads, const std::string &_directory, int _width)
+    : DecoderPool(_codec_id, _extradata, _extradata_size, _threads)
+    , directory(_directory)
+    , width(_width)
+{
+    start();
+}
+
+
+Thumbnailer::~Thumbnailer() {
+    finish();
+}
+
+
+bool Thumbnailer::handleFrame(const Job &job, int frame_number, const AVFrame *frame, std::string &err) {
+    if (frame_number > 0)
+        return true;
+
+    if (frame->width <= 0 || frame->height <= 0)
+        return true;
+
+    int thumb_width = std::min(width, frame->width);
+    int thumb_height = std::max(1, (int)((int64_t)frame->height * thumb_width / frame->width));
+
+    std::vector<uint8_t> thumbnail(thumb_width * thumb_height);
+
+    // Box filter over the luma plane.
+    for (int y = 0; y < thumb_height; y++) {
+        int src_top = y * frame->height / thumb_height;
+        int src_bottom = std::max(src_top + 1, (y + 1) * frame->height / thumb_height);
+
+        for (int x = 0; x < thumb_width; x++) {
+            int src_left = x * frame->width / thumb_width;
+            int src_right = std::max(src_left + 1, (x + 1) * frame->width / thumb_width);
+
+            unsigned sum = 0;
+            for (int sy = src_top; sy < src_bottom; sy++) {
+                const uint8_t *src = frame->data[0] + sy * frame->linesize[0];
+                for (int sx = src_left; sx < src_right; sx++)
+                    sum += src[sx];
+            }
+
+            thumbnail[y * thumb_width + x] = sum / ((src_bottom - src_top) * (src_right - src_left));
+        }
+    }
+
+    char name[32] = { 0 };
+    snprintf(name, 32, "%08d.pgm", job.line_number);
+
+    std::string path = directory + "/" + name;
+
+    FILE *file = openFile(path.c_str(), "wb");
+    if (!file) {
+        err = "Failed to open thumbnail file '" + path + "' for writing: " + strerror(errno);
+        return false;
+    }
+
+    bool okay = fprintf(file, "P5\n%d %d\n255\n", thumb_width, thumb_height) >= 0 &&
+                fwrite(thumbnail.data(), 1, thumbnail.size(), file) == thumbnail.size();
+
+    if (fclose(file))
+        okay = false;
+
+    if (!okay) {
+        err = "Failed to write thumbnail file '" + path + "'.";
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,45 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#ifndef D2V_WITCH_THUMBNAILER_H
+#define D2V_WITCH_THUMBNAILER_H
+
+
+#include <string>
+
+#include "DecoderPool.h"
+
+
+// Writes a greyscale thumbnail (PGM) of the first picture of each job.
+// The files are named after the D2V line number.
+class Thumbnailer : public DecoderPool {
+    std::string directory;
+    int width;
+
+protected:
+    bool handleFrame(const Job &job, int frame_number, const AVFrame *frame, std::string &err);
+
+public:
+    Thumbnailer(AVCodecID _codec_id, const uint8_t *_extradata, int _extradata_size, int _threads, const std::string &_directory, int _width);
+    ~Thumbnailer();
+};
+
+
+#endif // D2V_WITCH_THUMBNAILER_H
@@ -0,0 +1,349 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+#include <algorithm>
+#include <cinttypes>
+
+#include "Bullshit.h"
+#include "Timestamps.h"
+
+
+static void writeVarint(std::string &buffer, int64_t value) {
+    // Zigzag: small negative numbers become small positive numbers.
+    uint64_t zigzag = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+
+    while (zigzag >= 0x80) {
+        buffer += (char)((zigzag & 0x7f) | 0x80);
+        zigzag >>= 7;
+    }
+
+    buffer += (char)zigzag;
+}
+
+
+static bool readVarint(FILE *file, int64_t *value) {
+    uint64_t zigzag = 0;
+
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(file);
+        if (c == EOF)
+            return false;
+
+        zigzag |= (uint64_t)(c & 0x7f) << shift;
+
+        if (!(c & 0x80)) {
+            *value = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+Timestamps::Timestamps()
+    : time_base{ 1, 90000 }
+    , last_timestamp(AV_NOPTS_VALUE)
+{ }
+
+
+void Timestamps::setTimeBase(AVRational _time_base) {
+    time_base = _time_base;
+}
+
+
+Timestamps::Picture Timestamps::makePicture(int64_t pts, int64_t dts) {
+    Picture picture = { pts, dts, false };
+
+    int64_t timestamp = dts != AV_NOPTS_VALUE ? dts : pts;
+    if (timestamp == AV_NOPTS_VALUE)
+        return picture;
+
+    int64_t max_jump = 5 * (int64_t)time_base.den / std::max(1, time_base.num);
+
+    if (last_timestamp != AV_NOPTS_VALUE &&
+        (timestamp < last_timestamp || timestamp - last_timestamp > max_jump))
+        picture.discontinuity = true;
+
+    last_timestamp = timestamp;
+
+    return picture;
+}
+
+
+void Timestamps::addLine(const std::vector<Picture> &line) {
+    pictures.insert(pictures.end(), line.begin(), line.end());
+}
+
+
+void Timestamps::addAudioDelay(int id, int64_t milliseconds) {
+    audio_delays.push_back({ id, milliseconds });
+}
+
+
+bool Timestamps::write(FILE *file) {
+    std::string buffer;
+
+    buffer += "D2VWitch timestamps 1\n";
+    buffer += "time_base=" + std::to_string(time_base.num) + "/" + std::to_string(time_base.den) + "\n";
+    buffer += "pictures=" + std::to_string(pictures.size()) + "\n";
+
+    for (size_t i = 0; i < audio_delays.size(); i++) {
+        char id[20] = { 0 };
+        snprintf(id, 19, "%x", audio_delays[i].id);
+        buffer += "audio_delay=";
+        buffer += id;
+        buffer += " " + std::to_string(audio_delays[i].milliseconds) + "\n";
+    }
+
+    buffer += "\n";
+
+    int64_t previous_dts = 0;
+    int64_t previous_pts = 0;
+
+    for (size_t i = 0; i < pictures.size(); i++) {
+        const Picture &picture = pictures[i];
+
+        int flags = 0;
+        if (picture.pts != AV_NOPTS_VALUE)
+            flags |= HAS_PTS;
+        if (picture.dts != AV_NOPTS_VALUE)
+            flags |= HAS_DTS;
+        if (picture.discontinuity)
+            flags |= DISCONTINUITY;
+
+        buffer += (char)flags;
+
+        if (flags & HAS_DTS) {
+            writeVarint(buffer, picture.dts - previous_dts);
+            previous_dts = picture.dts;
+        }
+
+        if (flags & HAS_PTS) {
+            writeVarint(buffer, picture.pts - ((flags & HAS_DTS) ? picture.dts : previous_pts));
+            previous_pts = picture.pts;
+        }
+
+        if (buffer.size() >= 64 * 1024) {
+            if (fwrite(buffer.data(), 1, buffer.size(), file) < buffer.size()) {
+                error = "Failed to write timestamps: fwrite() failed.";
+                return false;
+            }
+
+            buffer.clear();
+        }
+    }
+
+    if (buffer.size() && fwrite(buffer.data(), 1, buffer.size(), file) < buffer.size()) {
+        error = "Failed to write timestamps: fwrite() failed.";
+        return false;
+    }
+
+    return true;
+}
+
+
+bool Timestamps::read(const std::string &path) {
+    pictures.clear();
+    audio_delays.clear();
+    timeline.clear();
+
+    FILE *file = openFile(path.c_str(), "rb");
+    if (!file) {
+        error = "Failed to open timestamps file '" + path + "': " + strerror(errno);
+        return false;
+    }
+
+    int64_t picture_count = -1;
+    bool okay = true;
+
+    char line[512];
+    for (int line_number = 0; okay; line_number++) {
+        if (!fgets(line, sizeof(line), file)) {
+            error = "The file is truncated.";
+            okay = false;
+            break;
+        }
+
+        std::string text(line);
+        while (text.size() && (text.back() == '\n' || text.back() == '\r'))
+            text.pop_back();
+
+        if (line_number == 0) {
+            if (text != "D2VWitch timestamps 1") {
+                error = "Not a timestamps file, or an unsupported version.";
+                okay = false;
+            }
+        } else if (!text.size()) {
+            break;
+        } else if (text.compare(0, 10, "time_base=") == 0) {
+            if (sscanf(text.c_str() + 10, "%d/%d", &time_base.num, &time_base.den) != 2 || time_base.num <= 0 || time_base.den <= 0) {
+                error = "Invalid time base '" + text + "'.";
+                okay = false;
+            }
+        } else if (text.compare(0, 9, "pictures=") == 0) {
+            if (sscanf(text.c_str() + 9, "%" SCNd64, &picture_count) != 1 || picture_count < 0) {
+                error = "Invalid number of pictures '" + text + "'.";
+                okay = false;
+            }
+        } else if (text.compare(0, 12, "audio_delay=") == 0) {
+            AudioDelay delay;
+            if (sscanf(text.c_str() + 12, "%x %" SCNd64, &delay.id, &delay.milliseconds) != 2) {
+                error = "Invalid audio delay '" + text + "'.";
+                okay = false;
+            }
+            audio_delays.push_back(delay);
+        }
+        // Unknown lines are ignored, for the benefit of future versions.
+    }
+
+    if (okay && picture_count < 0) {
+        error = "The number of pictures is missing.";
+        okay = false;
+    }
+
+    int64_t previous_dts = 0;
+    int64_t previous_pts = 0;
+
+    for (int64_t i = 0; i < picture_count && okay; i++) {
+        Picture picture = { AV_NOPTS_VALUE, AV_NOPTS_VALUE, false };
+
+        int flags = fgetc(file);
+        if (flags == EOF) {
+            error = "The file is truncated.";
+            okay = false;
+            break;
+        }
+
+        int64_t delta;
+
+        if (flags & HAS_DTS) {
+            okay = readVarint(file, &delta);
+            picture.dts = previous_dts + delta;
+            previous_dts = picture.dts;
+        }
+
+        if (okay && (flags & HAS_PTS)) {
+            okay = readVarint(file, &delta);
+            picture.pts = ((flags & HAS_DTS) ? picture.dts : previous_pts) + delta;
+            previous_pts = picture.pts;
+        }
+
+        if (!okay)
+            error = "The file is truncated.";
+
+        picture.discontinuity = flags & DISCONTINUITY;
+
+        pictures.push_back(picture);
+    }
+
+    fclose(file);
+
+    if (!okay) {
+        error = "Failed to read timestamps file '" + path + "': " + error;
+        return false;
+    }
+
+    buildTimeline();
+
+    return true;
+}
+
+
+void Timestamps::buildTimeline() {
+    timeline.clear();
+
+    int64_t offset = 0;
+    int64_t first_time = AV_NOPTS_VALUE;
+    int64_t end_time = AV_NOPTS_VALUE;
+    int64_t previous_pts = AV_NOPTS_VALUE;
+    int64_t duration = 0;
+
+    for (size_t i = 0; i < pictures.size(); i++) {
+        const Picture &picture = pictures[i];
+
+        if (picture.pts == AV_NOPTS_VALUE)
+            continue;
+
+        // Whatever comes after a discontinuity continues right after the
+        // last picture before it.
+        if (picture.discontinuity && end_time != AV_NOPTS_VALUE)
+            offset = end_time + duration - picture.pts;
+
+        if (previous_pts != AV_NOPTS_VALUE && !picture.discontinuity && picture.pts > previous_pts)
+            duration = picture.pts - previous_pts;
+        previous_pts = picture.pts;
+
+        int64_t time = picture.pts + offset;
+
+        if (first_time == AV_NOPTS_VALUE)
+            first_time = time;
+
+        if (end_time == AV_NOPTS_VALUE || time > end_time)
+            end_time = time;
+
+        timeline.push_back({ time - first_time, (int64_t)i });
+    }
+
+    std::sort(timeline.begin(), timeline.end());
+}
+
+
+AVRational Timestamps::getTimeBase() const {
+    return time_base;
+}
+
+
+const std::vector<Timestamps::Picture> &Timestamps::getPictures() const {
+    return pictures;
+}
+
+
+const std::vector<Timestamps::AudioDelay> &Timestamps::getAudioDelays() const {
+    return audio_delays;
+}
+
+
+int64_t Timestamps::getPictureAtTime(double seconds) const {
+    if (!timeline.size() || seconds < 0)
+        return -1;
+
+    // The small bias protects against times just under a picture's timestamp.
+    int64_t time = (int64_t)((seconds * time_base.den) / time_base.num + 1e-3);
+
+    auto it = std::upper_bound(timeline.begin(), timeline.end(), std::make_pair(time, INT64_MAX));
+    if (it == timeline.begin())
+        return -1;
+
+    it--;
+
+    // Past the end of the last picture.
+    if (it == timeline.end() - 1 && timeline.size() > 1) {
+        int64_t last_duration = timeline.back().first - timeline[timeline.size() - 2].first;
+        if (time >= timeline.back().first + last_duration)
+            return -1;
+    }
+
+    return it->second;
+}
+
+
+const std::string &Timestamps::getError() const {
+    return error;
+}
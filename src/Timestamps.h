@@ -0,0 +1,123 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+#ifndef D2V_WITCH_TIMESTAMPS_H
+#define D2V_WITCH_TIMESTAMPS_H
+
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <libavutil/avutil.h>
+}
+
+
+// The presentation and decoding timestamps of every video picture, in
+// the same order as the flags in the D2V file, plus the audio delays.
+//
+// The sidecar file starts with a few text lines:
+//
+//   D2VWitch timestamps 1
+//   time_base=1/90000
+//   pictures=<number of pictures>
+//   audio_delay=<hexadecimal track id> <milliseconds>    (once per track)
+//   <empty line>
+//
+// followed by one binary record per picture: a byte with flags (1 = has
+// pts, 2 = has dts, 4 = discontinuity before this picture), then the dts
+// minus the previous dts, then the pts minus the dts (or minus the
+// previous pts, if there is no dts). Both are zigzag encoded varints.
+//
+// The discontinuity flag is on the first picture of the new timeline in
+// display order. After a jump before an open GOP that is the first of
+// its leading B pictures, not the I picture decoded first.
+class Timestamps {
+public:
+    enum PictureFlags {
+        HAS_PTS = 1,
+        HAS_DTS = 2,
+        DISCONTINUITY = 4
+    };
+
+    struct Picture {
+        int64_t pts;
+        int64_t dts;
+        bool discontinuity;
+    };
+
+    struct AudioDelay {
+        int id;
+        int64_t milliseconds;
+    };
+
+    Timestamps();
+
+    void setTimeBase(AVRational _time_base);
+
+    // Must be called in decoding order. Missing timestamps are
+    // AV_NOPTS_VALUE. The timestamps jumping backwards, or forwards by
+    // more than a few seconds, is a discontinuity.
+    Picture makePicture(int64_t pts, int64_t dts);
+
+    // The pictures of one D2V data line, in the order of its flags, with
+    // any discontinuity already moved to the first picture displayed on
+    // the new timeline.
+    void addLine(const std::vector<Picture> &line);
+
+    void addAudioDelay(int id, int64_t milliseconds);
+
+    bool write(FILE *file);
+
+    bool read(const std::string &path);
+
+    AVRational getTimeBase() const;
+
+    const std::vector<Picture> &getPictures() const;
+
+    const std::vector<AudioDelay> &getAudioDelays() const;
+
+    // The picture being displayed at the given number of seconds after the
+    // first picture, with the discontinuities removed, or -1. Only works
+    // after read().
+    int64_t getPictureAtTime(double seconds) const;
+
+    const std::string &getError() const;
+
+private:
+    AVRational time_base;
+    std::vector<Picture> pictures;
+    std::vector<AudioDelay> audio_delays;
+
+    int64_t last_timestamp;
+
+    // (time since the first picture, picture number), sorted.
+    std::vector<std::pair<int64_t, int64_t> > timeline;
+
+    std::string error;
+
+
+    void buildTimeline();
+};
+
+
+#endif // D2V_WITCH_TIMESTAMPS_H
@@ -0,0 +1,140 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+#include <cinttypes>
+
+#include "Trace.h"
+#include "JSON.h"
+
+
+Trace::Trace(size_t _capacity, int _sampling)
+    : capacity(_capacity)
+    , sampling(_sampling)
+    , scopes{ }
+    , epoch(Clock::now())
+    , next_event(0)
+    , recorded_events(0)
+{
+    if (capacity < 1)
+        capacity = 1;
+
+    if (sampling < 1)
+        sampling = 1;
+
+    setThreadName("main");
+}
+
+
+bool Trace::sample(const char *name) {
+    if (sampling == 1)
+        return true;
+
+    std::lock_guard<std::mutex> lock(scopes_mutex);
+
+    return scopes[name]++ % sampling == 0;
+}
+
+
+int64_t Trace::now() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - epoch).count();
+}
+
+
+// Must be called with the mutex locked.
+int Trace::getThread() {
+    auto it = threads.find(std::this_thread::get_id());
+    if (it != threads.end())
+        return it->second;
+
+    int thread = thread_names.size() + 1;
+    threads.insert({ std::this_thread::get_id(), thread });
+    thread_names.push_back("thread " + std::to_string(thread));
+
+    return thread;
+}
+
+
+void Trace::record(const char *category, const char *name, int64_t start, int64_t end) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Event event = { category, name, getThread(), start, end - start };
+
+    if (events.size() < capacity)
+        events.push_back(event);
+    else
+        events[next_event] = event;
+
+    next_event = (next_event + 1) % capacity;
+    recorded_events++;
+}
+
+
+void Trace::setThreadName(const std::string &name) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    thread_names[getThread() - 1] = name;
+}
+
+
+bool Trace::write(FILE *file) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    bool okay = fprintf(file,
+                        "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"sampling\":%d,\"recorded_events\":%" PRIu64 ",\"dropped_events\":%" PRIu64 "},\"traceEvents\":[\n",
+                        sampling,
+                        recorded_events,
+                        recorded_events - events.size()) >= 0;
+
+    for (size_t i = 0; i < thread_names.size() && okay; i++)
+        okay = fprintf(file,
+                       "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+                       (int)i + 1,
+                       escapeJSON(thread_names[i]).c_str()) >= 0;
+
+    // Oldest first.
+    size_t first = events.size() < capacity ? 0 : next_event;
+
+    for (size_t i = 0; i < events.size() && okay; i++) {
+        const Event &event = events[(first + i) % events.size()];
+
+        okay = fprintf(file,
+                       "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%" PRId64 ",\"dur\":%" PRId64 "},\n",
+                       event.name,
+                       event.category,
+                       event.thread,
+                       event.start,
+                       event.duration) >= 0;
+    }
+
+    // Chrome's parser doesn't like a comma after the last event.
+    if (okay)
+        okay = fprintf(file,
+                       "{\"name\":\"trace_end\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":1,\"ts\":%" PRId64 "}\n]}\n",
+                       now()) >= 0;
+
+    if (!okay)
+        error = "Failed to write trace: fprintf() failed.";
+
+    return okay;
+}
+
+
+const std::string &Trace::getError() const {
+    return error;
+}
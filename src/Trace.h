@@ -0,0 +1,121 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+#ifndef D2V_WITCH_TRACE_H
+#define D2V_WITCH_TRACE_H
+
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+// Records how long some parts of the indexing take, and on which thread,
+// and writes them in the Chrome trace event format, which chrome://tracing
+// and Perfetto can load. Only the most recent events are kept, so the
+// memory used doesn't depend on the size of the input.
+class Trace {
+    typedef std::chrono::steady_clock Clock;
+
+    struct Event {
+        const char *category;
+        const char *name;
+        int thread;
+        int64_t start;
+        int64_t duration;
+    };
+
+    size_t capacity;
+    int sampling;
+
+    // Scopes seen so far, per name, so that every kind of scope is
+    // sampled, however the different kinds alternate.
+    std::mutex scopes_mutex;
+    std::unordered_map<const char *, uint64_t> scopes;
+
+    Clock::time_point epoch;
+
+    std::mutex mutex;
+    std::vector<Event> events;
+    size_t next_event;
+    uint64_t recorded_events;
+    std::unordered_map<std::thread::id, int> threads;
+    std::vector<std::string> thread_names;
+
+    std::string error;
+
+
+    int getThread();
+
+public:
+    // Keeps at most capacity events. Only one in sampling scopes with the
+    // same name is recorded.
+    Trace(size_t _capacity, int _sampling);
+
+    // Whether the next scope with this name should be recorded. Names are
+    // told apart by their address. Thread safe.
+    bool sample(const char *name);
+
+    // Microseconds since the trace was created.
+    int64_t now() const;
+
+    // Thread safe.
+    void record(const char *category, const char *name, int64_t start, int64_t end);
+
+    // Names the calling thread's track. The thread that creates the trace
+    // is called "main".
+    void setThreadName(const std::string &name);
+
+    bool write(FILE *file);
+
+    const std::string &getError() const;
+};
+
+
+// Records the lifetime of the object as an event, if the trace is not null.
+class TraceScope {
+    Trace *trace;
+    const char *category;
+    const char *name;
+    int64_t start;
+
+public:
+    TraceScope(Trace *_trace, const char *_category, const char *_name)
+        : trace(_trace && _trace->sample(_name) ? _trace : nullptr)
+        , category(_category)
+        , name(_name)
+        , start(trace ? trace->now() : 0)
+    { }
+
+    ~TraceScope() {
+        if (trace)
+            trace->record(category, name, start, trace->now());
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+};
+
+
+#endif // D2V_WITCH_TRACE_H
@@ -0,0 +1,313 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#include <algorithm>
+#include <cinttypes>
+#include <thread>
+
+#include "FakeFile.h"
+#include "FFMPEG.h"
+#include "MPEGParser.h"
+#include "Verifier.h"
+
+
+Verifier::Verifier(const D2VFile &_d2v, int _samples, int _threads, bool _decode)
+    : d2v(_d2v)
+    , samples(_samples)
+    , threads(_threads)
+    , decode(_decode)
+    , sampled_lines{ }
+    , problems{ }
+    , thread_errors{ }
+    , error{ }
+{ }
+
+
+std::string Verifier::checkLine(FFMPEG &f, AVStream *video_stream, const FakeFile &fake_file, const D2V::DataLine &line) {
+    char where[100] = { 0 };
+    snprintf(where, 100, "file %d, position %" PRId64 ": ", line.file, line.position);
+
+    if (line.position >= fake_file[line.file].size)
+        return std::string(where) + "the position is beyond the end of the file.";
+
+    int64_t target = line.position;
+    for (int i = 0; i < line.file; i++)
+        target += fake_file[i].size;
+
+    if (av_seek_frame(f.fctx, -1, target, AVSEEK_FLAG_BYTE) < 0)
+        return std::string(where) + "seeking failed.";
+
+    AVPacket packet;
+    av_init_packet(&packet);
+
+    std::string problem = "no video packet found.";
+
+    // In case seeking didn't really work.
+    int packets_before_target = 0;
+
+    while (av_read_frame(f.fctx, &packet) == 0) {
+        if (packet.stream_index != video_stream->index || packet.pos < target) {
+            av_free_packet(&packet);
+
+            if (++packets_before_target > 1000) {
+                problem = "seeking didn't reach the position.";
+                break;
+            }
+
+            continue;
+        }
+
+        if (packet.pos > target) {
+            problem = "no video packet starts here. The next one starts at " + std::to_string(packet.pos - target) + " bytes after it.";
+            av_free_packet(&packet);
+            break;
+        }
+
+        MPEGParser parser;
+        parser.parseData(packet.data, packet.size);
+
+        if (parser.picture_coding_type != MPEGParser::I_PICTURE) {
+            problem = "expected an I picture, found picture type " + std::to_string(parser.picture_coding_type) + ".";
+        } else if (!!(line.info & D2V::INFO_STARTS_NEW_GOP) != parser.group_of_pictures_header) {
+            problem = parser.group_of_pictures_header ? "unexpected GOP header." : "expected a GOP header.";
+        } else if ((line.info & D2V::INFO_CLOSED_GOP) && !parser.closed_gop) {
+            // D2V clears the closed GOP flag sometimes, but never sets it when the GOP isn't closed.
+            problem = "expected a closed GOP.";
+        } else if (parser.sequence_header && !!(line.info & D2V::INFO_PROGRESSIVE_SEQUENCE) != parser.progressive_sequence) {
+            // Without a sequence header here, D2V used the flag of an
+            // earlier one, which this fresh parser doesn't know.
+            problem = "the progressive_sequence flag doesn't match.";
+        } else if (decode) {
+            problem = checkSkip(f, video_stream, &packet, line);
+        } else {
+            problem.clear();
+        }
+
+        av_free_packet(&packet);
+
+        break;
+    }
+
+    if (problem.size())
+        return std::string(where) + problem;
+
+    return problem;
+}
+
+
+std::string Verifier::checkSkip(FFMPEG &f, AVStream *video_stream, AVPacket *first_packet, const D2V::DataLine &line) {
+    AVFrame *frame = av_frame_alloc();
+    if (!frame)
+        return "failed to allocate AVFrame.";
+
+    size_t pictures = line.flags.size();
+    size_t fed_pictures = 0;
+    int decoded_frames = 0;
+
+    AVPacket packet;
+    av_init_packet(&packet);
+
+    while (fed_pictures < pictures) {
+        AVPacket *current = first_packet;
+
+        if (fed_pictures > 0) {
+            if (av_read_frame(f.fctx, &packet) < 0)
+                break;
+
+            if (packet.stream_index != video_stream->index) {
+                av_free_packet(&packet);
+                continue;
+            }
+
+            current = &packet;
+        }
+
+        int got_frame = 0;
+        // Errors in individual packets are not fatal. It's what the decoder does with them.
+        avcodec_decode_video2(f.avctx, frame, &got_frame, current);
+        if (got_frame) {
+            decoded_frames++;
+            av_frame_unref(frame);
+        }
+
+        if (current == &packet)
+            av_free_packet(&packet);
+
+        fed_pictures++;
+    }
+
+    // Get the pictures still held back for reordering.
+    av_init_packet(&packet);
+    packet.data = nullptr;
+    packet.size = 0;
+
+    int got_frame;
+    do {
+        got_frame = 0;
+
+        if (avcodec_decode_video2(f.avctx, frame, &got_frame, &packet) < 0)
+            break;
+
+        if (got_frame) {
+            decoded_frames++;
+            av_frame_unref(frame);
+        }
+    } while (got_frame);
+
+    avcodec_flush_buffers(f.avctx);
+    av_frame_free(&frame);
+
+    if (fed_pictures < pictures)
+        return "the file ended after " + std::to_string(fed_pictures) + " of the line's " + std::to_string(pictures) + " pictures.";
+
+    int expected_frames = (int)pictures - line.skip;
+    if (decoded_frames != expected_frames)
+        return "decoding the line's " + std::to_string(pictures) + " pictures returned " + std::to_string(decoded_frames) +
+               " frames, but the skip field (" + std::to_string(line.skip) + ") means " + std::to_string(expected_frames) + " were expected.";
+
+    return std::string();
+}
+
+
+void Verifier::work(int thread, size_t first, size_t last) {
+    FakeFile fake_file;
+    for (size_t i = 0; i < d2v.files.size(); i++)
+        fake_file.push_back(d2v.files[i]);
+
+    if (!fake_file.open()) {
+        thread_errors[thread] = fake_file.getError();
+        fake_file.close();
+        return;
+    }
+
+    FFMPEG f;
+    if (!f.initFormat(fake_file)) {
+        thread_errors[thread] = f.getError();
+        f.cleanup();
+        fake_file.close();
+        return;
+    }
+
+    int video_id = d2v.getVideoId();
+
+    AVStream *video_stream = nullptr;
+    for (unsigned i = 0; i < f.fctx->nb_streams; i++) {
+        AVStream *stream = f.fctx->streams[i];
+        stream->discard = AVDISCARD_ALL;
+
+        if (!video_stream && stream->codec->codec_type == AVMEDIA_TYPE_VIDEO && (video_id == -1 || stream->id == video_id)) {
+            stream->discard = AVDISCARD_DEFAULT;
+            video_stream = stream;
+        }
+    }
+
+    if (!video_stream) {
+        thread_errors[thread] = "Couldn't find the video track.";
+        f.cleanup();
+        fake_file.close();
+        return;
+    }
+
+    if (decode && !f.initCodec(video_stream->codec->codec_id, video_stream->codec->extradata, video_stream->codec->extradata_size)) {
+        thread_errors[thread] = f.getError();
+        f.cleanup();
+        fake_file.close();
+        return;
+    }
+
+    for (size_t i = first; i < last; i++)
+        problems[i] = checkLine(f, video_stream, fake_file, d2v.lines[sampled_lines[i]]);
+
+    f.cleanup();
+    fake_file.close();
+}
+
+
+bool Verifier::verify() {
+    if (!d2v.lines.size()) {
+        error = "The d2v file has no data lines.";
+        return false;
+    }
+
+    size_t count = d2v.lines.size();
+    if (samples > 0 && (size_t)samples < count)
+        count = samples;
+
+    // Evenly spaced, always including the first line.
+    sampled_lines.clear();
+    for (size_t i = 0; i < count; i++)
+        sampled_lines.push_back(i * d2v.lines.size() / count);
+
+    // Sorted by offset, so every thread only ever seeks forward.
+    std::stable_sort(sampled_lines.begin(), sampled_lines.end(), [this] (size_t a, size_t b) {
+        const D2V::DataLine &line_a = d2v.lines[a];
+        const D2V::DataLine &line_b = d2v.lines[b];
+
+        if (line_a.file != line_b.file)
+            return line_a.file < line_b.file;
+        return line_a.position < line_b.position;
+    });
+
+    problems.assign(sampled_lines.size(), std::string());
+
+    int thread_count = std::max(1, std::min(threads, (int)sampled_lines.size()));
+    thread_errors.assign(thread_count, std::string());
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < thread_count; i++) {
+        size_t first = sampled_lines.size() * i / thread_count;
+        size_t last = sampled_lines.size() * (i + 1) / thread_count;
+
+        workers.push_back(std::thread(&Verifier::work, this, i, first, last));
+    }
+
+    for (int i = 0; i < thread_count; i++)
+        workers[i].join();
+
+    for (int i = 0; i < thread_count; i++) {
+        if (thread_errors[i].size()) {
+            error = thread_errors[i];
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+int Verifier::getCheckedLines() const {
+    return sampled_lines.size();
+}
+
+
+std::vector<std::string> Verifier::getProblems() const {
+    std::vector<std::string> messages;
+
+    for (size_t i = 0; i < problems.size(); i++)
+        if (problems[i].size())
+            messages.push_back("Line " + std::to_string(sampled_lines[i]) + ", " + problems[i]);
+
+    return messages;
+}
+
+
+const std::string &Verifier::getError() const {
+    return error;
+}
@@ -0,0 +1,77 @@
+/*
+
+Copyright (c) 2016, John Smith
+
+Permission to use, copy, modify, and/or distribute this software for
+any purpose with or without fee is hereby granted, provided that the
+above copyright notice and this permission notice appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR
+BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES
+OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS,
+WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION,
+ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS
+SOFTWARE.
+
+*/
+
+
+#ifndef D2V_WITCH_VERIFIER_H
+#define D2V_WITCH_VERIFIER_H
+
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "D2VFile.h"
+
+
+// Checks that the data lines of an existing D2V file still point at
+// the start of the right GOPs, by seeking to some of them and looking at
+// the first video packet found there. Optionally, the GOPs are also
+// decoded, to check the number of leading pictures to skip.
+class Verifier {
+    const D2VFile &d2v;
+    int samples;
+    int threads;
+    bool decode;
+
+    // Indices into d2v.lines, in file order.
+    std::vector<size_t> sampled_lines;
+
+    // One per sampled line. Empty means the line is fine.
+    std::vector<std::string> problems;
+
+    std::vector<std::string> thread_errors;
+
+    std::string error;
+
+
+    std::string checkLine(FFMPEG &f, AVStream *video_stream, const FakeFile &fake_file, const D2V::DataLine &line);
+
+    // Decodes the pictures of the line, starting with first_packet, and
+    // compares the number of frames the decoder returns with the number
+    // of pictures minus the "skip" field.
+    std::string checkSkip(FFMPEG &f, AVStream *video_stream, AVPacket *first_packet, const D2V::DataLine &line);
+
+    void work(int thread, size_t first, size_t last);
+
+public:
+    // samples = 0 means all the lines will be checked.
+    Verifier(const D2VFile &_d2v, int _samples, int _threads, bool _decode);
+
+    bool verify();
+
+    int getCheckedLines() const;
+
+    // Messages about the lines that didn't match, in file order.
+    std::vector<std::string> getProblems() const;
+
+    const std::string &getError() const;
+};
+
+
+#endif // D2V_WITCH_VERIFIER_H